@@ -2,6 +2,9 @@
 // Copyright 2025 The LineageOS Project
 // SPDX-License-Identifier: MIT
 
+use crate::handle::{self, BufferInfo, DRM_FORMAT_INVALID, DRM_FORMAT_MOD_LINEAR, fourcc};
+use crate::metadata;
+use android_hardware_common::aidl::android::hardware::common::NativeHandle::NativeHandle;
 use android_hardware_graphics_allocator::aidl::android::hardware::graphics::allocator::{
     AllocationError::AllocationError,
     AllocationResult::AllocationResult,
@@ -9,11 +12,40 @@ use android_hardware_graphics_allocator::aidl::android::hardware::graphics::allo
     IAllocator::BnAllocator,
     IAllocator::IAllocator,
 };
-use binder::{BinderFeatures, ExceptionCode, Interface, Result, Status, Strong};
-use log::{LevelFilter, info};
+use android_hardware_graphics_common::aidl::android::hardware::graphics::common::{
+    BufferUsage::BufferUsage, PixelFormat::PixelFormat,
+};
+use binder::{
+    BinderFeatures, ExceptionCode, Interface, ParcelFileDescriptor, Result, Status, Strong,
+};
+use log::{LevelFilter, error, info};
+use std::collections::HashMap;
+use std::env;
+use std::process;
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::{Arc, RwLock};
 
 const LOG_TAG: &str = "graphics_allocator_service_hbm";
 
+// the default max number of binder threads, in addition to the main thread
+const DEFAULT_BINDER_THREAD_COUNT: u32 = 2;
+
+// Parses `--binder-threads <count>` from the command line.  An init rc can pass it to size the
+// binder thread pool for the device.
+fn binder_thread_count() -> u32 {
+    let mut args = env::args().skip(1);
+    while let Some(arg) = args.next() {
+        if arg == "--binder-threads" {
+            if let Some(count) = args.next().and_then(|count| count.parse().ok()) {
+                return count;
+            }
+            error!("bad --binder-threads value");
+        }
+    }
+
+    DEFAULT_BINDER_THREAD_COUNT
+}
+
 pub fn main() {
     let logger_success = logger::init(
         logger::Config::default().with_tag_on_device(LOG_TAG).with_max_level(LevelFilter::Trace),
@@ -22,7 +54,7 @@ pub fn main() {
         panic!("{LOG_TAG}: Failed to start logger.");
     }
 
-    binder::ProcessState::set_thread_pool_max_thread_count(0);
+    binder::ProcessState::set_thread_pool_max_thread_count(binder_thread_count());
 
     let allocator_service = AllocatorService::default();
     let allocator_service_binder = BnAllocator::new_binder(allocator_service, BinderFeatures::default());
@@ -34,17 +66,115 @@ pub fn main() {
     binder::ProcessState::join_thread_pool()
 }
 
+// Returns the DRM format and the bytes per pixel of the first plane of an Android pixel format.
+fn to_drm_format(pixel_format: PixelFormat) -> Option<(u32, u32)> {
+    let fmt = match pixel_format {
+        PixelFormat::BLOB => (DRM_FORMAT_INVALID, 1),
+        PixelFormat::R_8 => (fourcc(b'R', b'8', b' ', b' '), 1),
+        PixelFormat::RGB_565 => (fourcc(b'R', b'G', b'1', b'6'), 2),
+        PixelFormat::RGB_888 => (fourcc(b'B', b'G', b'2', b'4'), 3),
+        PixelFormat::RGBA_8888 => (fourcc(b'A', b'B', b'2', b'4'), 4),
+        PixelFormat::RGBX_8888 => (fourcc(b'X', b'B', b'2', b'4'), 4),
+        PixelFormat::BGRA_8888 => (fourcc(b'A', b'R', b'2', b'4'), 4),
+        PixelFormat::RGBA_1010102 => (fourcc(b'A', b'B', b'3', b'0'), 4),
+        PixelFormat::RGBA_FP16 => (fourcc(b'A', b'B', b'4', b'H'), 8),
+        PixelFormat::YCBCR_420_888 => (fourcc(b'N', b'V', b'1', b'2'), 1),
+        PixelFormat::YCRCB_420_SP => (fourcc(b'N', b'V', b'2', b'1'), 1),
+        PixelFormat::YCBCR_P010 => (fourcc(b'P', b'0', b'1', b'0'), 2),
+        PixelFormat::YV12 => (fourcc(b'Y', b'V', b'1', b'2'), 1),
+        // the format is up to the consumers; pick one that every consumer can handle
+        PixelFormat::IMPLEMENTATION_DEFINED => (fourcc(b'X', b'B', b'2', b'4'), 4),
+        _ => return None,
+    };
+
+    Some(fmt)
+}
+
+fn to_status(err: hbm::Error) -> Status {
+    let code = match err {
+        hbm::Error::User => AllocationError::BAD_DESCRIPTOR,
+        hbm::Error::Unsupported => AllocationError::UNSUPPORTED,
+        _ => AllocationError::NO_RESOURCES,
+    };
+
+    Status::new_service_specific_error(code.0, None)
+}
+
+fn unsupported() -> Status {
+    Status::new_service_specific_error(AllocationError::UNSUPPORTED.0, None)
+}
+
+// Classes depend only on the formats and the usages of the descriptors.
+#[derive(Clone, Copy, Eq, Hash, PartialEq)]
+struct ClassKey {
+    pixel_format: PixelFormat,
+    usage: BufferUsage,
+}
+
 pub struct AllocatorService {
-    // Add any necessary fields here
+    device: Option<Arc<hbm::Device>>,
+    // this is read-mostly, because clients allocate from a few descriptors over and over
+    class_cache: RwLock<HashMap<ClassKey, Arc<hbm::Class>>>,
 }
 
 impl Interface for AllocatorService {}
 
 impl AllocatorService {
     fn new() -> Self {
-        Self {
-            // Initialize fields here
+        let device = hbm::dma_heap::Builder::new()
+            .heap_name("system")
+            .build()
+            .and_then(|backend| hbm::Builder::new().add_backend(backend).build())
+            .inspect_err(|err| error!("failed to create device: {err}"))
+            .ok();
+
+        Self { device, class_cache: Default::default() }
+    }
+
+    fn device(&self) -> Result<&Arc<hbm::Device>> {
+        self.device
+            .as_ref()
+            .ok_or_else(|| Status::new_exception(ExceptionCode::ILLEGAL_STATE, None))
+    }
+
+    fn classify(&self, key: ClassKey) -> Result<hbm::Class> {
+        let (fmt, _) = to_drm_format(key.pixel_format).ok_or_else(unsupported)?;
+
+        let flags = handle::usage_flags(key.usage.0 as u64);
+        let mut desc = hbm::Description::new().flags(flags).format(hbm::Format(fmt));
+        if fmt != DRM_FORMAT_INVALID {
+            desc = desc.modifier(hbm::Modifier(DRM_FORMAT_MOD_LINEAR));
+        }
+
+        self.device()?.classify(desc, &[hbm::Usage::Unused]).map_err(to_status)
+    }
+
+    fn get_class(&self, key: ClassKey) -> Result<Arc<hbm::Class>> {
+        if let Some(class) = self.class_cache.read().unwrap().get(&key) {
+            return Ok(class.clone());
         }
+
+        // classify without the lock held; two threads can classify the same key, which is
+        // harmless
+        let class = Arc::new(self.classify(key)?);
+        let class = self.class_cache.write().unwrap().entry(key).or_insert(class).clone();
+
+        Ok(class)
+    }
+
+    fn allocate_buffer(
+        &self,
+        class: &hbm::Class,
+        extent: hbm::Extent,
+        name: &str,
+    ) -> hbm::Result<(hbm::Layout, ParcelFileDescriptor)> {
+        let device = self.device.clone().ok_or(hbm::Error::Device)?;
+
+        let mut bo = hbm::Bo::with_constraint(device, class, extent, None)?;
+        bo.bind_memory(hbm::MemoryType::empty(), None)?;
+        let dmabuf = bo.export_dma_buf(Some(dma_buf_name(name)))?;
+
+        Ok((bo.layout(), ParcelFileDescriptor::new(dmabuf)))
     }
 }
 
@@ -54,20 +184,127 @@ impl Default for AllocatorService {
     }
 }
 
+fn descriptor_name(descriptor: &BufferDescriptorInfo) -> String {
+    let name = &descriptor.name;
+    let len = name.iter().position(|&c| c == 0).unwrap_or(name.len());
+    String::from_utf8_lossy(&name[..len]).into_owned()
+}
+
+// the kernel rejects dma-buf names longer than DMA_BUF_NAME_LEN - 1
+const DMA_BUF_NAME_MAX: usize = 31;
+
+fn dma_buf_name(name: &str) -> &str {
+    let mut max = DMA_BUF_NAME_MAX.min(name.len());
+    while !name.is_char_boundary(max) {
+        max -= 1;
+    }
+
+    &name[..max]
+}
+
+// Returns a buffer id that is unique across processes.
+fn next_buffer_id() -> u64 {
+    static NEXT_ID: AtomicU32 = AtomicU32::new(0);
+
+    let id = NEXT_ID.fetch_add(1, Ordering::Relaxed);
+    ((process::id() as u64) << 32) | id as u64
+}
+
+fn descriptor_extent(descriptor: &BufferDescriptorInfo) -> Result<hbm::Extent> {
+    let bad_descriptor =
+        || Status::new_service_specific_error(AllocationError::BAD_DESCRIPTOR.0, None);
+
+    let width = u32::try_from(descriptor.width).map_err(|_| bad_descriptor())?;
+    let height = u32::try_from(descriptor.height).map_err(|_| bad_descriptor())?;
+    if width == 0 || height == 0 || descriptor.layerCount != 1 {
+        return Err(bad_descriptor());
+    }
+
+    let extent = if descriptor.format == PixelFormat::BLOB {
+        if height != 1 {
+            return Err(bad_descriptor());
+        }
+        hbm::Extent::Buffer(width as hbm::Size)
+    } else {
+        hbm::Extent::Image(width, height)
+    };
+
+    Ok(extent)
+}
+
 impl IAllocator for AllocatorService {
-    fn allocate(&self, descriptor: &[u8], count: i32) -> Result<AllocationResult> {
+    // this takes an IMapper 4.x-encoded descriptor, which is unused with the stable-C mapper
+    fn allocate(&self, _descriptor: &[u8], count: i32) -> Result<AllocationResult> {
         info!("Allocator allocate called with count={}", count);
         Err(Status::new_exception(ExceptionCode::UNSUPPORTED_OPERATION, None))
     }
 
     fn allocate2(&self, descriptor: &BufferDescriptorInfo, count: i32) -> Result<AllocationResult> {
         info!("Allocator allocate2 called with count={}", count);
-        Err(Status::new_exception(ExceptionCode::UNSUPPORTED_OPERATION, None))
+
+        let count = usize::try_from(count)
+            .map_err(|_| Status::new_exception(ExceptionCode::ILLEGAL_ARGUMENT, None))?;
+        let reserved_size = u64::try_from(descriptor.reservedSize)
+            .map_err(|_| Status::new_exception(ExceptionCode::ILLEGAL_ARGUMENT, None))?;
+        if !descriptor.additionalOptions.is_empty() {
+            return Err(unsupported());
+        }
+
+        let key = ClassKey { pixel_format: descriptor.format, usage: descriptor.usage };
+        let class = self.get_class(key)?;
+        let extent = descriptor_extent(descriptor)?;
+        let name = descriptor_name(descriptor);
+        let (fmt, bpp) = to_drm_format(descriptor.format).ok_or_else(unsupported)?;
+
+        // classify once and allocate all buffers in one pass
+        let mut stride = 0;
+        let mut buffers = Vec::with_capacity(count);
+        for _ in 0..count {
+            let (layout, dmabuf) =
+                self.allocate_buffer(&class, extent, &name).map_err(to_status)?;
+
+            if fmt != DRM_FORMAT_INVALID {
+                stride = i32::try_from(layout.strides[0] / bpp as hbm::Size)
+                    .map_err(|_| unsupported())?;
+            }
+
+            let info = BufferInfo {
+                width: descriptor.width as u32,
+                height: descriptor.height as u32,
+                pixel_format: descriptor.format.0,
+                format: fmt,
+                usage: descriptor.usage.0 as u64,
+                layout,
+            };
+            let ints = info.encode().ok_or_else(unsupported)?;
+            let (ro_metadata, rw_metadata) =
+                metadata::create(&info, &name, next_buffer_id(), reserved_size).map_err(|err| {
+                    error!("failed to create metadata: {err}");
+                    Status::new_service_specific_error(AllocationError::NO_RESOURCES.0, None)
+                })?;
+
+            buffers.push(NativeHandle {
+                fds: vec![
+                    dmabuf,
+                    ParcelFileDescriptor::new(ro_metadata),
+                    ParcelFileDescriptor::new(rw_metadata),
+                ],
+                ints,
+            });
+        }
+
+        Ok(AllocationResult { stride, buffers })
     }
 
     fn isSupported(&self, descriptor: &BufferDescriptorInfo) -> Result<bool> {
         info!("Allocator isSupported called");
-        Err(Status::new_exception(ExceptionCode::UNSUPPORTED_OPERATION, None))
+
+        if descriptor_extent(descriptor).is_err() || descriptor.reservedSize < 0 {
+            return Ok(false);
+        }
+
+        let key = ClassKey { pixel_format: descriptor.format, usage: descriptor.usage };
+        Ok(self.get_class(key).is_ok())
     }
 
     fn getIMapperLibrarySuffix(&self) -> Result<String> {
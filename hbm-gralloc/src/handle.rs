@@ -0,0 +1,174 @@
+// Copyright 2025 Google LLC
+// SPDX-License-Identifier: MIT
+
+//! Buffer handles.
+//!
+//! A buffer handle is the native handle of a buffer that is transported between processes.  It
+//! consists of the dma-buf of the BO and the two metadata regions of the buffer, followed by the
+//! ints that describe the buffer.  The ints carry everything needed to re-create the BO with
+//! `hbm::Bo::with_layout`, such that importers never query the allocator.
+//!
+//! The ints are versioned and packed.  Only the offsets and the strides of the planes in use are
+//! transported:
+//!
+//! ```text
+//!   magic
+//!   version | (plane_count << 16)
+//!   width, height, pixel_format, format
+//!   usage (lo, hi), size (lo, hi), modifier (lo, hi)
+//!   offsets[plane_count]
+//!   strides[plane_count]
+//! ```
+
+// the allocator and the mapper use different parts of this module
+#![allow(dead_code)]
+
+pub const fn fourcc(a: u8, b: u8, c: u8, d: u8) -> u32 {
+    (a as u32) | ((b as u32) << 8) | ((c as u32) << 16) | ((d as u32) << 24)
+}
+
+pub const DRM_FORMAT_INVALID: u32 = 0;
+pub const DRM_FORMAT_MOD_LINEAR: u64 = 0;
+
+// Android buffer usage bits that affect BOs
+pub const USAGE_CPU_READ_MASK: u64 = 0xf;
+pub const USAGE_CPU_READ_OFTEN: u64 = 0x3;
+pub const USAGE_CPU_WRITE_MASK: u64 = 0xf0;
+pub const USAGE_CPU_WRITE_OFTEN: u64 = 0x30;
+pub const USAGE_PROTECTED: u64 = 1 << 14;
+
+// Returns the BO flags of an Android buffer usage.
+pub fn usage_flags(usage: u64) -> hbm::Flags {
+    // buffers are always exported
+    let mut flags = hbm::Flags::EXTERNAL;
+
+    if usage & (USAGE_CPU_READ_MASK | USAGE_CPU_WRITE_MASK) != 0 {
+        flags |= hbm::Flags::MAP;
+    }
+    if usage & USAGE_CPU_READ_MASK == USAGE_CPU_READ_OFTEN {
+        flags |= hbm::Flags::CPU_READBACK;
+    }
+    if usage & USAGE_CPU_WRITE_MASK == USAGE_CPU_WRITE_OFTEN {
+        flags |= hbm::Flags::CPU_STREAM;
+    }
+    if usage & USAGE_PROTECTED != 0 {
+        flags |= hbm::Flags::PROTECTED;
+    }
+
+    flags
+}
+
+// Returns the CPU access type of an Android buffer usage, if any.
+pub fn usage_access(usage: u64) -> Option<hbm::Access> {
+    let read = usage & USAGE_CPU_READ_MASK != 0;
+    let write = usage & USAGE_CPU_WRITE_MASK != 0;
+
+    match (read, write) {
+        (true, true) => Some(hbm::Access::ReadWrite),
+        (true, false) => Some(hbm::Access::Read),
+        (false, true) => Some(hbm::Access::Write),
+        (false, false) => None,
+    }
+}
+
+// the number of fds of a buffer handle, which are the dma-buf, the read-only metadata region, and
+// the read-write metadata region
+pub const FD_COUNT: usize = 3;
+
+const MAGIC: u32 = fourcc(b'H', b'B', b'M', b'H');
+const VERSION: u32 = 1;
+
+// the number of ints of a buffer handle before the offsets and the strides
+const HEADER_INT_COUNT: usize = 12;
+
+// The description of a buffer.
+#[derive(Clone, Debug, PartialEq)]
+pub struct BufferInfo {
+    pub width: u32,
+    pub height: u32,
+    // the Android pixel format
+    pub pixel_format: i32,
+    // the DRM format, or DRM_FORMAT_INVALID for blobs
+    pub format: u32,
+    // the Android buffer usage
+    pub usage: u64,
+    pub layout: hbm::Layout,
+}
+
+fn split(val: u64) -> [i32; 2] {
+    [val as u32 as i32, (val >> 32) as u32 as i32]
+}
+
+fn join(lo: i32, hi: i32) -> u64 {
+    (lo as u32 as u64) | ((hi as u32 as u64) << 32)
+}
+
+impl BufferInfo {
+    // Returns the number of ints of the buffer handle.
+    pub fn int_count(&self) -> usize {
+        HEADER_INT_COUNT + 2 * self.layout.plane_count as usize
+    }
+
+    // Encodes the ints of a buffer handle.  This returns None if the layout does not fit.
+    pub fn encode(&self) -> Option<Vec<i32>> {
+        let layout = &self.layout;
+        let plane_count = layout.plane_count as usize;
+
+        let mut ints = Vec::with_capacity(self.int_count());
+        ints.push(MAGIC as i32);
+        ints.push((VERSION | (layout.plane_count << 16)) as i32);
+        ints.push(self.width as i32);
+        ints.push(self.height as i32);
+        ints.push(self.pixel_format);
+        ints.push(self.format as i32);
+        ints.extend(split(self.usage));
+        ints.extend(split(layout.size));
+        ints.extend(split(layout.modifier.0));
+        for &offset in layout.offsets.get(..plane_count)? {
+            ints.push(u32::try_from(offset).ok()? as i32);
+        }
+        for &stride in layout.strides.get(..plane_count)? {
+            ints.push(u32::try_from(stride).ok()? as i32);
+        }
+
+        Some(ints)
+    }
+
+    // Decodes the ints of a buffer handle.
+    pub fn decode(ints: &[i32]) -> Option<Self> {
+        let header = ints.get(..HEADER_INT_COUNT)?;
+        if header[0] as u32 != MAGIC || header[1] as u32 & 0xffff != VERSION {
+            return None;
+        }
+
+        let plane_count = header[1] as u32 >> 16;
+        let max_plane_count = hbm::Layout::default().offsets.len();
+        if plane_count as usize > max_plane_count
+            || ints.len() != HEADER_INT_COUNT + 2 * plane_count as usize
+        {
+            return None;
+        }
+
+        let (offsets, strides) = ints[HEADER_INT_COUNT..].split_at(plane_count as usize);
+        let mut layout = hbm::Layout::new()
+            .size(join(header[8], header[9]))
+            .modifier(hbm::Modifier(join(header[10], header[11])))
+            .plane_count(plane_count);
+        for (plane, (&offset, &stride)) in offsets.iter().zip(strides).enumerate() {
+            layout = layout
+                .offset(plane, offset as u32 as hbm::Size)
+                .stride(plane, stride as u32 as hbm::Size);
+        }
+
+        let info = Self {
+            width: header[2] as u32,
+            height: header[3] as u32,
+            pixel_format: header[4],
+            format: header[5] as u32,
+            usage: join(header[6], header[7]),
+            layout,
+        };
+
+        Some(info)
+    }
+}
@@ -1,8 +1,12 @@
 // Copyright 2024 Google LLC
 // SPDX-License-Identifier: MIT
 
+#[cfg(target_os = "android")]
+mod handle;
 #[cfg(target_os = "android")]
 mod mapper;
+#[cfg(target_os = "android")]
+mod metadata;
 
 #[cfg(target_os = "android")]
 pub use mapper::ANDROID_HAL_MAPPER_VERSION;
@@ -3,6 +3,10 @@
 
 #[cfg(target_os = "android")]
 mod allocator;
+#[cfg(target_os = "android")]
+mod handle;
+#[cfg(target_os = "android")]
+mod metadata;
 
 #[cfg(target_os = "android")]
 use allocator::main;
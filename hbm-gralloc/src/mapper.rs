@@ -1,7 +1,6 @@
 // Copyright 2024 Google LLC
 // SPDX-License-Identifier: MIT
 
-// TODO implement
 // https://android.googlesource.com/platform/hardware/interfaces/+/refs/heads/main/graphics/mapper/stable-c/include/android/hardware/graphics/mapper/IMapper.h
 //
 // To generate the type definitions,
@@ -18,29 +17,389 @@ mod builtin_imapper_stablec_bindgen;
 #[cfg(feature = "builtin-imapper-stablec-bindgen")]
 use builtin_imapper_stablec_bindgen as imapper_stablec_bindgen;
 
+use crate::handle::{self, BufferInfo, DRM_FORMAT_INVALID, DRM_FORMAT_MOD_LINEAR};
+use crate::metadata::{self, Metadata};
 use imapper_stablec_bindgen::{
     buffer_handle_t, native_handle_t, AIMapper, AIMapperV5, AIMapper_BeginDumpBufferCallback,
     AIMapper_DumpBufferCallback, AIMapper_Error, AIMapper_MetadataType,
     AIMapper_MetadataTypeDescription, AIMapper_Version, ARect,
 };
+use std::collections::HashMap;
+use std::ffi::{c_int, c_void, CStr};
+use std::io;
+use std::os::fd::{AsRawFd, BorrowedFd, FromRawFd, OwnedFd};
+use std::sync::{Arc, Mutex, OnceLock, RwLock};
+use std::{ptr, slice};
+
+extern "C" {
+    fn native_handle_clone(handle: *const native_handle_t) -> *mut native_handle_t;
+    fn native_handle_close(handle: *const native_handle_t) -> c_int;
+    fn native_handle_delete(handle: *mut native_handle_t) -> c_int;
+}
+
+// A native handle owned by the mapper.
+struct OwnedHandle(ptr::NonNull<native_handle_t>);
+
+// SAFETY: the native handle is immutable until it is dropped
+unsafe impl Send for OwnedHandle {}
+// SAFETY: the native handle is immutable until it is dropped
+unsafe impl Sync for OwnedHandle {}
+
+impl OwnedHandle {
+    fn fds(&self) -> &[c_int] {
+        // SAFETY: the handle is valid
+        let handle = unsafe { self.0.as_ref() };
+        // SAFETY: the handle has numFds fds followed by numInts ints
+        unsafe { handle.data.as_slice(handle.numFds as usize) }
+    }
+
+    fn ints(&self) -> &[c_int] {
+        // SAFETY: the handle is valid
+        let handle = unsafe { self.0.as_ref() };
+        let len = (handle.numFds + handle.numInts) as usize;
+        // SAFETY: the handle has numFds fds followed by numInts ints
+        let data = unsafe { handle.data.as_slice(len) };
+        &data[handle.numFds as usize..]
+    }
+}
+
+impl Drop for OwnedHandle {
+    fn drop(&mut self) {
+        // SAFETY: the handle is valid and owns its fds
+        unsafe { native_handle_close(self.0.as_ptr()) };
+        // SAFETY: the handle was created by native_handle_clone
+        unsafe { native_handle_delete(self.0.as_ptr()) };
+    }
+}
+
+#[derive(Default)]
+struct BufferState {
+    // the mapping is created on the first lock and is kept until the buffer is freed, such that
+    // lock/unlock cycles do not mmap/munmap
+    mapping: Option<hbm::Mapping>,
+    // the locked range, when the buffer is locked
+    locked: Option<Option<(hbm::Size, hbm::Size)>>,
+}
+
+// SAFETY: the mapping is only handed out to clients as a pointer
+unsafe impl Send for BufferState {}
+
+// An imported buffer.
+struct Buffer {
+    info: BufferInfo,
+    bo: hbm::Bo,
+    metadata: Metadata,
+    state: Mutex<BufferState>,
+    // this is dropped last to keep the fds open while the BO is alive
+    _handle: OwnedHandle,
+}
+
+impl Buffer {
+    // Returns the range of a lock region, or None to lock the entire buffer.
+    fn lock_range(&self, region: ARect) -> Result<Option<(hbm::Size, hbm::Size)>, AIMapper_Error> {
+        // an empty region means the entire buffer
+        if region.left == 0 && region.top == 0 && region.right == 0 && region.bottom == 0 {
+            return Ok(None);
+        }
+
+        let info = &self.info;
+        if region.left < 0
+            || region.top < 0
+            || region.left >= region.right
+            || region.top >= region.bottom
+            || region.right as u32 > info.width
+            || region.bottom as u32 > info.height
+        {
+            return Err(AIMapper_Error::AIMAPPER_ERROR_BAD_VALUE);
+        }
+
+        let layout = &info.layout;
+        let range = if info.format == DRM_FORMAT_INVALID {
+            // a blob is a row of bytes
+            Some((
+                region.left as hbm::Size,
+                (region.right - region.left) as hbm::Size,
+            ))
+        } else if layout.plane_count == 1 && layout.modifier.0 == DRM_FORMAT_MOD_LINEAR {
+            // the rows of a single-plane linear image are contiguous
+            let stride = layout.strides[0];
+            let offset = layout.offsets[0] + region.top as hbm::Size * stride;
+            let size = (region.bottom - region.top) as hbm::Size * stride;
+            Some((offset, size.min(layout.size - offset)))
+        } else {
+            None
+        };
+
+        Ok(range)
+    }
+
+    fn lock(&self, access: hbm::Access, region: ARect) -> Result<*mut c_void, AIMapper_Error> {
+        let range = self.lock_range(region)?;
+
+        let mut state = self.state.lock().unwrap();
+        if state.locked.is_some() {
+            return Err(AIMapper_Error::AIMAPPER_ERROR_BAD_BUFFER);
+        }
+
+        let mapping = match state.mapping {
+            Some(mapping) => mapping,
+            None => {
+                // map with all access types that the usage allows, such that later locks are
+                // covered
+                let map_access = handle::usage_access(self.info.usage)
+                    .ok_or(AIMapper_Error::AIMAPPER_ERROR_BAD_BUFFER)?;
+                let mapping = self
+                    .bo
+                    .map(map_access)
+                    .map_err(|_| AIMapper_Error::AIMAPPER_ERROR_NO_RESOURCES)?;
+                *state.mapping.insert(mapping)
+            }
+        };
+
+        let res = match range {
+            Some((offset, size)) => self.bo.begin_cpu_access_range(access, offset, size),
+            None => self.bo.begin_cpu_access(access),
+        };
+        res.map_err(|_| AIMapper_Error::AIMAPPER_ERROR_BAD_VALUE)?;
+        state.locked = Some(range);
+
+        Ok(mapping.ptr.as_ptr())
+    }
+
+    fn unlock(&self) -> Result<(), AIMapper_Error> {
+        let mut state = self.state.lock().unwrap();
+        if state.locked.take().is_none() {
+            return Err(AIMapper_Error::AIMAPPER_ERROR_BAD_BUFFER);
+        }
+
+        self.bo
+            .end_cpu_access()
+            .map_err(|_| AIMapper_Error::AIMAPPER_ERROR_BAD_BUFFER)
+    }
+
+    fn flush(&self) -> Result<(), AIMapper_Error> {
+        let state = self.state.lock().unwrap();
+        match state.locked {
+            Some(Some((offset, size))) => self.bo.flush_range(offset, size),
+            Some(None) => self.bo.flush(),
+            None => return Err(AIMapper_Error::AIMAPPER_ERROR_BAD_BUFFER),
+        }
+
+        Ok(())
+    }
+
+    fn reread(&self) -> Result<(), AIMapper_Error> {
+        let state = self.state.lock().unwrap();
+        match state.locked {
+            Some(Some((offset, size))) => self.bo.invalidate_range(offset, size),
+            Some(None) => self.bo.invalidate(),
+            None => return Err(AIMapper_Error::AIMAPPER_ERROR_BAD_BUFFER),
+        }
+
+        Ok(())
+    }
+}
+
+impl Drop for Buffer {
+    fn drop(&mut self) {
+        let state = self.state.get_mut().unwrap();
+        if state.locked.take().is_some() {
+            let _ = self.bo.end_cpu_access();
+        }
+        if state.mapping.take().is_some() {
+            self.bo.unmap();
+        }
+    }
+}
+
+// The per-process mapper state.
+struct Mapper {
+    device: Arc<hbm::Device>,
+    // classes depend only on the formats and the flags
+    class_cache: RwLock<HashMap<(u32, hbm::Flags), Arc<hbm::Class>>>,
+    // imported buffers, keyed by the addresses of their handles
+    buffers: RwLock<HashMap<usize, Arc<Buffer>>>,
+}
+
+impl Mapper {
+    fn new() -> Option<Self> {
+        // the mapper is loaded into processes without dma-heap access
+        let backend = hbm::dma_heap::Builder::new().build().ok()?;
+        let device = hbm::Builder::new().add_backend(backend).build().ok()?;
+
+        let mapper = Self {
+            device,
+            class_cache: Default::default(),
+            buffers: Default::default(),
+        };
+
+        Some(mapper)
+    }
+
+    fn get_class(&self, fmt: u32, flags: hbm::Flags) -> hbm::Result<Arc<hbm::Class>> {
+        let key = (fmt, flags);
+        if let Some(class) = self.class_cache.read().unwrap().get(&key) {
+            return Ok(class.clone());
+        }
+
+        let mut desc = hbm::Description::new()
+            .flags(flags)
+            .format(hbm::Format(fmt));
+        if fmt != DRM_FORMAT_INVALID {
+            desc = desc.modifier(hbm::Modifier(DRM_FORMAT_MOD_LINEAR));
+        }
+
+        // classify without the lock held; two threads can classify the same key, which is
+        // harmless
+        let class = Arc::new(self.device.classify(desc, &[hbm::Usage::Unused])?);
+        let class = self
+            .class_cache
+            .write()
+            .unwrap()
+            .entry(key)
+            .or_insert(class)
+            .clone();
+
+        Ok(class)
+    }
+
+    fn import(&self, handle: OwnedHandle) -> Result<Buffer, AIMapper_Error> {
+        let bad_buffer = AIMapper_Error::AIMAPPER_ERROR_BAD_BUFFER;
+
+        if handle.fds().len() != handle::FD_COUNT {
+            return Err(bad_buffer);
+        }
+        let info = BufferInfo::decode(handle.ints()).ok_or(bad_buffer)?;
+
+        // SAFETY: the fd is valid while the handle is alive
+        let ro_metadata = unsafe { BorrowedFd::borrow_raw(handle.fds()[1]) };
+        // SAFETY: the fd is valid while the handle is alive
+        let rw_metadata = unsafe { BorrowedFd::borrow_raw(handle.fds()[2]) };
+        let metadata = Metadata::map(ro_metadata, rw_metadata).ok_or(bad_buffer)?;
+
+        let extent = if info.format == DRM_FORMAT_INVALID {
+            hbm::Extent::Buffer(info.width as hbm::Size)
+        } else {
+            hbm::Extent::Image(info.width, info.height)
+        };
+
+        // SAFETY: the fd is valid while the handle is alive
+        let dmabuf = unsafe { BorrowedFd::borrow_raw(handle.fds()[0]) };
+        let owned_dmabuf = dmabuf
+            .try_clone_to_owned()
+            .map_err(|_| AIMapper_Error::AIMAPPER_ERROR_NO_RESOURCES)?;
+
+        let class = self
+            .get_class(info.format, handle::usage_flags(info.usage))
+            .map_err(|_| bad_buffer)?;
+        let mut bo = hbm::Bo::with_layout(
+            self.device.clone(),
+            &class,
+            extent,
+            info.layout.clone(),
+            Some(dmabuf),
+        )
+        .map_err(|_| bad_buffer)?;
+        bo.bind_memory(hbm::MemoryType::empty(), Some(owned_dmabuf))
+            .map_err(|_| bad_buffer)?;
+
+        let buf = Buffer {
+            info,
+            bo,
+            metadata,
+            state: Default::default(),
+            _handle: handle,
+        };
+
+        Ok(buf)
+    }
+
+    fn lookup(&self, buffer: buffer_handle_t) -> Result<Arc<Buffer>, AIMapper_Error> {
+        self.buffers
+            .read()
+            .unwrap()
+            .get(&(buffer as usize))
+            .cloned()
+            .ok_or(AIMapper_Error::AIMAPPER_ERROR_BAD_BUFFER)
+    }
+}
+
+fn mapper() -> Result<&'static Mapper, AIMapper_Error> {
+    static MAPPER: OnceLock<Option<Mapper>> = OnceLock::new();
+
+    MAPPER
+        .get_or_init(Mapper::new)
+        .as_ref()
+        .ok_or(AIMapper_Error::AIMAPPER_ERROR_NO_RESOURCES)
+}
+
+fn into_error(res: Result<(), AIMapper_Error>) -> AIMapper_Error {
+    res.err().unwrap_or(AIMapper_Error::AIMAPPER_ERROR_NONE)
+}
+
+// Waits for and closes a fence.
+fn wait_fence(fence: OwnedFd) -> Result<(), AIMapper_Error> {
+    let mut pollfd = libc::pollfd {
+        fd: fence.as_raw_fd(),
+        events: libc::POLLIN,
+        revents: 0,
+    };
+
+    loop {
+        // SAFETY: pollfd is valid
+        let ret = unsafe { libc::poll(&mut pollfd, 1, -1) };
+        if ret > 0 && pollfd.revents & (libc::POLLERR | libc::POLLNVAL) == 0 {
+            return Ok(());
+        }
+        if ret < 0 && io::Error::last_os_error().kind() == io::ErrorKind::Interrupted {
+            continue;
+        }
+
+        return Err(AIMapper_Error::AIMAPPER_ERROR_NO_RESOURCES);
+    }
+}
 
 unsafe extern "C" fn import_buffer(
-    _handle: *const native_handle_t,
-    _out_buffer_handle: *mut buffer_handle_t,
+    handle: *const native_handle_t,
+    out_buffer_handle: *mut buffer_handle_t,
 ) -> AIMapper_Error {
-    // validate(handle);
-    // buf = native_handle_clone(handle);
-    // import(buf); // validate and setup buf->bo mapping
-    // return buf;
-    AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED
+    let mapper = match mapper() {
+        Ok(mapper) => mapper,
+        Err(err) => return err,
+    };
+
+    let Some(handle) = ptr::NonNull::new(native_handle_clone(handle)) else {
+        return AIMapper_Error::AIMAPPER_ERROR_NO_RESOURCES;
+    };
+    let handle = OwnedHandle(handle);
+    let buffer = handle.0.as_ptr() as buffer_handle_t;
+
+    let buf = match mapper.import(handle) {
+        Ok(buf) => buf,
+        Err(err) => return err,
+    };
+    mapper
+        .buffers
+        .write()
+        .unwrap()
+        .insert(buffer as usize, Arc::new(buf));
+
+    *out_buffer_handle = buffer;
+    AIMapper_Error::AIMAPPER_ERROR_NONE
 }
 
-unsafe extern "C" fn free_buffer(_buffer: buffer_handle_t) -> AIMapper_Error {
-    // bo = lookup(buf);
-    // delete(bo);
-    // native_handle_close(buf);
-    // native_handle_delete(buf);
-    AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED
+unsafe extern "C" fn free_buffer(buffer: buffer_handle_t) -> AIMapper_Error {
+    let mapper = match mapper() {
+        Ok(mapper) => mapper,
+        Err(err) => return err,
+    };
+
+    let buf = mapper.buffers.write().unwrap().remove(&(buffer as usize));
+    match buf {
+        // the buffer is destroyed when the last reference is dropped
+        Some(_) => AIMapper_Error::AIMAPPER_ERROR_NONE,
+        None => AIMapper_Error::AIMAPPER_ERROR_BAD_BUFFER,
+    }
 }
 
 unsafe extern "C" fn get_transport_size(
@@ -48,47 +407,86 @@ unsafe extern "C" fn get_transport_size(
     out_num_fds: *mut u32,
     out_num_ints: *mut u32,
 ) -> AIMapper_Error {
-    let buf = &*buffer;
-    *out_num_fds = buf.numFds as u32;
-    *out_num_ints = buf.numInts as u32;
+    let buf = match mapper().and_then(|mapper| mapper.lookup(buffer)) {
+        Ok(buf) => buf,
+        Err(err) => return err,
+    };
+
+    // the size is that of the decoded handle rather than what the raw handle claims
+    *out_num_fds = handle::FD_COUNT as u32;
+    *out_num_ints = buf.info.int_count() as u32;
     AIMapper_Error::AIMAPPER_ERROR_NONE
 }
 
 unsafe extern "C" fn lock(
-    _buffer: buffer_handle_t,
-    _cpu_usage: u64,
-    _access_region: ARect,
-    _acquire_fence: std::ffi::c_int,
-    _out_data: *mut *mut std::ffi::c_void,
+    buffer: buffer_handle_t,
+    cpu_usage: u64,
+    access_region: ARect,
+    acquire_fence: c_int,
+    out_data: *mut *mut c_void,
 ) -> AIMapper_Error {
-    // bo = lookup(buf);
-    // wait(acquire_fence);
-    // map(bo);
-    // sync(bo, start);
-    AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED
+    // the ownership of the fence is transferred to us
+    let fence = (acquire_fence >= 0).then(|| OwnedFd::from_raw_fd(acquire_fence));
+
+    let buf = match mapper().and_then(|mapper| mapper.lookup(buffer)) {
+        Ok(buf) => buf,
+        Err(err) => return err,
+    };
+
+    // the CPU usage must be a subset of the buffer usage
+    let Some(access) = handle::usage_access(cpu_usage) else {
+        return AIMapper_Error::AIMAPPER_ERROR_BAD_VALUE;
+    };
+    if handle::usage_access(cpu_usage & buf.info.usage) != Some(access) {
+        return AIMapper_Error::AIMAPPER_ERROR_BAD_VALUE;
+    }
+
+    if let Some(fence) = fence {
+        if let Err(err) = wait_fence(fence) {
+            return err;
+        }
+    }
+
+    match buf.lock(access, access_region) {
+        Ok(data) => {
+            *out_data = data;
+            AIMapper_Error::AIMAPPER_ERROR_NONE
+        }
+        Err(err) => err,
+    }
 }
 
-unsafe extern "C" fn unlock(
-    _buffer: buffer_handle_t,
-    release_fence: *mut std::ffi::c_int,
-) -> AIMapper_Error {
-    // bo = lookup(buf);
-    // sync(bo, end);
-    // unmap(bo);
+unsafe extern "C" fn unlock(buffer: buffer_handle_t, release_fence: *mut c_int) -> AIMapper_Error {
+    // CPU accesses are complete when unlock returns
     *release_fence = -1;
-    AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED
+
+    let res = mapper()
+        .and_then(|mapper| mapper.lookup(buffer))
+        .and_then(|buf| buf.unlock());
+    into_error(res)
 }
 
-unsafe extern "C" fn flush_locked_buffer(_buffer: buffer_handle_t) -> AIMapper_Error {
-    // bo = lookup(buf);
-    // flush(bo);
-    AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED
+unsafe extern "C" fn flush_locked_buffer(buffer: buffer_handle_t) -> AIMapper_Error {
+    let res = mapper()
+        .and_then(|mapper| mapper.lookup(buffer))
+        .and_then(|buf| buf.flush());
+    into_error(res)
 }
 
-unsafe extern "C" fn reread_locked_buffer(_buffer: buffer_handle_t) -> AIMapper_Error {
-    // bo = lookup(buf);
-    // invalidate(bo);
-    AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED
+unsafe extern "C" fn reread_locked_buffer(buffer: buffer_handle_t) -> AIMapper_Error {
+    let res = mapper()
+        .and_then(|mapper| mapper.lookup(buffer))
+        .and_then(|buf| buf.reread());
+    into_error(res)
+}
+
+const STANDARD_METADATA_TYPE_NAME: &[u8] =
+    b"android.hardware.graphics.common.StandardMetadataType\0";
+
+fn is_standard(metadata_type: &AIMapper_MetadataType) -> bool {
+    // SAFETY: the name is a valid C string
+    let name = unsafe { CStr::from_ptr(metadata_type.name) };
+    name.to_bytes_with_nul() == STANDARD_METADATA_TYPE_NAME
 }
 
 unsafe extern "C" fn get_metadata(
@@ -97,25 +495,43 @@ unsafe extern "C" fn get_metadata(
     dest_buffer: *mut std::ffi::c_void,
     dest_buffer_size: usize,
 ) -> i32 {
-    let c_name = std::ffi::CStr::from_ptr(metadata_type.name);
-    let name = c_name.to_str().unwrap();
-    if name != "android.hardware.graphics.common.StandardMetadataType" {
-        return AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED as i32;
+    if !is_standard(&metadata_type) {
+        return -(AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED as i32);
     }
 
     get_standard_metadata(buffer, metadata_type.value, dest_buffer, dest_buffer_size)
 }
 
+fn from_metadata_error(err: metadata::Error) -> AIMapper_Error {
+    match err {
+        metadata::Error::BadValue => AIMapper_Error::AIMAPPER_ERROR_BAD_VALUE,
+        metadata::Error::Unsupported => AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED,
+        metadata::Error::Busy => AIMapper_Error::AIMAPPER_ERROR_NO_RESOURCES,
+    }
+}
+
 unsafe extern "C" fn get_standard_metadata(
-    _buffer: buffer_handle_t,
-    _standard_metadata_type: i64,
-    _dest_buffer: *mut std::ffi::c_void,
-    _dest_buffer_size: usize,
+    buffer: buffer_handle_t,
+    standard_metadata_type: i64,
+    dest_buffer: *mut std::ffi::c_void,
+    dest_buffer_size: usize,
 ) -> i32 {
-    // bo = lookup(buf);
-    // val = get_metadata(bo); // ro metadata are embedded and rw metadata are on shmem
-    // encode(val, dest_buffer, dest_buffer_size);
-    AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED as i32
+    let buf = match mapper().and_then(|mapper| mapper.lookup(buffer)) {
+        Ok(buf) => buf,
+        Err(err) => return -(err as i32),
+    };
+
+    let dst = if dest_buffer.is_null() || dest_buffer_size == 0 {
+        &mut []
+    } else {
+        slice::from_raw_parts_mut(dest_buffer.cast(), dest_buffer_size)
+    };
+
+    // the value is pre-encoded and this is a copy
+    match buf.metadata.get(standard_metadata_type, dst) {
+        Ok(size) => size as i32,
+        Err(err) => -(from_metadata_error(err) as i32),
+    }
 }
 
 unsafe extern "C" fn set_metadata(
@@ -124,9 +540,7 @@ unsafe extern "C" fn set_metadata(
     metadata: *const std::ffi::c_void,
     metadata_size: usize,
 ) -> AIMapper_Error {
-    let c_name = std::ffi::CStr::from_ptr(metadata_type.name);
-    let name = c_name.to_str().unwrap();
-    if name != "android.hardware.graphics.common.StandardMetadataType" {
+    if !is_standard(&metadata_type) {
         return AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED;
     }
 
@@ -134,55 +548,180 @@ unsafe extern "C" fn set_metadata(
 }
 
 unsafe extern "C" fn set_standard_metadata(
-    _buffer: buffer_handle_t,
-    _standard_metadata_type: i64,
-    _metadata: *const std::ffi::c_void,
-    _metadata_size: usize,
+    buffer: buffer_handle_t,
+    standard_metadata_type: i64,
+    metadata: *const std::ffi::c_void,
+    metadata_size: usize,
 ) -> AIMapper_Error {
-    // bo = lookup(buf);
-    // val = decode(metadata, metadata_size);
-    // set_metadata(bo, val); // ro metadata are embedded and rw metadata are on shmem
-    AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED
+    let buf = match mapper().and_then(|mapper| mapper.lookup(buffer)) {
+        Ok(buf) => buf,
+        Err(err) => return err,
+    };
+
+    let src = if metadata.is_null() || metadata_size == 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(metadata.cast(), metadata_size)
+    };
+
+    let res = buf
+        .metadata
+        .set(standard_metadata_type, src)
+        .map_err(from_metadata_error);
+    into_error(res)
+}
+
+// The descriptions of the supported metadata types.
+struct MetadataTypeDescriptions(Vec<AIMapper_MetadataTypeDescription>);
+
+// SAFETY: the descriptions point to static strings
+unsafe impl Send for MetadataTypeDescriptions {}
+// SAFETY: the descriptions point to static strings
+unsafe impl Sync for MetadataTypeDescriptions {}
+
+// a vendor metadata type whose value is the device statistics as text
+const STATS_METADATA_TYPE_NAME: &[u8] = b"com.google.hbm.Stats\0";
+
+fn standard_metadata_type(value: i64) -> AIMapper_MetadataType {
+    AIMapper_MetadataType {
+        name: STANDARD_METADATA_TYPE_NAME.as_ptr().cast(),
+        value,
+    }
 }
 
 unsafe extern "C" fn list_supported_metadata_types(
     out_description_list: *mut *const AIMapper_MetadataTypeDescription,
     out_number_of_descriptions: *mut usize,
 ) -> AIMapper_Error {
-    // list std metadata
-    *out_description_list = std::ptr::null();
-    *out_number_of_descriptions = 0;
-    AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED
+    static DESCRIPTIONS: OnceLock<MetadataTypeDescriptions> = OnceLock::new();
+
+    let descs = DESCRIPTIONS.get_or_init(|| {
+        let descs = metadata::SUPPORTED_TYPES
+            .iter()
+            .map(|&(value, settable)| AIMapper_MetadataTypeDescription {
+                metadataType: standard_metadata_type(value),
+                description: ptr::null(),
+                isGettable: true,
+                isSettable: settable,
+                reserved: [0; 32],
+            })
+            .collect();
+        MetadataTypeDescriptions(descs)
+    });
+
+    *out_description_list = descs.0.as_ptr();
+    *out_number_of_descriptions = descs.0.len();
+    AIMapper_Error::AIMAPPER_ERROR_NONE
+}
+
+// Dumps the metadata of a buffer.
+fn dump(
+    buf: &Buffer,
+    callback: unsafe extern "C" fn(*mut c_void, AIMapper_MetadataType, *const c_void, usize),
+    context: *mut c_void,
+) {
+    let mut val = Vec::new();
+    for (value, _) in metadata::SUPPORTED_TYPES {
+        let Ok(size) = buf.metadata.get(value, &mut []) else {
+            continue;
+        };
+        val.resize(size, 0);
+        let Ok(size) = buf.metadata.get(value, &mut val) else {
+            continue;
+        };
+        // the value can change between the two gets
+        if size > val.len() {
+            continue;
+        }
+
+        // SAFETY: the callback is valid for the duration of the dump
+        unsafe {
+            callback(
+                context,
+                standard_metadata_type(value),
+                val.as_ptr().cast(),
+                size,
+            )
+        };
+    }
 }
 
 unsafe extern "C" fn dump_buffer(
-    _buffer: buffer_handle_t,
-    _dump_buffer_callback: AIMapper_DumpBufferCallback,
-    _context: *mut std::ffi::c_void,
+    buffer: buffer_handle_t,
+    dump_buffer_callback: AIMapper_DumpBufferCallback,
+    context: *mut std::ffi::c_void,
 ) -> AIMapper_Error {
-    // bo = lookup(buf);
-    // for each metadata: dump_bufferCallback()
-    AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED
+    let Some(callback) = dump_buffer_callback else {
+        return AIMapper_Error::AIMAPPER_ERROR_BAD_VALUE;
+    };
+
+    let res = mapper()
+        .and_then(|mapper| mapper.lookup(buffer))
+        .map(|buf| dump(&buf, callback, context));
+    into_error(res)
 }
 
 unsafe extern "C" fn dump_all_buffers(
-    _begin_dump_callback: AIMapper_BeginDumpBufferCallback,
-    _dump_buffer_callback: AIMapper_DumpBufferCallback,
-    _context: *mut std::ffi::c_void,
+    begin_dump_callback: AIMapper_BeginDumpBufferCallback,
+    dump_buffer_callback: AIMapper_DumpBufferCallback,
+    context: *mut std::ffi::c_void,
 ) -> AIMapper_Error {
-    // for each buffer: dump_buffer(buffer);
-    AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED
+    let (Some(begin_callback), Some(callback)) = (begin_dump_callback, dump_buffer_callback) else {
+        return AIMapper_Error::AIMAPPER_ERROR_BAD_VALUE;
+    };
+    let mapper = match mapper() {
+        Ok(mapper) => mapper,
+        Err(err) => return err,
+    };
+
+    // do not call back with the lock held
+    let bufs: Vec<Arc<Buffer>> = mapper.buffers.read().unwrap().values().cloned().collect();
+    for buf in bufs {
+        begin_callback(context);
+        dump(&buf, callback, context);
+    }
+
+    // the device statistics are dumped as a pseudo buffer after the buffers
+    let stats: String = mapper
+        .device
+        .stats()
+        .iter()
+        .enumerate()
+        .map(|(idx, stats)| format!("backend {idx}:\n{stats}"))
+        .collect();
+    let stats_type = AIMapper_MetadataType {
+        name: STATS_METADATA_TYPE_NAME.as_ptr().cast(),
+        value: 0,
+    };
+    begin_callback(context);
+    callback(context, stats_type, stats.as_ptr().cast(), stats.len());
+
+    AIMapper_Error::AIMAPPER_ERROR_NONE
 }
 
 unsafe extern "C" fn get_reserved_region(
-    _buffer: buffer_handle_t,
-    _out_reserved_region: *mut *mut std::ffi::c_void,
-    _out_reserved_size: *mut u64,
+    buffer: buffer_handle_t,
+    out_reserved_region: *mut *mut std::ffi::c_void,
+    out_reserved_size: *mut u64,
 ) -> AIMapper_Error {
-    // bo = lookup(buf);
-    // // shmem holds rw metadata as well as a region reserved for client
-    // return mmap_shmem(bo);
-    AIMapper_Error::AIMAPPER_ERROR_UNSUPPORTED
+    let buf = match mapper().and_then(|mapper| mapper.lookup(buffer)) {
+        Ok(buf) => buf,
+        Err(err) => return err,
+    };
+
+    // the reserved region is a part of the read-write metadata region and is mapped
+    match buf.metadata.reserved_region() {
+        Some((region, size)) => {
+            *out_reserved_region = region.as_ptr().cast();
+            *out_reserved_size = size as u64;
+        }
+        None => {
+            *out_reserved_region = ptr::null_mut();
+            *out_reserved_size = 0;
+        }
+    }
+
+    AIMapper_Error::AIMAPPER_ERROR_NONE
 }
 
 #[no_mangle]
@@ -0,0 +1,876 @@
+// Copyright 2025 Google LLC
+// SPDX-License-Identifier: MIT
+
+//! Buffer metadata.
+//!
+//! Each buffer carries two small metadata regions, memfds that the allocator creates and every
+//! importer maps.  They hold the standard metadata of the buffer, pre-encoded in the IMapper wire
+//! format, such that getters are a copy from shared memory.
+//!
+//! The read-only region is sealed against writes and is mapped read-only.  It holds a header and
+//! the read-only metadata, which are encoded once at allocation:
+//!
+//! ```text
+//!   magic: u32
+//!   version: u32
+//!   reserved_offset: u64
+//!   reserved_size: u64
+//!   entries: [(offset: u32, size: u32, capacity: u32); TYPE_COUNT]
+//!   values
+//! ```
+//!
+//! The entries are indexed by `StandardMetadataType` values.  Entries of read-only types point to
+//! their values in the read-only region.  Entries of settable types point to fixed-capacity slots
+//! in the read-write region, which setters re-encode in place such that the changes are visible to
+//! all processes.  The read-write region also holds the reserved region of the buffer, if any.
+//!
+//! A slot is protected by a seqlock.  The sequence number is odd while a setter writes the slot,
+//! and getters retry when it is odd or changes during their copy:
+//!
+//! ```text
+//!   sequence: u32
+//!   size: u32
+//!   value: [u8; capacity]
+//! ```
+//!
+//! All values are little-endian.
+
+// the allocator and the mapper use different parts of this module
+#![allow(dead_code)]
+
+use crate::handle::{self, BufferInfo};
+use std::fs::File;
+use std::io;
+use std::os::fd::{AsRawFd, BorrowedFd, FromRawFd, OwnedFd};
+use std::os::unix::fs::FileExt;
+use std::sync::atomic::{self, AtomicU32, Ordering};
+use std::{mem, ptr, thread};
+
+// StandardMetadataType values
+pub const BUFFER_ID: i64 = 1;
+pub const NAME: i64 = 2;
+pub const WIDTH: i64 = 3;
+pub const HEIGHT: i64 = 4;
+pub const LAYER_COUNT: i64 = 5;
+pub const PIXEL_FORMAT_REQUESTED: i64 = 6;
+pub const PIXEL_FORMAT_FOURCC: i64 = 7;
+pub const PIXEL_FORMAT_MODIFIER: i64 = 8;
+pub const USAGE: i64 = 9;
+pub const ALLOCATION_SIZE: i64 = 10;
+pub const PROTECTED_CONTENT: i64 = 11;
+pub const COMPRESSION: i64 = 12;
+pub const INTERLACED: i64 = 13;
+pub const CHROMA_SITING: i64 = 14;
+pub const PLANE_LAYOUTS: i64 = 15;
+pub const CROP: i64 = 16;
+pub const DATASPACE: i64 = 17;
+pub const BLEND_MODE: i64 = 18;
+pub const SMPTE2086: i64 = 19;
+pub const CTA861_3: i64 = 20;
+pub const STRIDE: i64 = 23;
+
+// the number of header entries, which covers every StandardMetadataType value up to STRIDE
+const TYPE_COUNT: usize = STRIDE as usize + 1;
+
+// The supported metadata types and whether they are settable.
+pub const SUPPORTED_TYPES: [(i64, bool); 21] = [
+    (BUFFER_ID, false),
+    (NAME, false),
+    (WIDTH, false),
+    (HEIGHT, false),
+    (LAYER_COUNT, false),
+    (PIXEL_FORMAT_REQUESTED, false),
+    (PIXEL_FORMAT_FOURCC, false),
+    (PIXEL_FORMAT_MODIFIER, false),
+    (USAGE, false),
+    (ALLOCATION_SIZE, false),
+    (PROTECTED_CONTENT, false),
+    (COMPRESSION, false),
+    (INTERLACED, false),
+    (CHROMA_SITING, false),
+    (PLANE_LAYOUTS, false),
+    (CROP, true),
+    (DATASPACE, true),
+    (BLEND_MODE, true),
+    (SMPTE2086, true),
+    (CTA861_3, true),
+    (STRIDE, false),
+];
+
+const MAGIC: u32 = handle::fourcc(b'H', b'B', b'M', b'M');
+const VERSION: u32 = 2;
+
+const HEADER_SIZE: usize = 24;
+const ENTRY_SIZE: usize = 12;
+const ENTRIES_SIZE: usize = ENTRY_SIZE * TYPE_COUNT;
+
+// the max number of crop rects
+const CROP_MAX_RECTS: usize = 4;
+const RECT_SIZE: usize = 16;
+
+// a slot starts with the sequence number and the size of the value
+const SLOT_HEADER_SIZE: usize = 8;
+// the max capacity of a slot, which is that of CROP
+const SLOT_MAX_CAPACITY: usize = 8 + RECT_SIZE * CROP_MAX_RECTS;
+// the max number of attempts to access a slot while other processes are setting it
+const SLOT_MAX_RETRIES: u32 = 1 << 16;
+
+const RESERVED_ALIGNMENT: u64 = 4096;
+
+const EXTENDABLE_COMPRESSION: &str = "android.hardware.graphics.common.Compression";
+const EXTENDABLE_INTERLACED: &str = "android.hardware.graphics.common.Interlaced";
+const EXTENDABLE_CHROMA_SITING: &str = "android.hardware.graphics.common.ChromaSiting";
+const EXTENDABLE_PLANE_LAYOUT_COMPONENT_TYPE: &str =
+    "android.hardware.graphics.common.PlaneLayoutComponentType";
+
+const CHROMA_SITING_NONE: i64 = 0;
+const CHROMA_SITING_SITED_INTERSTITIAL: i64 = 2;
+
+// PlaneLayoutComponentType values
+const COMPONENT_Y: i64 = 1 << 0;
+const COMPONENT_CB: i64 = 1 << 1;
+const COMPONENT_CR: i64 = 1 << 2;
+const COMPONENT_R: i64 = 1 << 10;
+const COMPONENT_G: i64 = 1 << 11;
+const COMPONENT_B: i64 = 1 << 12;
+const COMPONENT_RAW: i64 = 1 << 20;
+const COMPONENT_A: i64 = 1 << 30;
+
+const DRM_FORMAT_R8: u32 = handle::fourcc(b'R', b'8', b' ', b' ');
+const DRM_FORMAT_RGB565: u32 = handle::fourcc(b'R', b'G', b'1', b'6');
+const DRM_FORMAT_BGR888: u32 = handle::fourcc(b'B', b'G', b'2', b'4');
+const DRM_FORMAT_ABGR8888: u32 = handle::fourcc(b'A', b'B', b'2', b'4');
+const DRM_FORMAT_XBGR8888: u32 = handle::fourcc(b'X', b'B', b'2', b'4');
+const DRM_FORMAT_ARGB8888: u32 = handle::fourcc(b'A', b'R', b'2', b'4');
+const DRM_FORMAT_ABGR2101010: u32 = handle::fourcc(b'A', b'B', b'3', b'0');
+const DRM_FORMAT_ABGR16161616F: u32 = handle::fourcc(b'A', b'B', b'4', b'H');
+const DRM_FORMAT_NV12: u32 = handle::fourcc(b'N', b'V', b'1', b'2');
+const DRM_FORMAT_NV21: u32 = handle::fourcc(b'N', b'V', b'2', b'1');
+const DRM_FORMAT_P010: u32 = handle::fourcc(b'P', b'0', b'1', b'0');
+const DRM_FORMAT_YVU420: u32 = handle::fourcc(b'Y', b'V', b'1', b'2');
+
+// A component of a plane, as (type, offset in bits, size in bits).
+type Component = (i64, i64, i64);
+
+// The components of a plane, the sample increment in bits, and the subsampling factor.
+type PlaneFormat = (&'static [Component], i64, u32);
+
+// Returns the plane formats of a DRM format.
+fn plane_formats(fmt: u32) -> &'static [PlaneFormat] {
+    const R: &[PlaneFormat] = &[(&[(COMPONENT_R, 0, 8)], 8, 1)];
+    const RGB565: &[PlaneFormat] = &[(
+        &[
+            (COMPONENT_B, 0, 5),
+            (COMPONENT_G, 5, 6),
+            (COMPONENT_R, 11, 5),
+        ],
+        16,
+        1,
+    )];
+    const BGR888: &[PlaneFormat] = &[(
+        &[
+            (COMPONENT_R, 0, 8),
+            (COMPONENT_G, 8, 8),
+            (COMPONENT_B, 16, 8),
+        ],
+        24,
+        1,
+    )];
+    const ABGR8888: &[PlaneFormat] = &[(
+        &[
+            (COMPONENT_R, 0, 8),
+            (COMPONENT_G, 8, 8),
+            (COMPONENT_B, 16, 8),
+            (COMPONENT_A, 24, 8),
+        ],
+        32,
+        1,
+    )];
+    const XBGR8888: &[PlaneFormat] = &[(
+        &[
+            (COMPONENT_R, 0, 8),
+            (COMPONENT_G, 8, 8),
+            (COMPONENT_B, 16, 8),
+        ],
+        32,
+        1,
+    )];
+    const ARGB8888: &[PlaneFormat] = &[(
+        &[
+            (COMPONENT_B, 0, 8),
+            (COMPONENT_G, 8, 8),
+            (COMPONENT_R, 16, 8),
+            (COMPONENT_A, 24, 8),
+        ],
+        32,
+        1,
+    )];
+    const ABGR2101010: &[PlaneFormat] = &[(
+        &[
+            (COMPONENT_R, 0, 10),
+            (COMPONENT_G, 10, 10),
+            (COMPONENT_B, 20, 10),
+            (COMPONENT_A, 30, 2),
+        ],
+        32,
+        1,
+    )];
+    const ABGR16161616F: &[PlaneFormat] = &[(
+        &[
+            (COMPONENT_R, 0, 16),
+            (COMPONENT_G, 16, 16),
+            (COMPONENT_B, 32, 16),
+            (COMPONENT_A, 48, 16),
+        ],
+        64,
+        1,
+    )];
+    const NV12: &[PlaneFormat] = &[
+        (&[(COMPONENT_Y, 0, 8)], 8, 1),
+        (&[(COMPONENT_CB, 0, 8), (COMPONENT_CR, 8, 8)], 16, 2),
+    ];
+    const NV21: &[PlaneFormat] = &[
+        (&[(COMPONENT_Y, 0, 8)], 8, 1),
+        (&[(COMPONENT_CR, 0, 8), (COMPONENT_CB, 8, 8)], 16, 2),
+    ];
+    const P010: &[PlaneFormat] = &[
+        (&[(COMPONENT_Y, 6, 10)], 16, 1),
+        (&[(COMPONENT_CB, 6, 10), (COMPONENT_CR, 22, 10)], 32, 2),
+    ];
+    const YVU420: &[PlaneFormat] = &[
+        (&[(COMPONENT_Y, 0, 8)], 8, 1),
+        (&[(COMPONENT_CR, 0, 8)], 8, 2),
+        (&[(COMPONENT_CB, 0, 8)], 8, 2),
+    ];
+    // a blob is a row of bytes
+    const BLOB: &[PlaneFormat] = &[(&[(COMPONENT_RAW, 0, 8)], 8, 1)];
+
+    match fmt {
+        DRM_FORMAT_R8 => R,
+        DRM_FORMAT_RGB565 => RGB565,
+        DRM_FORMAT_BGR888 => BGR888,
+        DRM_FORMAT_ABGR8888 => ABGR8888,
+        DRM_FORMAT_XBGR8888 => XBGR8888,
+        DRM_FORMAT_ARGB8888 => ARGB8888,
+        DRM_FORMAT_ABGR2101010 => ABGR2101010,
+        DRM_FORMAT_ABGR16161616F => ABGR16161616F,
+        DRM_FORMAT_NV12 => NV12,
+        DRM_FORMAT_NV21 => NV21,
+        DRM_FORMAT_P010 => P010,
+        DRM_FORMAT_YVU420 => YVU420,
+        _ => BLOB,
+    }
+}
+
+// Encodes metadata values in the IMapper wire format.
+#[derive(Default)]
+struct Encoder(Vec<u8>);
+
+impl Encoder {
+    fn i32(&mut self, val: i32) -> &mut Self {
+        self.0.extend(val.to_le_bytes());
+        self
+    }
+
+    fn i64(&mut self, val: i64) -> &mut Self {
+        self.0.extend(val.to_le_bytes());
+        self
+    }
+
+    fn string(&mut self, val: &str) -> &mut Self {
+        self.i64(val.len() as i64);
+        self.0.extend(val.as_bytes());
+        self
+    }
+
+    fn extendable(&mut self, name: &str, val: i64) -> &mut Self {
+        self.string(name).i64(val)
+    }
+
+    fn rect(&mut self, left: i32, top: i32, right: i32, bottom: i32) -> &mut Self {
+        self.i32(left).i32(top).i32(right).i32(bottom)
+    }
+
+    fn finish(&mut self) -> Vec<u8> {
+        mem::take(&mut self.0)
+    }
+}
+
+fn encode_plane_layouts(info: &BufferInfo) -> Vec<u8> {
+    let layout = &info.layout;
+    let planes = plane_formats(info.format);
+    let is_blob = info.format == handle::DRM_FORMAT_INVALID;
+    let height = if is_blob { 1 } else { info.height };
+
+    let mut enc = Encoder::default();
+    let plane_count = planes.len().min(layout.plane_count as usize);
+    enc.i64(plane_count as i64);
+    for (plane, &(components, sample_bits, subsampling)) in planes[..plane_count].iter().enumerate()
+    {
+        enc.i64(components.len() as i64);
+        for &(ty, offset, size) in components {
+            enc.extendable(EXTENDABLE_PLANE_LAYOUT_COMPONENT_TYPE, ty)
+                .i64(offset)
+                .i64(size);
+        }
+
+        let stride = if is_blob {
+            layout.size
+        } else {
+            layout.strides[plane]
+        };
+        let width_in_samples = info.width.div_ceil(subsampling);
+        let height_in_samples = height.div_ceil(subsampling);
+        enc.i64(layout.offsets[plane] as i64)
+            .i64(sample_bits)
+            .i64(stride as i64)
+            .i64(width_in_samples as i64)
+            .i64(height_in_samples as i64)
+            .i64((stride * height_in_samples as u64) as i64)
+            .i64(subsampling as i64)
+            .i64(subsampling as i64);
+    }
+
+    enc.finish()
+}
+
+// Returns the encoded value of a metadata type and its capacity.  Read-only metadata have no
+// spare capacity.
+fn encode(ty: i64, info: &BufferInfo, name: &str, buffer_id: u64) -> Option<(Vec<u8>, usize)> {
+    let is_blob = info.format == handle::DRM_FORMAT_INVALID;
+    let height = if is_blob { 1 } else { info.height };
+
+    let mut enc = Encoder::default();
+    let capacity = match ty {
+        BUFFER_ID => {
+            enc.i64(buffer_id as i64);
+            None
+        }
+        NAME => {
+            enc.string(name);
+            None
+        }
+        WIDTH => {
+            enc.i64(info.width as i64);
+            None
+        }
+        HEIGHT => {
+            enc.i64(height as i64);
+            None
+        }
+        LAYER_COUNT => {
+            enc.i64(1);
+            None
+        }
+        PIXEL_FORMAT_REQUESTED => {
+            enc.i32(info.pixel_format);
+            None
+        }
+        PIXEL_FORMAT_FOURCC => {
+            enc.i32(info.format as i32);
+            None
+        }
+        PIXEL_FORMAT_MODIFIER => {
+            enc.i64(info.layout.modifier.0 as i64);
+            None
+        }
+        USAGE => {
+            enc.i64(info.usage as i64);
+            None
+        }
+        ALLOCATION_SIZE => {
+            enc.i64(info.layout.size as i64);
+            None
+        }
+        PROTECTED_CONTENT => {
+            enc.i64((info.usage & handle::USAGE_PROTECTED != 0) as i64);
+            None
+        }
+        COMPRESSION => {
+            enc.extendable(EXTENDABLE_COMPRESSION, 0);
+            None
+        }
+        INTERLACED => {
+            enc.extendable(EXTENDABLE_INTERLACED, 0);
+            None
+        }
+        CHROMA_SITING => {
+            let is_yuv = plane_formats(info.format)[0].0[0].0 == COMPONENT_Y;
+            let siting = if is_yuv {
+                CHROMA_SITING_SITED_INTERSTITIAL
+            } else {
+                CHROMA_SITING_NONE
+            };
+            enc.extendable(EXTENDABLE_CHROMA_SITING, siting);
+            None
+        }
+        PLANE_LAYOUTS => return Some((encode_plane_layouts(info), 0)),
+        CROP => {
+            let width = i32::try_from(info.width).ok()?;
+            let height = i32::try_from(height).ok()?;
+            enc.i64(1).rect(0, 0, width, height);
+            Some(SLOT_MAX_CAPACITY)
+        }
+        DATASPACE | BLEND_MODE => {
+            // Dataspace::UNKNOWN and BlendMode::INVALID
+            enc.i32(0);
+            Some(4)
+        }
+        // the optional values are unset
+        SMPTE2086 => Some(40),
+        CTA861_3 => Some(8),
+        STRIDE => {
+            let stride = if is_blob {
+                0
+            } else {
+                let bpp = plane_formats(info.format)[0].1 as u64 / 8;
+                info.layout.strides[0] / bpp
+            };
+            enc.i32(u32::try_from(stride).ok()? as i32);
+            None
+        }
+        _ => return None,
+    };
+
+    let val = enc.finish();
+    let capacity = capacity.unwrap_or(val.len());
+
+    Some((val, capacity))
+}
+
+// Validates a value of a settable metadata type.
+fn validate(ty: i64, val: &[u8]) -> Result<(), Error> {
+    let valid = match ty {
+        CROP => {
+            let count = val
+                .get(..8)
+                .map(|count| i64::from_le_bytes(count.try_into().unwrap()));
+            matches!(count, Some(count) if count >= 0
+                && (count as usize) <= CROP_MAX_RECTS
+                && val.len() == 8 + RECT_SIZE * count as usize)
+        }
+        DATASPACE | BLEND_MODE => val.len() == 4,
+        // an empty value unsets an optional value
+        SMPTE2086 => val.is_empty() || val.len() == 40,
+        CTA861_3 => val.is_empty() || val.len() == 8,
+        _ => return Err(Error::Unsupported),
+    };
+
+    if valid {
+        Ok(())
+    } else {
+        Err(Error::BadValue)
+    }
+}
+
+fn align(val: u64, alignment: u64) -> Option<u64> {
+    val.checked_next_multiple_of(alignment)
+}
+
+fn entry_offset(ty: usize) -> usize {
+    HEADER_SIZE + ENTRY_SIZE * ty
+}
+
+// Creates a memfd with the data at the start, and seals it.  The name must be NUL-terminated.
+fn create_memfd(name: &[u8], data: &[u8], size: u64, seals: libc::c_int) -> io::Result<OwnedFd> {
+    // SAFETY: the name is NUL-terminated
+    let fd = unsafe {
+        libc::memfd_create(
+            name.as_ptr().cast(),
+            libc::MFD_CLOEXEC | libc::MFD_ALLOW_SEALING,
+        )
+    };
+    if fd < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    // SAFETY: fd is a new and valid fd
+    let file = File::from(unsafe { OwnedFd::from_raw_fd(fd) });
+
+    file.set_len(size)?;
+    file.write_all_at(data, 0)?;
+
+    // SAFETY: the fd is valid
+    if unsafe { libc::fcntl(file.as_raw_fd(), libc::F_ADD_SEALS, seals) } < 0 {
+        return Err(io::Error::last_os_error());
+    }
+
+    Ok(OwnedFd::from(file))
+}
+
+// importers map the regions and must not see them shrink
+const RO_SEALS: libc::c_int =
+    libc::F_SEAL_WRITE | libc::F_SEAL_SHRINK | libc::F_SEAL_GROW | libc::F_SEAL_SEAL;
+const RW_SEALS: libc::c_int = libc::F_SEAL_SHRINK | libc::F_SEAL_GROW | libc::F_SEAL_SEAL;
+
+// Creates the metadata regions of a buffer, and returns the read-only region and the read-write
+// region.
+pub fn create(
+    info: &BufferInfo,
+    name: &str,
+    buffer_id: u64,
+    reserved_size: u64,
+) -> io::Result<(OwnedFd, OwnedFd)> {
+    let invalid = || io::Error::from(io::ErrorKind::InvalidInput);
+
+    let mut ro = vec![0; HEADER_SIZE + ENTRIES_SIZE];
+    let mut rw = Vec::new();
+    for (ty, settable) in SUPPORTED_TYPES {
+        let (val, capacity) = encode(ty, info, name, buffer_id).ok_or_else(invalid)?;
+
+        let offset = if settable {
+            // slots are accessed in 4-byte words
+            let offset = rw.len();
+            rw.extend(0u32.to_le_bytes());
+            rw.extend((val.len() as u32).to_le_bytes());
+            rw.extend(&val);
+            rw.resize(offset + SLOT_HEADER_SIZE + capacity.next_multiple_of(4), 0);
+            offset
+        } else {
+            let offset = ro.len();
+            ro.extend(&val);
+            offset
+        };
+
+        let entry = entry_offset(ty as usize);
+        ro[entry..entry + 4].copy_from_slice(&(offset as u32).to_le_bytes());
+        ro[entry + 4..entry + 8].copy_from_slice(&(val.len() as u32).to_le_bytes());
+        ro[entry + 8..entry + 12].copy_from_slice(&(capacity as u32).to_le_bytes());
+    }
+
+    let reserved_offset = if reserved_size > 0 {
+        align(rw.len() as u64, RESERVED_ALIGNMENT).ok_or_else(invalid)?
+    } else {
+        rw.len() as u64
+    };
+    let rw_size = reserved_offset
+        .checked_add(reserved_size)
+        .ok_or_else(invalid)?;
+
+    ro[0..4].copy_from_slice(&MAGIC.to_le_bytes());
+    ro[4..8].copy_from_slice(&VERSION.to_le_bytes());
+    ro[8..16].copy_from_slice(&reserved_offset.to_le_bytes());
+    ro[16..24].copy_from_slice(&reserved_size.to_le_bytes());
+
+    let ro_fd = create_memfd(b"hbm-metadata\0", &ro, ro.len() as u64, RO_SEALS)?;
+    let rw_fd = create_memfd(b"hbm-metadata-rw\0", &rw, rw_size, RW_SEALS)?;
+
+    Ok((ro_fd, rw_fd))
+}
+
+// The errors of metadata accesses.
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum Error {
+    BadValue,
+    Unsupported,
+    // another process has been setting the value for too long, such as when it died while setting
+    Busy,
+}
+
+// A mapped metadata region.
+struct Region {
+    ptr: ptr::NonNull<u8>,
+    len: usize,
+}
+
+impl Region {
+    // Maps a region for reads or for reads and writes, after checking that it has the seals.
+    fn map(fd: BorrowedFd, seals: libc::c_int, writable: bool) -> Option<Self> {
+        // SAFETY: the fd is valid
+        let actual_seals = unsafe { libc::fcntl(fd.as_raw_fd(), libc::F_GET_SEALS) };
+        if actual_seals < 0 || actual_seals & seals != seals {
+            return None;
+        }
+
+        let mut stat = mem::MaybeUninit::<libc::stat>::uninit();
+        // SAFETY: the fd and stat are valid
+        if unsafe { libc::fstat(fd.as_raw_fd(), stat.as_mut_ptr()) } < 0 {
+            return None;
+        }
+        // SAFETY: fstat succeeded and initialized stat
+        let stat = unsafe { stat.assume_init() };
+
+        let len = usize::try_from(stat.st_size).ok().filter(|&len| len > 0)?;
+        let prot = if writable {
+            libc::PROT_READ | libc::PROT_WRITE
+        } else {
+            libc::PROT_READ
+        };
+
+        // SAFETY: the region is sealed against shrinking, and it is mapped for its entire size
+        let ptr = unsafe {
+            libc::mmap(
+                ptr::null_mut(),
+                len,
+                prot,
+                libc::MAP_SHARED,
+                fd.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return None;
+        }
+
+        Some(Self {
+            ptr: ptr::NonNull::new(ptr.cast())?,
+            len,
+        })
+    }
+
+    fn ptr_at(&self, offset: usize) -> *mut u8 {
+        self.ptr.as_ptr().wrapping_add(offset)
+    }
+
+    fn contains(&self, offset: usize, size: usize) -> bool {
+        offset.checked_add(size).is_some_and(|end| end <= self.len)
+    }
+
+    fn read_u32(&self, offset: usize) -> u32 {
+        let mut val = [0; 4];
+        self.read(offset, &mut val);
+        u32::from_le_bytes(val)
+    }
+
+    fn read_u64(&self, offset: usize) -> u64 {
+        let mut val = [0; 8];
+        self.read(offset, &mut val);
+        u64::from_le_bytes(val)
+    }
+
+    // Copies from the region.  The range must be in bounds.
+    fn read(&self, offset: usize, dst: &mut [u8]) {
+        assert!(self.contains(offset, dst.len()));
+        // SAFETY: the range is in bounds and dst does not overlap the region
+        unsafe { ptr::copy_nonoverlapping(self.ptr_at(offset), dst.as_mut_ptr(), dst.len()) };
+    }
+
+    // Returns a word of the region.  The word must be in bounds and 4-byte aligned.
+    fn word(&self, offset: usize) -> &AtomicU32 {
+        assert!(self.contains(offset, 4) && offset & 3 == 0);
+        // SAFETY: the word is in bounds and is 4-byte aligned because the region is page-aligned
+        unsafe { &*self.ptr_at(offset).cast::<AtomicU32>() }
+    }
+
+    // Copies words from the region.  Other processes might write the words concurrently.
+    fn read_words(&self, offset: usize, dst: &mut [u8]) {
+        for (idx, chunk) in dst.chunks_mut(4).enumerate() {
+            let word = self.word(offset + 4 * idx).load(Ordering::Relaxed);
+            chunk.copy_from_slice(&word.to_ne_bytes()[..chunk.len()]);
+        }
+    }
+
+    // Copies words to the region.  Other processes might read the words concurrently.
+    fn write_words(&self, offset: usize, src: &[u8]) {
+        for (idx, chunk) in src.chunks(4).enumerate() {
+            let mut word = [0; 4];
+            word[..chunk.len()].copy_from_slice(chunk);
+            self.word(offset + 4 * idx)
+                .store(u32::from_ne_bytes(word), Ordering::Relaxed);
+        }
+    }
+}
+
+impl Drop for Region {
+    fn drop(&mut self) {
+        // SAFETY: the region was mapped by map
+        unsafe { libc::munmap(self.ptr.as_ptr().cast(), self.len) };
+    }
+}
+
+#[derive(Clone, Copy, Default)]
+enum Entry {
+    #[default]
+    Unsupported,
+    // a read-only value in the read-only region
+    Value {
+        offset: usize,
+        size: usize,
+    },
+    // a slot in the read-write region
+    Slot {
+        offset: usize,
+        capacity: usize,
+    },
+}
+
+// The mapped metadata regions of a buffer.
+pub struct Metadata {
+    ro: Region,
+    rw: Region,
+    // the entries are validated once and copied
+    entries: [Entry; TYPE_COUNT],
+    reserved: (usize, usize),
+}
+
+// SAFETY: the regions are shared memory, and the slots are accessed atomically
+unsafe impl Send for Metadata {}
+// SAFETY: the regions are shared memory, and the slots are accessed atomically
+unsafe impl Sync for Metadata {}
+
+impl Metadata {
+    // Maps the read-only region and the read-write region of a buffer.
+    pub fn map(ro_fd: BorrowedFd, rw_fd: BorrowedFd) -> Option<Self> {
+        let ro = Region::map(ro_fd, RO_SEALS & !libc::F_SEAL_SEAL, false)?;
+        let rw = Region::map(rw_fd, RW_SEALS & !libc::F_SEAL_SEAL, true)?;
+        if !ro.contains(0, HEADER_SIZE + ENTRIES_SIZE) {
+            return None;
+        }
+
+        let mut metadata = Self {
+            ro,
+            rw,
+            entries: [Entry::default(); TYPE_COUNT],
+            reserved: (0, 0),
+        };
+        metadata.parse_header()?;
+
+        Some(metadata)
+    }
+
+    fn parse_header(&mut self) -> Option<()> {
+        let ro = &self.ro;
+        if ro.read_u32(0) != MAGIC || ro.read_u32(4) != VERSION {
+            return None;
+        }
+
+        let reserved_offset = usize::try_from(ro.read_u64(8)).ok()?;
+        let reserved_size = usize::try_from(ro.read_u64(16)).ok()?;
+        if !self.rw.contains(reserved_offset, reserved_size) {
+            return None;
+        }
+        self.reserved = (reserved_offset, reserved_size);
+
+        for (ty, settable) in SUPPORTED_TYPES {
+            let ty = ty as usize;
+            let offset = ro.read_u32(entry_offset(ty)) as usize;
+            let size = ro.read_u32(entry_offset(ty) + 4) as usize;
+            let capacity = ro.read_u32(entry_offset(ty) + 8) as usize;
+
+            let entry = if settable {
+                let valid = offset & 3 == 0
+                    && capacity <= SLOT_MAX_CAPACITY
+                    && self
+                        .rw
+                        .contains(offset, SLOT_HEADER_SIZE + capacity.next_multiple_of(4));
+                if !valid {
+                    return None;
+                }
+                Entry::Slot { offset, capacity }
+            } else {
+                if !ro.contains(offset, size) {
+                    return None;
+                }
+                Entry::Value { offset, size }
+            };
+            self.entries[ty] = entry;
+        }
+
+        Some(())
+    }
+
+    fn entry(&self, ty: i64) -> Result<Entry, Error> {
+        usize::try_from(ty)
+            .ok()
+            .and_then(|ty| self.entries.get(ty).copied())
+            .ok_or(Error::Unsupported)
+    }
+
+    // Copies the value of a slot to val, and returns the size of the value.
+    fn read_slot(&self, offset: usize, val: &mut [u8]) -> Result<usize, Error> {
+        let seq = self.rw.word(offset);
+        for _ in 0..SLOT_MAX_RETRIES {
+            let begin = seq.load(Ordering::Acquire);
+            if begin & 1 == 0 {
+                let size = self.rw.word(offset + 4).load(Ordering::Relaxed) as usize;
+                self.rw.read_words(offset + SLOT_HEADER_SIZE, val);
+
+                // the copy must complete before the sequence number is checked again
+                atomic::fence(Ordering::Acquire);
+                if seq.load(Ordering::Relaxed) == begin {
+                    // a misbehaving process can write any size
+                    return Ok(size.min(val.len()));
+                }
+            }
+
+            thread::yield_now();
+        }
+
+        Err(Error::Busy)
+    }
+
+    // Copies src to a slot.
+    fn write_slot(&self, offset: usize, src: &[u8]) -> Result<(), Error> {
+        let seq = self.rw.word(offset);
+        for _ in 0..SLOT_MAX_RETRIES {
+            let begin = seq.load(Ordering::Relaxed);
+            if begin & 1 == 0
+                && seq
+                    .compare_exchange_weak(begin, begin + 1, Ordering::Relaxed, Ordering::Relaxed)
+                    .is_ok()
+            {
+                // the odd sequence number must be visible before the copy
+                atomic::fence(Ordering::Release);
+                self.rw
+                    .word(offset + 4)
+                    .store(src.len() as u32, Ordering::Relaxed);
+                self.rw.write_words(offset + SLOT_HEADER_SIZE, src);
+                seq.store(begin.wrapping_add(2), Ordering::Release);
+
+                return Ok(());
+            }
+
+            thread::yield_now();
+        }
+
+        Err(Error::Busy)
+    }
+
+    // Gets the value of a metadata type and returns its size.  The value is copied only when dst
+    // is large enough.
+    pub fn get(&self, ty: i64, dst: &mut [u8]) -> Result<usize, Error> {
+        match self.entry(ty)? {
+            Entry::Unsupported => Err(Error::Unsupported),
+            Entry::Value { offset, size } => {
+                if let Some(dst) = dst.get_mut(..size) {
+                    self.ro.read(offset, dst);
+                }
+
+                Ok(size)
+            }
+            Entry::Slot { offset, capacity } => {
+                let mut val = [0; SLOT_MAX_CAPACITY];
+                let val = &mut val[..capacity];
+                let size = self.read_slot(offset, val)?;
+                if let Some(dst) = dst.get_mut(..size) {
+                    dst.copy_from_slice(&val[..size]);
+                }
+
+                Ok(size)
+            }
+        }
+    }
+
+    // Sets the value of a metadata type.
+    pub fn set(&self, ty: i64, src: &[u8]) -> Result<(), Error> {
+        validate(ty, src)?;
+
+        let Entry::Slot { offset, capacity } = self.entry(ty)? else {
+            return Err(Error::Unsupported);
+        };
+        if src.len() > capacity {
+            return Err(Error::BadValue);
+        }
+
+        self.write_slot(offset, src)
+    }
+
+    // Returns the reserved region.
+    pub fn reserved_region(&self) -> Option<(ptr::NonNull<u8>, usize)> {
+        let (offset, size) = self.reserved;
+        if size == 0 {
+            return None;
+        }
+
+        Some((ptr::NonNull::new(self.rw.ptr_at(offset))?, size))
+    }
+}
@@ -52,7 +52,7 @@ test_image_copy(struct hbm_bo *img_bo, struct hbm_bo *buf_bo, uint32_t width, ui
     if (!hbm_bo_copy_buffer_image(buf_bo, img_bo, &copy, -1, NULL))
         die("failed to copy image to buffer");
 
-    void *buf_ptr = hbm_bo_map(buf_bo);
+    void *buf_ptr = hbm_bo_map(buf_bo, HBM_ACCESS_READ);
     if (!buf_ptr)
         die("failed to map buffer");
 
@@ -70,7 +70,7 @@ test_image_copy(struct hbm_bo *img_bo, struct hbm_bo *buf_bo, uint32_t width, ui
     if (!hbm_bo_copy_buffer_image(img_bo, buf_bo, &copy, -1, NULL))
         die("failed to copy buffer to image");
 
-    void *img_ptr = hbm_bo_map(img_bo);
+    void *img_ptr = hbm_bo_map(img_bo, HBM_ACCESS_READ);
     if (!img_ptr)
         die("failed to map image");
 
@@ -89,7 +89,7 @@ test_image_copy(struct hbm_bo *img_bo, struct hbm_bo *buf_bo, uint32_t width, ui
 static void
 test_image_map(struct hbm_bo *img_bo, uint32_t width, uint32_t height, uint64_t stride, bool write)
 {
-    void *img_ptr = hbm_bo_map(img_bo);
+    void *img_ptr = hbm_bo_map(img_bo, write ? HBM_ACCESS_WRITE : HBM_ACCESS_READ);
     if (!img_ptr)
         die("failed to map image");
 
@@ -233,7 +233,7 @@ test_buffer_copy(struct hbm_bo *buf_bo, struct hbm_bo *buf_dst, uint64_t buf_siz
     if (!hbm_bo_copy_buffer(buf_dst, buf_bo, &copy, -1, NULL))
         die("failed to copy buffer");
 
-    void *buf_ptr = hbm_bo_map(buf_bo);
+    void *buf_ptr = hbm_bo_map(buf_bo, HBM_ACCESS_READ);
     if (!buf_ptr)
         die("failed to map buffer");
 
@@ -251,7 +251,7 @@ test_buffer_copy(struct hbm_bo *buf_bo, struct hbm_bo *buf_dst, uint64_t buf_siz
 static void
 test_buffer_map(struct hbm_bo *buf_bo, uint64_t buf_size, bool write)
 {
-    void *buf_ptr = hbm_bo_map(buf_bo);
+    void *buf_ptr = hbm_bo_map(buf_bo, write ? HBM_ACCESS_WRITE : HBM_ACCESS_READ);
     if (!buf_ptr)
         die("failed to map buffer");
 
@@ -6,9 +6,12 @@
 //! Implements an unstable C API for minigbm drivers.
 
 use super::log::LogError;
-use std::collections::{hash_map::Entry, HashMap};
-use std::sync::{Arc, Mutex};
-use std::{ffi, ptr, slice};
+use std::collections::hash_map::RandomState;
+use std::collections::HashMap;
+use std::hash::BuildHasher;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, RwLock};
+use std::{array, env, ffi, ptr, slice};
 
 /// Log level of a message or the message filter.
 #[repr(C)]
@@ -41,6 +44,12 @@ pub const HBM_FLAG_COPY: u32 = 1 << 2;
 pub const HBM_FLAG_PROTECTED: u32 = 1 << 3;
 /// The BO must not be compressed.
 pub const HBM_FLAG_NO_COMPRESSION: u32 = 1 << 4;
+/// The CPU writes the BO once and the GPU reads it many times.  This requires `HBM_FLAG_MAP`.
+pub const HBM_FLAG_CPU_UPLOAD: u32 = 1 << 5;
+/// The CPU writes the BO frequently.  This requires `HBM_FLAG_MAP`.
+pub const HBM_FLAG_CPU_STREAM: u32 = 1 << 6;
+/// The CPU reads the BO back after the GPU writes it.  This requires `HBM_FLAG_MAP`.
+pub const HBM_FLAG_CPU_READBACK: u32 = 1 << 7;
 
 /// The BO can be used for GPU copies.
 pub const HBM_USAGE_GPU_TRANSFER: u64 = 1u64 << 0;
@@ -64,6 +73,35 @@ pub const HBM_MEMORY_TYPE_COHERENT: u32 = 1 << 2;
 /// The memory type is cached.
 pub const HBM_MEMORY_TYPE_CACHED: u32 = 1 << 3;
 
+/// The number of memory types, which are all combinations of the memory type bits.
+pub const HBM_MEMORY_TYPE_COUNT: usize = 16;
+
+/// The operation classifies BOs.
+pub const HBM_OPERATION_CLASSIFY: u32 = 0;
+/// The operation creates BOs with constraints or with layouts.
+pub const HBM_OPERATION_CREATE: u32 = 1;
+/// The operation allocates or imports memories, and binds them to BOs.
+pub const HBM_OPERATION_BIND_MEMORY: u32 = 2;
+/// The operation maps BOs for the first time.
+pub const HBM_OPERATION_MAP: u32 = 3;
+/// The operation copies BOs, including any wait for the copies to complete.
+pub const HBM_OPERATION_COPY: u32 = 4;
+/// The operation waits for copies to complete.
+pub const HBM_OPERATION_WAIT: u32 = 5;
+/// The number of operations.
+pub const HBM_OPERATION_COUNT: usize = 6;
+
+/// The number of buckets of a latency histogram.
+///
+/// Bucket 0 counts latencies below 1us.  Bucket `i` counts latencies in `[2^(i-1), 2^i)` us,
+/// except that the last bucket also counts all longer latencies.
+pub const HBM_HISTOGRAM_BUCKET_COUNT: usize = 24;
+
+/// The CPU reads.
+pub const HBM_ACCESS_READ: u32 = 1 << 0;
+/// The CPU writes.
+pub const HBM_ACCESS_WRITE: u32 = 1 << 1;
+
 /// A hardware device.
 ///
 /// This opaque struct represents a device.  There are module-level functions to query device info
@@ -193,6 +231,57 @@ pub struct hbm_copy_buffer_image {
     pub height: u32,
 }
 
+/// Describes a buffer-image copy in a batch.
+#[repr(C)]
+pub struct hbm_copy_buffer_image_batch_item {
+    /// Destination BO.
+    pub dst: *mut hbm_bo,
+    /// Source BO.
+    pub src: *mut hbm_bo,
+    /// The copy from the source BO to the destination BO.
+    pub copy: hbm_copy_buffer_image,
+}
+
+/// Statistics of the class cache of a device.
+#[repr(C)]
+pub struct hbm_class_cache_stats {
+    /// Number of lookups that found a cached class.
+    pub hits: u64,
+    /// Number of lookups that classified a BO description.
+    pub misses: u64,
+}
+
+/// Latency statistics of an operation.
+#[repr(C)]
+pub struct hbm_operation_stats {
+    /// Number of times the operation was performed.
+    pub count: u64,
+    /// Total time spent in the operation, in nanoseconds.
+    pub total_ns: u64,
+    /// Longest time spent in a single operation, in nanoseconds.
+    pub max_ns: u64,
+    /// Latency histogram.
+    pub histogram: [u64; HBM_HISTOGRAM_BUCKET_COUNT],
+}
+
+/// Statistics of the live BOs of a memory type.
+#[repr(C)]
+pub struct hbm_memory_stats {
+    /// Number of BOs with memories of the memory type bound.
+    pub count: u64,
+    /// Total size of the BOs.
+    pub size: u64,
+}
+
+/// Statistics of a device.
+#[repr(C)]
+pub struct hbm_stats {
+    /// Latency statistics, indexed by `HBM_OPERATION_*`.
+    pub ops: [hbm_operation_stats; HBM_OPERATION_COUNT],
+    /// Live BO statistics, indexed by memory types.
+    pub memory: [hbm_memory_stats; HBM_MEMORY_TYPE_COUNT],
+}
+
 // helpers to convert parameters to/from C
 mod c {
     use super::*;
@@ -255,6 +344,15 @@ mod c {
         if (c_flags & HBM_FLAG_NO_COMPRESSION) > 0 {
             flags |= hbm::Flags::NO_COMPRESSION;
         }
+        if (c_flags & HBM_FLAG_CPU_UPLOAD) > 0 {
+            flags |= hbm::Flags::CPU_UPLOAD;
+        }
+        if (c_flags & HBM_FLAG_CPU_STREAM) > 0 {
+            flags |= hbm::Flags::CPU_STREAM;
+        }
+        if (c_flags & HBM_FLAG_CPU_READBACK) > 0 {
+            flags |= hbm::Flags::CPU_READBACK;
+        }
 
         flags
     }
@@ -334,8 +432,7 @@ mod c {
             .stride_align(con.stride_align)
             .size_align(con.size_align);
         if !mods.is_empty() {
-            let mods: Vec<hbm::Modifier> = mods.iter().copied().map(hbm::Modifier::from).collect();
-            con = con.modifiers(mods);
+            con = con.modifiers(mods.iter().copied().map(hbm::Modifier::from));
         }
 
         Some(con)
@@ -422,6 +519,16 @@ mod c {
         c_mt
     }
 
+    pub fn access_from(c_access: u32) -> Option<hbm::Access> {
+        const READ_WRITE: u32 = HBM_ACCESS_READ | HBM_ACCESS_WRITE;
+        match c_access {
+            HBM_ACCESS_READ => Some(hbm::Access::Read),
+            HBM_ACCESS_WRITE => Some(hbm::Access::Write),
+            READ_WRITE => Some(hbm::Access::ReadWrite),
+            _ => None,
+        }
+    }
+
     pub fn mt_copy_out(out_mts: *mut u32, mt_max: u32, mts: Vec<hbm::MemoryType>) -> u32 {
         let mut mt_count = mts.len() as u32;
         if mt_max == 0 {
@@ -499,6 +606,29 @@ mod c {
         }
     }
 
+    pub fn copybufferimagebatch_from<'a>(
+        items: *const hbm_copy_buffer_image_batch_item,
+        count: u32,
+    ) -> Vec<(&'a hbm::Bo, &'a hbm::Bo, hbm::CopyBufferImage)> {
+        if count == 0 {
+            return Vec::new();
+        }
+
+        // SAFETY: items is valid and has count items
+        let items = unsafe { slice::from_raw_parts(items, count as usize) };
+
+        items
+            .iter()
+            .map(|item| {
+                (
+                    bo_borrow(item.dst),
+                    bo_borrow(item.src),
+                    copybufferimage_from(&item.copy),
+                )
+            })
+            .collect()
+    }
+
     pub fn copybufferimage_from(copy: *const hbm_copy_buffer_image) -> hbm::CopyBufferImage {
         // SAFETY: copy is valid
         let copy = unsafe { &*copy };
@@ -548,11 +678,31 @@ pub unsafe extern "C" fn hbm_log_init(
     super::log::enable(log_lv_max, Box::new(cb));
 }
 
-type ClassCache = HashMap<hbm_description, Arc<hbm::Class>>;
+const CLASS_CACHE_SHARD_COUNT: usize = 16;
+
+type ClassCacheShard = RwLock<HashMap<hbm_description, Arc<hbm::Class>>>;
+
+// The class cache is read-mostly.  It is sharded such that concurrent hits only share read locks
+// and concurrent misses rarely contend.
+#[derive(Default)]
+struct ClassCache {
+    hasher: RandomState,
+    shards: [ClassCacheShard; CLASS_CACHE_SHARD_COUNT],
+
+    hits: AtomicU64,
+    misses: AtomicU64,
+}
+
+impl ClassCache {
+    fn shard(&self, desc: &hbm_description) -> &ClassCacheShard {
+        let idx = self.hasher.hash_one(desc) as usize % CLASS_CACHE_SHARD_COUNT;
+        &self.shards[idx]
+    }
+}
 
 struct CDevice {
     device: Arc<hbm::Device>,
-    class_cache: Mutex<ClassCache>,
+    class_cache: ClassCache,
 }
 
 impl CDevice {
@@ -567,32 +717,40 @@ impl CDevice {
     }
 
     fn get_class(&self, desc: hbm_description) -> hbm::Result<Arc<hbm::Class>> {
-        let mut class_cache = self.class_cache.lock().unwrap();
-        let class = match class_cache.entry(desc) {
-            Entry::Occupied(e) => e.into_mut(),
-            Entry::Vacant(e) => {
-                let class = self.classify(e.key())?;
-                e.insert(Arc::new(class))
-            }
-        };
+        let cache = &self.class_cache;
+        let shard = cache.shard(&desc);
+
+        if let Some(class) = shard.read().unwrap().get(&desc) {
+            cache.hits.fetch_add(1, Ordering::Relaxed);
+            return Ok(class.clone());
+        }
+        cache.misses.fetch_add(1, Ordering::Relaxed);
+
+        // classify without the lock held; two threads can classify the same description, which
+        // is harmless
+        let class = Arc::new(self.classify(&desc)?);
+        let class = shard.write().unwrap().entry(desc).or_insert(class).clone();
 
-        Ok(class.clone())
+        Ok(class)
     }
 }
 
 /// Creates a device.
 ///
+/// If the `HBM_CACHE_DIR` environment variable is set, device capabilities are cached in the
+/// directory to speed up later device creations.
+///
 /// # Safety
 ///
 /// This function is always safe.
 #[no_mangle]
 pub unsafe extern "C" fn hbm_device_create(dev: libc::dev_t, debug: bool) -> *mut hbm_device {
-    let Ok(backend) = hbm::vulkan::Builder::new()
-        .device_id(dev as _)
-        .debug(debug)
-        .build()
-        .log_err("create backend")
-    else {
+    let mut builder = hbm::vulkan::Builder::new().device_id(dev as _).debug(debug);
+    if let Some(cache_dir) = env::var_os("HBM_CACHE_DIR") {
+        builder = builder.cache_dir(cache_dir);
+    }
+
+    let Ok(backend) = builder.build().log_err("create backend") else {
         return ptr::null_mut();
     };
 
@@ -606,7 +764,7 @@ pub unsafe extern "C" fn hbm_device_create(dev: libc::dev_t, debug: bool) -> *mu
 
     let dev = CDevice {
         device,
-        class_cache: Mutex::new(HashMap::new()),
+        class_cache: Default::default(),
     };
 
     c::dev_ret(dev)
@@ -622,6 +780,75 @@ pub unsafe extern "C" fn hbm_device_destroy(dev: *mut hbm_device) {
     let _ = c::dev_take(dev);
 }
 
+/// Queries the statistics of the class cache.
+///
+/// # Safety
+///
+/// `dev` and `out_stats` must be valid.
+#[no_mangle]
+pub unsafe extern "C" fn hbm_device_get_class_cache_stats(
+    dev: *mut hbm_device,
+    out_stats: *mut hbm_class_cache_stats,
+) {
+    let dev = c::dev_borrow(dev);
+    let cache = &dev.class_cache;
+
+    // SAFETY: out_stats is valid
+    let out_stats = unsafe { &mut *out_stats };
+    *out_stats = hbm_class_cache_stats {
+        hits: cache.hits.load(Ordering::Relaxed),
+        misses: cache.misses.load(Ordering::Relaxed),
+    };
+}
+
+/// Queries the operation and live BO statistics of a device.
+///
+/// # Safety
+///
+/// `dev` and `out_stats` must be valid.
+#[no_mangle]
+pub unsafe extern "C" fn hbm_device_get_stats(dev: *mut hbm_device, out_stats: *mut hbm_stats) {
+    let dev = c::dev_borrow(dev);
+    // the device has a single backend
+    let stats = dev.device.stats().swap_remove(0);
+
+    let op_stats = |op: hbm::Operation| {
+        let stats = stats.operation(op);
+        hbm_operation_stats {
+            count: stats.count,
+            total_ns: stats.total.as_nanos() as u64,
+            max_ns: stats.max.as_nanos() as u64,
+            histogram: stats.histogram,
+        }
+    };
+    let memory_stats = |bits: usize| {
+        let mt = hbm::MemoryType::from_bits_truncate(bits as u32);
+        let stats = stats.memory(mt);
+        hbm_memory_stats {
+            count: stats.count,
+            size: stats.size,
+        }
+    };
+
+    // SAFETY: out_stats is valid
+    let out_stats = unsafe { &mut *out_stats };
+    *out_stats = hbm_stats {
+        ops: hbm::Operation::ALL.map(op_stats),
+        memory: array::from_fn(memory_stats),
+    };
+}
+
+/// Frees the resources that the device keeps for recycling.  BOs are not affected.
+///
+/// # Safety
+///
+/// `dev` must be valid.
+#[no_mangle]
+pub unsafe extern "C" fn hbm_device_trim(dev: *mut hbm_device) {
+    let dev = c::dev_borrow(dev);
+    dev.device.trim();
+}
+
 /// Queries the memory plane count for the speicifed format modifier.  Returns 0 if the format or
 /// the modifier is not supported.
 ///
@@ -648,6 +875,8 @@ pub unsafe extern "C" fn hbm_device_get_plane_count(
 /// If the BO description is not supported or refers to a buffer, there is no supported modifier
 /// and 0 is always returned.
 ///
+/// The modifiers are sorted by preference, with compressed modifiers first.
+///
 /// If `mod_max` is 0, the number of supported modifiers is returned.  Otherwise, the number of
 /// supported modifiers written to `out_mods` is returned.
 ///
@@ -816,6 +1045,8 @@ pub unsafe extern "C" fn hbm_bo_memory_types(
 /// If `dmabuf` is negative, the memory is allocated.  Otherwise, the BO must have `HBM_FLAG_EXTERNAL` and
 /// the memory is imported from `dmabuf`.  Ownership of `dmabuf` is always transferred.
 ///
+/// If `mt` is 0, the memory type that best suits the `HBM_FLAG_CPU_*` flags of the BO is used.
+///
 /// # Safety
 ///
 /// `bo` must be valid.
@@ -860,15 +1091,47 @@ pub unsafe extern "C" fn hbm_bo_export_dma_buf(bo: *mut hbm_bo, name: *const ffi
 /// Map a BO for direct CPU access.
 ///
 /// The BO must have `HBM_FLAG_MAP` and must have an `HBM_MEMORY_TYPE_MAPPABLE` memory bound.
+/// `access` is a bitmask of `HBM_ACCESS_*`.  A read-only mapping needs no flush and a write-only
+/// mapping needs no invalidation.
 ///
 /// # Safety
 ///
 /// `bo` must be valid.
 #[no_mangle]
-pub unsafe extern "C" fn hbm_bo_map(bo: *mut hbm_bo) -> *mut ffi::c_void {
-    let bo = c::bo_borrow_mut(bo);
+pub unsafe extern "C" fn hbm_bo_map(bo: *mut hbm_bo, access: u32) -> *mut ffi::c_void {
+    let bo = c::bo_borrow(bo);
+    let Some(access) = c::access_from(access) else {
+        return ptr::null_mut();
+    };
+
+    let Ok(mapping) = bo.map(access).log_err("map") else {
+        return ptr::null_mut();
+    };
+
+    mapping.ptr.as_ptr()
+}
 
-    let Ok(mapping) = bo.map().log_err("map") else {
+/// Map a range of a BO for direct CPU access.
+///
+/// This is similar to `hbm_bo_map` except only the range is mapped.  The returned pointer points
+/// to the start of the range.
+///
+/// # Safety
+///
+/// `bo` must be valid.
+#[no_mangle]
+pub unsafe extern "C" fn hbm_bo_map_range(
+    bo: *mut hbm_bo,
+    offset: u64,
+    size: u64,
+    access: u32,
+) -> *mut ffi::c_void {
+    let bo = c::bo_borrow(bo);
+    let Some(access) = c::access_from(access) else {
+        return ptr::null_mut();
+    };
+
+    let Ok(mapping) = bo.map_range(offset, size, access).log_err("map range") else {
         return ptr::null_mut();
     };
 
@@ -882,7 +1145,7 @@ pub unsafe extern "C" fn hbm_bo_map(bo: *mut hbm_bo) -> *mut ffi::c_void {
 /// `bo` must be valid.
 #[no_mangle]
 pub unsafe extern "C" fn hbm_bo_unmap(bo: *mut hbm_bo) {
-    let bo = c::bo_borrow_mut(bo);
+    let bo = c::bo_borrow(bo);
 
     bo.unmap();
 }
@@ -899,6 +1162,20 @@ pub unsafe extern "C" fn hbm_bo_flush(bo: *mut hbm_bo) {
     bo.flush();
 }
 
+/// Flush the CPU cache for a range of a non-coherent mapped BO.
+///
+/// The range must be within the mapping.
+///
+/// # Safety
+///
+/// `bo` must be valid.
+#[no_mangle]
+pub unsafe extern "C" fn hbm_bo_flush_range(bo: *mut hbm_bo, offset: u64, size: u64) {
+    let bo = c::bo_borrow(bo);
+
+    bo.flush_range(offset, size);
+}
+
 /// Invalidate the CPU cache for a non-coherent mapped BO.
 ///
 /// # Safety
@@ -911,6 +1188,55 @@ pub unsafe extern "C" fn hbm_bo_invalidate(bo: *mut hbm_bo) {
     bo.invalidate();
 }
 
+/// Invalidate the CPU cache for a range of a non-coherent mapped BO.
+///
+/// The range must be within the mapping.
+///
+/// # Safety
+///
+/// `bo` must be valid.
+#[no_mangle]
+pub unsafe extern "C" fn hbm_bo_invalidate_range(bo: *mut hbm_bo, offset: u64, size: u64) {
+    let bo = c::bo_borrow(bo);
+
+    bo.invalidate_range(offset, size);
+}
+
+/// Begin CPU access to a BO.
+///
+/// `access` is a bitmask of `HBM_ACCESS_*`.  This waits for pending device accesses and makes
+/// device writes visible to the CPU.  CPU accesses cannot be nested.
+///
+/// # Safety
+///
+/// `bo` must be valid.
+#[no_mangle]
+pub unsafe extern "C" fn hbm_bo_begin_cpu_access(bo: *mut hbm_bo, access: u32) -> bool {
+    let bo = c::bo_borrow(bo);
+
+    let Some(access) = c::access_from(access) else {
+        return false;
+    };
+
+    bo.begin_cpu_access(access)
+        .log_err("begin cpu access")
+        .is_ok()
+}
+
+/// End CPU access to a BO.
+///
+/// This makes CPU writes visible to the device.
+///
+/// # Safety
+///
+/// `bo` must be valid.
+#[no_mangle]
+pub unsafe extern "C" fn hbm_bo_end_cpu_access(bo: *mut hbm_bo) -> bool {
+    let bo = c::bo_borrow(bo);
+
+    bo.end_cpu_access().log_err("end cpu access").is_ok()
+}
+
 /// Performs a buffer-buffer copy from `src` to `bo`.
 ///
 /// Both BOs must have `HBM_FLAG_COPY`, must have memories bound, and must be buffers.
@@ -980,3 +1306,37 @@ pub unsafe extern "C" fn hbm_bo_copy_buffer_image(
         .map(|sync_fd| c::fd_copy_out(out_sync_fd, sync_fd))
         .is_ok()
 }
+
+/// Performs a batch of buffer-image copies.
+///
+/// This is similar to calling `hbm_bo_copy_buffer_image` for each item, except the copies are
+/// submitted at once.  The copies can cover different planes and different BOs, but a BO must not
+/// be both a destination and a source in the same batch.
+///
+/// `in_sync_fd` and `out_sync_fd` have the same meanings as in `hbm_bo_copy_buffer_image`, and
+/// apply to the entire batch.
+///
+/// # Safety
+///
+/// `items` must be valid and have `count` items.  All BOs must be valid and must belong to the
+/// same device.
+///
+/// If `in_sync_fd` is non-negative, it must be a valid sync file.
+///
+/// If `out_sync_fd` is non-NULL, it must be point to an i32.
+#[no_mangle]
+pub unsafe extern "C" fn hbm_bo_copy_buffer_image_batch(
+    items: *const hbm_copy_buffer_image_batch_item,
+    count: u32,
+    in_sync_fd: i32,
+    out_sync_fd: *mut i32,
+) -> bool {
+    let copies = c::copybufferimagebatch_from(items, count);
+    let in_sync_fd = c::fd_optional_from(in_sync_fd);
+
+    let wait = out_sync_fd.is_null();
+    hbm::Bo::copy_buffer_image_batch(&copies, in_sync_fd, wait)
+        .log_err("copy image batch")
+        .map(|sync_fd| c::fd_copy_out(out_sync_fd, sync_fd))
+        .is_ok()
+}
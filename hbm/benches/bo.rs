@@ -0,0 +1,77 @@
+// Copyright 2025 Google LLC
+// SPDX-License-Identifier: MIT
+
+// Benchmarks BO allocation and mapping.
+
+mod common;
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion};
+use hbm::{Access, Extent, Flags};
+use std::hint::black_box;
+
+fn bench_alloc_free(c: &mut Criterion) {
+    let mut group = c.benchmark_group("alloc_free");
+    let flags = Flags::EXTERNAL;
+
+    for (backend, dev) in common::devices() {
+        if let Some(class) = backend.classify(&dev, flags, None) {
+            for size in common::BUFFER_SIZES {
+                let id = BenchmarkId::new(backend.name(), format!("buffer-{size}"));
+                group.bench_function(id, |b| {
+                    b.iter(|| common::alloc(&dev, &class, flags, Extent::Buffer(size)))
+                });
+            }
+        }
+
+        for (fmt_name, fmt) in common::IMAGE_FORMATS {
+            let Some(class) = backend.classify(&dev, flags, Some(fmt)) else {
+                continue;
+            };
+
+            for (size_name, width, height) in common::IMAGE_SIZES {
+                let id = BenchmarkId::new(backend.name(), format!("{fmt_name}-{size_name}"));
+                group.bench_function(id, |b| {
+                    b.iter(|| common::alloc(&dev, &class, flags, Extent::Image(width, height)))
+                });
+            }
+        }
+    }
+
+    group.finish();
+}
+
+fn bench_map_unmap(c: &mut Criterion) {
+    let mut group = c.benchmark_group("map_unmap");
+    let flags = Flags::EXTERNAL | Flags::MAP;
+    let size = 1024 * 1024;
+
+    for (backend, dev) in common::devices() {
+        let Some(class) = backend.classify(&dev, flags, None) else {
+            continue;
+        };
+        let bo = common::alloc(&dev, &class, flags, Extent::Buffer(size));
+
+        // every iteration maps and unmaps the memory
+        group.bench_function(BenchmarkId::new(backend.name(), "first"), |b| {
+            b.iter(|| {
+                black_box(bo.map(Access::Write).unwrap());
+                bo.unmap();
+            })
+        });
+
+        // every iteration takes the lockless path of recursive mapping
+        bo.map(Access::Write).unwrap();
+        group.bench_function(BenchmarkId::new(backend.name(), "recursive"), |b| {
+            b.iter(|| {
+                black_box(bo.map(Access::Write).unwrap());
+                bo.unmap();
+            })
+        });
+        bo.unmap();
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_alloc_free, bench_map_unmap);
+criterion_main!(benches);
@@ -0,0 +1,179 @@
+// Copyright 2025 Google LLC
+// SPDX-License-Identifier: MIT
+
+// Shared setup of the benchmarks.
+//
+// Each benchmark runs against all backend configurations that are available on the machine.
+// Configurations that fail to build, such as dma-heap without /dev/dma_heap, are skipped.
+
+// each benchmark uses a different part of this module
+#![allow(dead_code)]
+
+use drm_fourcc::DrmFourcc;
+use hbm::{Access, Flags, Format, MemoryType, Modifier, Size, Usage};
+use std::sync::Arc;
+
+// the buffer sizes to benchmark, which are also the pool sizes of dma-heap-pool
+pub const BUFFER_SIZES: [Size; 4] = [4 * 1024, 64 * 1024, 1024 * 1024, 8 * 1024 * 1024];
+
+// the image formats and sizes to benchmark
+pub const IMAGE_FORMATS: [(&str, DrmFourcc); 2] =
+    [("abgr8888", DrmFourcc::Abgr8888), ("nv12", DrmFourcc::Nv12)];
+pub const IMAGE_SIZES: [(&str, u32, u32); 2] = [("1080p", 1920, 1080), ("4k", 3840, 2160)];
+
+// DRM_FORMAT_MOD_LINEAR
+const MOD_LINEAR: Modifier = Modifier(0);
+
+const POOL_COUNT: usize = 4;
+const SLAB_SIZE: Size = 2 * 1024 * 1024;
+
+// A backend configuration.
+#[derive(Clone, Copy, Debug)]
+pub enum Backend {
+    DmaHeap,
+    DmaHeapPool,
+    Udmabuf,
+    UdmabufHugetlbSlab,
+    #[cfg(feature = "ash")]
+    Vulkan,
+}
+
+pub const BACKENDS: &[Backend] = &[
+    Backend::DmaHeap,
+    Backend::DmaHeapPool,
+    Backend::Udmabuf,
+    Backend::UdmabufHugetlbSlab,
+    #[cfg(feature = "ash")]
+    Backend::Vulkan,
+];
+
+impl Backend {
+    pub fn name(self) -> &'static str {
+        match self {
+            Backend::DmaHeap => "dma-heap",
+            Backend::DmaHeapPool => "dma-heap-pool",
+            Backend::Udmabuf => "udmabuf",
+            Backend::UdmabufHugetlbSlab => "udmabuf-hugetlb-slab",
+            #[cfg(feature = "ash")]
+            Backend::Vulkan => "vulkan",
+        }
+    }
+
+    // Builds a device with the backend, or returns None if the backend is unavailable.
+    pub fn build(self) -> Option<Arc<hbm::Device>> {
+        let builder = hbm::Builder::new();
+        let builder = match self {
+            Backend::DmaHeap => builder.add_backend(
+                hbm::dma_heap::Builder::new()
+                    .heap_name("system")
+                    .build()
+                    .ok()?,
+            ),
+            Backend::DmaHeapPool => {
+                let backend = BUFFER_SIZES
+                    .iter()
+                    .fold(
+                        hbm::dma_heap::Builder::new().heap_name("system"),
+                        |b, &size| b.pool(size, POOL_COUNT),
+                    )
+                    .build()
+                    .ok()?;
+                builder.add_backend(backend)
+            }
+            Backend::Udmabuf => builder.add_backend(hbm::udmabuf::Builder::new().build().ok()?),
+            Backend::UdmabufHugetlbSlab => {
+                let backend = hbm::udmabuf::Builder::new()
+                    .hugetlb(true)
+                    .slab_size(SLAB_SIZE)
+                    .build()
+                    .ok()?;
+                builder.add_backend(backend)
+            }
+            #[cfg(feature = "ash")]
+            Backend::Vulkan => builder.add_backend(hbm::vulkan::Builder::new().build().ok()?),
+        };
+
+        builder.build().ok()
+    }
+
+    pub fn usage(self) -> Usage {
+        match self {
+            #[cfg(feature = "ash")]
+            Backend::Vulkan => Usage::Vulkan(hbm::vulkan::Usage::TRANSFER),
+            _ => Usage::Unused,
+        }
+    }
+
+    // Returns a description for the backend.  dma-buf backends only support linear images.
+    pub fn description(self, flags: Flags, fmt: Option<DrmFourcc>) -> hbm::Description {
+        let desc = hbm::Description::new().flags(flags);
+        let Some(fmt) = fmt else {
+            return desc;
+        };
+
+        let desc = desc.format(Format(fmt as u32));
+        match self {
+            #[cfg(feature = "ash")]
+            Backend::Vulkan => desc,
+            _ => desc.modifier(MOD_LINEAR),
+        }
+    }
+
+    // Returns the flags of images that are copied to or copied from.  Copies fall back to the
+    // CPU on backends without device copies, which requires mapping.
+    pub fn image_copy_flags(self) -> Flags {
+        match self {
+            #[cfg(feature = "ash")]
+            Backend::Vulkan => Flags::COPY,
+            _ => Flags::MAP | Flags::COPY,
+        }
+    }
+
+    // Classifies a description, or returns None if the backend does not support it.
+    pub fn classify(
+        self,
+        dev: &hbm::Device,
+        flags: Flags,
+        fmt: Option<DrmFourcc>,
+    ) -> Option<hbm::Class> {
+        let res = dev.classify(self.description(flags, fmt), &[self.usage()]);
+        if let Err(err) = &res {
+            eprintln!("skipping unsupported {} {:?}: {}", self.name(), fmt, err);
+        }
+
+        res.ok()
+    }
+}
+
+// Builds the devices of all available backends.
+pub fn devices() -> Vec<(Backend, Arc<hbm::Device>)> {
+    BACKENDS
+        .iter()
+        .filter_map(|&backend| match backend.build() {
+            Some(dev) => Some((backend, dev)),
+            None => {
+                eprintln!("skipping unavailable backend {}", backend.name());
+                None
+            }
+        })
+        .collect()
+}
+
+// Allocates a BO with memory bound.  Mappable BOs are bound to memory types for CPU writes.
+pub fn alloc(
+    dev: &Arc<hbm::Device>,
+    class: &hbm::Class,
+    flags: Flags,
+    extent: hbm::Extent,
+) -> hbm::Bo {
+    let mut bo = hbm::Bo::with_constraint(dev.clone(), class, extent, None).unwrap();
+
+    let mt = if flags.contains(Flags::MAP) {
+        bo.mappable_memory_type(Access::Write).unwrap()
+    } else {
+        MemoryType::empty()
+    };
+    bo.bind_memory(mt, None).unwrap();
+
+    bo
+}
@@ -0,0 +1,99 @@
+// Copyright 2025 Google LLC
+// SPDX-License-Identifier: MIT
+
+// Benchmarks operations on a shared device or a shared BO from multiple threads.
+//
+// Each iteration performs the operation once on every thread, and the throughput is reported in
+// operations.
+
+mod common;
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use hbm::{Access, Extent, Flags};
+use std::hint::black_box;
+use std::sync::Barrier;
+use std::thread;
+use std::time::{Duration, Instant};
+
+const THREAD_COUNTS: [usize; 4] = [1, 2, 4, 8];
+
+// Runs f for iters iterations on each of thread_count threads, and returns the wall time.
+fn run_threads<F>(thread_count: usize, iters: u64, f: F) -> Duration
+where
+    F: Fn() + Sync,
+{
+    // the threads are created before the timer starts
+    let barrier = Barrier::new(thread_count + 1);
+    thread::scope(|s| {
+        let handles: Vec<_> = (0..thread_count)
+            .map(|_| {
+                s.spawn(|| {
+                    barrier.wait();
+                    for _ in 0..iters {
+                        f();
+                    }
+                })
+            })
+            .collect();
+
+        barrier.wait();
+        let start = Instant::now();
+        for handle in handles {
+            handle.join().unwrap();
+        }
+        start.elapsed()
+    })
+}
+
+fn bench_contention(c: &mut Criterion) {
+    let mut group = c.benchmark_group("contention");
+    let flags = Flags::EXTERNAL | Flags::MAP;
+    let size = 64 * 1024;
+
+    for (backend, dev) in common::devices() {
+        let Some(class) = backend.classify(&dev, flags, None) else {
+            continue;
+        };
+        let desc = backend.description(flags, None);
+        let usage = [backend.usage()];
+        let bo = common::alloc(&dev, &class, flags, Extent::Buffer(size));
+
+        for thread_count in THREAD_COUNTS {
+            group.throughput(Throughput::Elements(thread_count as u64));
+
+            let id = BenchmarkId::new(format!("{}/classify", backend.name()), thread_count);
+            group.bench_function(id, |b| {
+                b.iter_custom(|iters| {
+                    run_threads(thread_count, iters, || {
+                        black_box(dev.classify(desc, &usage).unwrap());
+                    })
+                })
+            });
+
+            let id = BenchmarkId::new(format!("{}/alloc_free", backend.name()), thread_count);
+            group.bench_function(id, |b| {
+                b.iter_custom(|iters| {
+                    run_threads(thread_count, iters, || {
+                        black_box(common::alloc(&dev, &class, flags, Extent::Buffer(size)));
+                    })
+                })
+            });
+
+            // all threads map and unmap the same BO
+            let id = BenchmarkId::new(format!("{}/map_unmap", backend.name()), thread_count);
+            group.bench_function(id, |b| {
+                b.iter_custom(|iters| {
+                    run_threads(thread_count, iters, || {
+                        black_box(bo.map(Access::Write).unwrap());
+                        bo.unmap();
+                    })
+                })
+            });
+        }
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_contention);
+criterion_main!(benches);
@@ -0,0 +1,129 @@
+// Copyright 2025 Google LLC
+// SPDX-License-Identifier: MIT
+
+// Benchmarks buffer-buffer and buffer-image copies.
+//
+// All copies wait for completion such that the throughput includes the latency.
+
+mod common;
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use drm_fourcc::DrmFourcc;
+use hbm::{CopyBuffer, CopyBufferImage, Extent, Flags, Size};
+
+// Returns the (bytes per texel, horizontal subsampling, vertical subsampling) of the planes.
+fn planes(fmt: DrmFourcc) -> &'static [(u32, u32, u32)] {
+    match fmt {
+        DrmFourcc::Abgr8888 => &[(4, 1, 1)],
+        DrmFourcc::Nv12 => &[(1, 1, 1), (2, 2, 2)],
+        _ => unreachable!(),
+    }
+}
+
+// Returns the copies of all planes of an image from or to a tightly packed buffer, and the
+// buffer size.
+fn plane_copies(fmt: DrmFourcc, width: u32, height: u32) -> (Vec<CopyBufferImage>, Size) {
+    let mut offset = 0;
+    let copies = planes(fmt)
+        .iter()
+        .enumerate()
+        .map(|(plane, &(bpp, sub_w, sub_h))| {
+            let plane_width = width / sub_w;
+            let plane_height = height / sub_h;
+            let stride = (plane_width * bpp) as Size;
+
+            let copy = CopyBufferImage {
+                offset,
+                stride,
+                plane: plane as u32,
+                x: 0,
+                y: 0,
+                width: plane_width,
+                height: plane_height,
+            };
+            offset += stride * plane_height as Size;
+
+            copy
+        })
+        .collect();
+
+    (copies, offset)
+}
+
+fn bench_copy_buffer(c: &mut Criterion) {
+    let mut group = c.benchmark_group("copy_buffer");
+    let flags = Flags::MAP | Flags::COPY;
+
+    for (backend, dev) in common::devices() {
+        let Some(class) = backend.classify(&dev, flags, None) else {
+            continue;
+        };
+
+        for size in common::BUFFER_SIZES {
+            let src = common::alloc(&dev, &class, flags, Extent::Buffer(size));
+            let dst = common::alloc(&dev, &class, flags, Extent::Buffer(size));
+            let copy = CopyBuffer {
+                src_offset: 0,
+                dst_offset: 0,
+                size,
+            };
+
+            group.throughput(Throughput::Bytes(size));
+            group.bench_function(BenchmarkId::new(backend.name(), size), |b| {
+                b.iter(|| dst.copy_buffer(&src, copy, None, true).unwrap())
+            });
+        }
+    }
+
+    group.finish();
+}
+
+fn bench_copy_buffer_image(c: &mut Criterion) {
+    let mut group = c.benchmark_group("copy_buffer_image");
+    let buf_flags = Flags::MAP | Flags::COPY;
+
+    for (backend, dev) in common::devices() {
+        let Some(buf_class) = backend.classify(&dev, buf_flags, None) else {
+            continue;
+        };
+
+        let img_flags = backend.image_copy_flags();
+        for (fmt_name, fmt) in common::IMAGE_FORMATS {
+            let Some(img_class) = backend.classify(&dev, img_flags, Some(fmt)) else {
+                continue;
+            };
+
+            for (size_name, width, height) in common::IMAGE_SIZES {
+                let (copies, size) = plane_copies(fmt, width, height);
+                let buf = common::alloc(&dev, &buf_class, buf_flags, Extent::Buffer(size));
+                let img = common::alloc(&dev, &img_class, img_flags, Extent::Image(width, height));
+
+                group.throughput(Throughput::Bytes(size));
+
+                let id = BenchmarkId::new(backend.name(), format!("upload-{fmt_name}-{size_name}"));
+                group.bench_function(id, |b| {
+                    b.iter(|| {
+                        for &copy in &copies {
+                            img.copy_buffer_image(&buf, copy, None, true).unwrap();
+                        }
+                    })
+                });
+
+                let id =
+                    BenchmarkId::new(backend.name(), format!("readback-{fmt_name}-{size_name}"));
+                group.bench_function(id, |b| {
+                    b.iter(|| {
+                        for &copy in &copies {
+                            buf.copy_buffer_image(&img, copy, None, true).unwrap();
+                        }
+                    })
+                });
+            }
+        }
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_copy_buffer, bench_copy_buffer_image);
+criterion_main!(benches);
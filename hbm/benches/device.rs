@@ -0,0 +1,48 @@
+// Copyright 2025 Google LLC
+// SPDX-License-Identifier: MIT
+
+// Benchmarks device creation and classification.
+
+mod common;
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion};
+use hbm::Flags;
+use std::hint::black_box;
+
+fn bench_device_create(c: &mut Criterion) {
+    let mut group = c.benchmark_group("device_create");
+    // creating a Vulkan instance is slow
+    group.sample_size(10);
+
+    for &(backend, _) in &common::devices() {
+        group.bench_function(backend.name(), |b| b.iter(|| backend.build().unwrap()));
+    }
+
+    group.finish();
+}
+
+fn bench_classify(c: &mut Criterion) {
+    let mut group = c.benchmark_group("classify");
+
+    for (backend, dev) in common::devices() {
+        let flags = Flags::EXTERNAL;
+        let usage = [backend.usage()];
+
+        let desc = backend.description(flags, None);
+        group.bench_function(BenchmarkId::new(backend.name(), "buffer"), |b| {
+            b.iter(|| dev.classify(black_box(desc), &usage).unwrap())
+        });
+
+        for (name, fmt) in common::IMAGE_FORMATS {
+            let desc = backend.description(flags, Some(fmt));
+            group.bench_function(BenchmarkId::new(backend.name(), name), |b| {
+                b.iter(|| dev.classify(black_box(desc), &usage).unwrap())
+            });
+        }
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_device_create, bench_classify);
+criterion_main!(benches);
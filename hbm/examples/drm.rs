@@ -1,5 +1,5 @@
 use drm_fourcc::{DrmFourcc, DrmModifier};
-use hbm::{Flags, Format, MemoryType, Usage};
+use hbm::{Access, Flags, Format, MemoryType, Usage};
 use std::slice;
 
 #[cfg(feature = "drm")]
@@ -53,7 +53,7 @@ fn main() {
     .unwrap();
     bo2.bind_memory(MemoryType::MAPPABLE, Some(dmabuf)).unwrap();
 
-    bo.map().unwrap();
+    bo.map(Access::ReadWrite).unwrap();
     bo.flush();
     bo.invalidate();
     bo.unmap();
@@ -1,5 +1,5 @@
 use drm_fourcc::DrmFourcc;
-use hbm::{Flags, Format, MemoryType, Usage};
+use hbm::{Access, Flags, Format, MemoryType, Usage};
 use std::slice;
 use std::sync::Arc;
 
@@ -47,7 +47,7 @@ fn test_image(dev: Arc<hbm::Device>) {
         .bind_memory(MemoryType::MAPPABLE, Some(img_dmabuf))
         .unwrap();
 
-    img_bo.map().unwrap();
+    img_bo.map(Access::ReadWrite).unwrap();
     img_bo.flush();
     img_bo.invalidate();
     img_bo.unmap();
@@ -107,7 +107,7 @@ fn test_buffer(dev: Arc<hbm::Device>) {
         .bind_memory(MemoryType::MAPPABLE, Some(buf_dmabuf))
         .unwrap();
 
-    buf_bo.map().unwrap();
+    buf_bo.map(Access::ReadWrite).unwrap();
     buf_bo.flush();
     buf_bo.invalidate();
     buf_bo.unmap();
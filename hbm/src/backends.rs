@@ -16,7 +16,7 @@ use super::dma_buf;
 use super::formats;
 #[cfg(feature = "ash")]
 use super::sash;
-use super::types::{Error, Format, Mapping, Modifier, Result, Size};
+use super::types::{Access, Error, Format, Mapping, Modifier, ModifierSet, Result, Size};
 use std::os::fd::{BorrowedFd, OwnedFd};
 
 bitflags::bitflags! {
@@ -35,9 +35,22 @@ bitflags::bitflags! {
         const PROTECTED = 1 << 3;
         /// The BO is not compressed.  This affects the supported modifiers.
         const NO_COMPRESSION = 1 << 4;
+        /// The CPU writes the BO once, and the device reads it many times.  This requires `MAP`.
+        const CPU_UPLOAD = 1 << 5;
+        /// The CPU writes the BO frequently.  This requires `MAP`.
+        const CPU_STREAM = 1 << 6;
+        /// The CPU reads the BO back after the device writes it.  This requires `MAP`.
+        const CPU_READBACK = 1 << 7;
     }
 }
 
+impl Flags {
+    /// Flags that describe the intended CPU access pattern.
+    pub const CPU_ACCESS: Self = Self::CPU_UPLOAD
+        .union(Self::CPU_STREAM)
+        .union(Self::CPU_READBACK);
+}
+
 /// A BO Description.
 #[derive(Clone, Copy, Debug, Default, Eq, Hash, PartialEq)]
 #[non_exhaustive]
@@ -88,6 +101,10 @@ impl Description {
             return false;
         }
 
+        if self.flags.intersects(Flags::CPU_ACCESS) && !self.flags.contains(Flags::MAP) {
+            return false;
+        }
+
         if self.is_buffer() {
             self.modifier.is_invalid()
         } else {
@@ -119,7 +136,7 @@ pub enum Usage {
 /// An opaque BO class.
 ///
 /// A class is validated and is opaque to users.
-#[derive(Clone, Debug)]
+#[derive(Clone, Debug, Eq, Hash, PartialEq)]
 pub struct Class {
     // these are copied from user inputs
     pub(crate) flags: Flags,
@@ -129,12 +146,14 @@ pub struct Class {
     // These express backend limits.  When there are multiple backends, limits from all backends
     // are merged.
     pub(crate) max_extent: Extent,
-    pub(crate) modifiers: Vec<Modifier>,
+    pub(crate) modifiers: ModifierSet,
     pub(crate) constraint: Option<Constraint>,
     pub(crate) unknown_constraint: bool,
 
-    // this is set by Device
+    // these are set by Device
     pub(crate) backend_index: usize,
+    // when set, device copies are routed to the backend of this class, which imports the BO
+    pub(crate) copy_class: Option<Box<Class>>,
 }
 
 impl Class {
@@ -144,10 +163,11 @@ impl Class {
             format: desc.format,
             usage: Usage::Unused,
             max_extent: Extent::max_supported(&desc),
-            modifiers: Vec::new(),
+            modifiers: ModifierSet::new(),
             constraint: None,
             unknown_constraint: false,
             backend_index: 0,
+            copy_class: None,
         }
     }
 
@@ -161,7 +181,7 @@ impl Class {
         self
     }
 
-    pub(crate) fn modifiers(mut self, mods: Vec<Modifier>) -> Self {
+    pub(crate) fn modifiers(mut self, mods: ModifierSet) -> Self {
         self.modifiers = mods;
         self
     }
@@ -176,6 +196,11 @@ impl Class {
         self
     }
 
+    pub(crate) fn copy_class(mut self, class: Class) -> Self {
+        self.copy_class = Some(Box::new(class));
+        self
+    }
+
     pub(crate) fn backend_index(mut self, idx: usize) -> Self {
         self.backend_index = idx;
         self
@@ -206,7 +231,7 @@ impl Class {
 ///
 /// An extent is 1-dimentional or 2-dimentional depending on whether the BO is a buffer or an
 /// image.
-#[derive(Clone, Copy, Debug)]
+#[derive(Clone, Copy, Debug, Eq, Hash, PartialEq)]
 #[non_exhaustive]
 pub enum Extent {
     /// The size of the BO, when it is a buffer.
@@ -282,14 +307,14 @@ impl Extent {
 /// A BO constraint.
 ///
 /// A constraint specifies additional requirements when creating a BO.
-#[derive(Clone, Debug)]
+#[derive(Clone, Debug, Eq, Hash, PartialEq)]
 pub struct Constraint {
     pub(crate) offset_align: Size,
     pub(crate) stride_align: Size,
     pub(crate) size_align: Size,
 
     // no restriction when empty
-    pub(crate) modifiers: Vec<Modifier>,
+    pub(crate) modifiers: ModifierSet,
 }
 
 impl Default for Constraint {
@@ -334,8 +359,8 @@ impl Constraint {
     }
 
     /// Sets the allowed modifiers.
-    pub fn modifiers(mut self, mods: Vec<Modifier>) -> Self {
-        self.modifiers = mods;
+    pub fn modifiers(mut self, mods: impl IntoIterator<Item = Modifier>) -> Self {
+        self.modifiers = mods.into_iter().collect();
         self
     }
 
@@ -373,7 +398,7 @@ impl Constraint {
 /// A BO physical layout.
 ///
 /// A physical layout provides the necessary information for import and for CPU access.
-#[derive(Clone, Debug, Default, PartialEq)]
+#[derive(Clone, Debug, Default, Eq, Hash, PartialEq)]
 #[non_exhaustive]
 pub struct Layout {
     /// Size of a BO.
@@ -531,7 +556,7 @@ bitflags::bitflags! {
     /// A memory type.
     ///
     /// A memory type is a bitmask of memory properties.
-    #[derive(Clone, Copy, Debug, Default)]
+    #[derive(Clone, Copy, Debug, Default, Eq, Hash, PartialEq)]
     pub struct MemoryType: u32 {
         /// The memory is local to the device.
         const LOCAL = 1 << 0;
@@ -544,6 +569,58 @@ bitflags::bitflags! {
     }
 }
 
+impl MemoryType {
+    // ranks the memory type for the intended access pattern described by the flags, or returns
+    // None if the memory type is unsuitable
+    fn rank(&self, flags: Flags) -> Option<u32> {
+        let local = self.contains(MemoryType::LOCAL);
+        let mappable = self.contains(MemoryType::MAPPABLE);
+        let coherent = self.contains(MemoryType::COHERENT);
+        let cached = self.contains(MemoryType::CACHED);
+
+        if !flags.intersects(Flags::MAP | Flags::CPU_ACCESS) {
+            // leave mappable local memory, which can be scarce, to BOs that are mapped
+            return Some(u32::from(local) * 4 + u32::from(!mappable) * 2);
+        }
+
+        if !mappable {
+            return None;
+        }
+
+        // coherent memory needs no flush nor invalidation
+        let mut rank = u32::from(coherent);
+        if flags.contains(Flags::CPU_UPLOAD) {
+            // ReBAR or UMA, and write-combined
+            rank += u32::from(local) * 4 + u32::from(!cached) * 2;
+        }
+        if flags.contains(Flags::CPU_STREAM) {
+            rank += u32::from(coherent) * 4 + u32::from(!cached) * 2 + u32::from(local);
+        }
+        if flags.contains(Flags::CPU_READBACK) {
+            // CPU reads from uncached memory are much slower than anything else
+            rank += u32::from(cached) * 8 + u32::from(coherent) * 2;
+        }
+
+        Some(rank)
+    }
+}
+
+// Returns the memory type that best suits the intended access pattern described by the flags.
+// When multiple memory types rank the same, the first one is returned.
+pub(crate) fn best_memory_type(mts: &[MemoryType], flags: Flags) -> Option<MemoryType> {
+    let mut best: Option<(MemoryType, u32)> = None;
+    for mt in mts {
+        let Some(rank) = mt.rank(flags) else {
+            continue;
+        };
+        if best.map_or(true, |(_, best_rank)| rank > best_rank) {
+            best = Some((*mt, rank));
+        }
+    }
+
+    best.map(|(mt, _)| mt)
+}
+
 /// A buffer-buffer copy.
 ///
 /// This struct describes a copy between two buffers.
@@ -615,7 +692,23 @@ pub trait Backend: Send + Sync {
     }
 
     /// Frees a BO handle.
-    fn free(&self, _handle: &Handle) {}
+    ///
+    /// The backend takes the ownership of the handle, and may recycle it instead of destroying
+    /// it.
+    fn free(&self, _handle: Handle) {}
+
+    /// Frees a BO handle without recycling it.
+    ///
+    /// This is for imported handles whose dma-bufs are being destroyed, which can never be
+    /// imported again.
+    fn free_uncached(&self, handle: Handle) {
+        self.free(handle);
+    }
+
+    /// Frees the resources that the backend keeps for recycling.
+    ///
+    /// Handles in use are not affected.
+    fn trim(&self) {}
 
     /// Returns the physical layout of a BO handle.
     fn layout(&self, handle: &Handle) -> Layout {
@@ -642,9 +735,9 @@ pub trait Backend: Send + Sync {
         dma_buf::export_dma_buf(handle, name)
     }
 
-    /// Maps a BO handle for CPU access.
-    fn map(&self, handle: &Handle) -> Result<Mapping> {
-        dma_buf::map(handle)
+    /// Maps a range of a BO handle for CPU access of the specified access type.
+    fn map(&self, handle: &Handle, offset: Size, size: Size, access: Access) -> Result<Mapping> {
+        dma_buf::map(handle, offset, size, access)
     }
 
     /// Unmaps a BO handle.
@@ -652,36 +745,84 @@ pub trait Backend: Send + Sync {
         dma_buf::unmap(handle, mapping)
     }
 
-    /// Flushes the CPU cache for the BO mapping.
-    fn flush(&self, handle: &Handle) {
-        dma_buf::flush(handle);
+    /// Flushes the CPU cache for a range of the BO mapping.
+    ///
+    /// The range is within the BO mapping.
+    fn flush(&self, handle: &Handle, offset: Size, size: Size) {
+        dma_buf::flush(handle, offset, size);
     }
 
-    /// Invalidates the CPU cache for the BO mapping.
-    fn invalidate(&self, handle: &Handle) {
-        dma_buf::invalidate(handle);
+    /// Invalidates the CPU cache for a range of the BO mapping.
+    ///
+    /// The range is within the BO mapping.
+    fn invalidate(&self, handle: &Handle, offset: Size, size: Size) {
+        dma_buf::invalidate(handle, offset, size);
+    }
+
+    /// Begins CPU access to a BO handle.
+    ///
+    /// `range` is the range of the BO mapping that needs cache maintenance, if any.
+    fn begin_cpu_access(&self, handle: &Handle, access: Access, range: Option<(Size, Size)>) {
+        let _ = range;
+        dma_buf::begin_cpu_access(handle, access);
+    }
+
+    /// Ends CPU access to a BO handle.
+    ///
+    /// `range` is the range of the BO mapping that needs cache maintenance, if any.
+    fn end_cpu_access(&self, handle: &Handle, access: Access, range: Option<(Size, Size)>) {
+        let _ = range;
+        dma_buf::end_cpu_access(handle, access);
+    }
+
+    /// Returns true if the backend supports device copies.
+    ///
+    /// When false, copies between mappable BOs are done by the CPU.
+    fn supports_device_copy(&self) -> bool {
+        false
     }
 
     /// Copies between two BO handles that are both buffers.
+    ///
+    /// The default implementation copies with the CPU.
     fn copy_buffer(
         &self,
-        _dst: &Handle,
-        _src: &Handle,
-        _copy: CopyBuffer,
-        _sync_fd: Option<OwnedFd>,
+        dst: &Handle,
+        src: &Handle,
+        copy: CopyBuffer,
+        sync_fd: Option<OwnedFd>,
     ) -> Result<Option<OwnedFd>> {
-        Error::unsupported()
+        dma_buf::copy_buffer(dst, src, copy, sync_fd)
     }
 
     /// Copies between two BO handles where one is a buffer and one is an image.
+    ///
+    /// The default implementation copies with the CPU, and only supports linear images.
     fn copy_buffer_image(
         &self,
-        _dst: &Handle,
-        _src: &Handle,
-        _copy: CopyBufferImage,
-        _sync_fd: Option<OwnedFd>,
+        dst: &Handle,
+        src: &Handle,
+        copy: CopyBufferImage,
+        sync_fd: Option<OwnedFd>,
     ) -> Result<Option<OwnedFd>> {
-        Error::unsupported()
+        dma_buf::copy_buffer_image(dst, src, copy, sync_fd)
+    }
+
+    /// Copies between pairs of BO handles where one is a buffer and one is an image.
+    ///
+    /// Each element of `copies` is a `(dst, src, copy)` tuple.  The default implementation
+    /// performs the copies one by one, with each copy waiting for the previous one.
+    fn copy_buffer_image_batch(
+        &self,
+        copies: &[(&Handle, &Handle, CopyBufferImage)],
+        sync_fd: Option<OwnedFd>,
+    ) -> Result<Option<OwnedFd>> {
+        let mut sync_fd = sync_fd;
+        for (dst, src, copy) in copies {
+            sync_fd = self.copy_buffer_image(dst, src, *copy, sync_fd)?;
+        }
+
+        Ok(sync_fd)
     }
 }
 
@@ -709,6 +850,49 @@ mod tests {
         desc = desc.format(formats::R8);
         assert!(desc.is_valid());
         assert!(!desc.is_buffer());
+
+        // cpu access patterns require MAP
+        desc = Description::new().flags(Flags::COPY | Flags::CPU_READBACK);
+        assert!(!desc.is_valid());
+        desc = desc.flags(Flags::MAP | Flags::CPU_READBACK);
+        assert!(desc.is_valid());
+    }
+
+    #[test]
+    fn test_best_memory_type() {
+        let local = MemoryType::LOCAL;
+        let rebar = MemoryType::LOCAL | MemoryType::MAPPABLE | MemoryType::COHERENT;
+        let wc = MemoryType::MAPPABLE | MemoryType::COHERENT;
+        let cached = MemoryType::MAPPABLE | MemoryType::COHERENT | MemoryType::CACHED;
+        let mts = [local, rebar, wc, cached];
+
+        assert_eq!(best_memory_type(&mts, Flags::COPY), Some(local));
+        assert_eq!(best_memory_type(&mts, Flags::MAP), Some(rebar));
+        assert_eq!(
+            best_memory_type(&mts, Flags::MAP | Flags::CPU_UPLOAD),
+            Some(rebar)
+        );
+        assert_eq!(
+            best_memory_type(&mts, Flags::MAP | Flags::CPU_STREAM),
+            Some(rebar)
+        );
+        assert_eq!(
+            best_memory_type(&mts, Flags::MAP | Flags::CPU_READBACK),
+            Some(cached)
+        );
+
+        // discrete gpus without rebar
+        let mts = [local, wc, cached];
+        assert_eq!(
+            best_memory_type(&mts, Flags::MAP | Flags::CPU_UPLOAD),
+            Some(wc)
+        );
+        assert_eq!(
+            best_memory_type(&mts, Flags::MAP | Flags::CPU_STREAM),
+            Some(wc)
+        );
+
+        assert_eq!(best_memory_type(&[local], Flags::MAP), None);
     }
 
     #[test]
@@ -840,7 +1024,7 @@ mod tests {
             .modifier(formats::MOD_LINEAR);
         let img_class = Class::new(img_desc)
             .max_extent(Extent::Image(width, height))
-            .modifiers(vec![formats::MOD_LINEAR]);
+            .modifiers([formats::MOD_LINEAR].into_iter().collect());
         let mut img_layout = Layout::new()
             .size((width * height) as Size)
             .modifier(formats::MOD_LINEAR)
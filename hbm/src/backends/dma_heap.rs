@@ -3,17 +3,153 @@
 
 //! A backend for dma-heaps.
 //!
-//! This module provides a backend for dma-heaps.
+//! This module provides a backend for dma-heaps.  The backend can optionally keep pools of
+//! pre-allocated dma-bufs for hot sizes.  The kernel zeroes pages on allocation, which can take
+//! milliseconds for large dma-bufs.  A background thread refills the pools such that allocation
+//! bursts take dma-bufs that are already zeroed.
 
 use super::{Handle, MemoryType};
 use crate::dma_buf;
-use crate::types::{Error, Result};
+use crate::types::{Error, Result, Size};
 use crate::utils;
 use std::os::fd::OwnedFd;
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+use std::time::Duration;
+
+// how long the refill thread waits after a failed allocation
+const POOL_RETRY_INTERVAL: Duration = Duration::from_secs(1);
+
+type AllocFn = dyn Fn(Size) -> Result<OwnedFd> + Send + Sync;
+
+struct PoolEntry {
+    size: Size,
+    count: usize,
+    bufs: Vec<OwnedFd>,
+}
+
+#[derive(Default)]
+struct PoolState {
+    entries: Vec<PoolEntry>,
+    shutdown: bool,
+}
+
+impl PoolState {
+    fn needs_refill(&self) -> Option<Size> {
+        self.entries
+            .iter()
+            .find(|entry| entry.bufs.len() < entry.count)
+            .map(|entry| entry.size)
+    }
+}
+
+// Pools of pre-allocated dma-bufs, keyed by sizes.
+struct Pool {
+    alloc: Box<AllocFn>,
+    state: Mutex<PoolState>,
+    refill: Condvar,
+}
+
+impl Pool {
+    fn new(sizes: &[(Size, usize)], alloc: Box<AllocFn>) -> Self {
+        let entries = sizes
+            .iter()
+            .map(|&(size, count)| PoolEntry {
+                size,
+                count,
+                bufs: Vec::with_capacity(count),
+            })
+            .collect();
+
+        Self {
+            alloc,
+            state: Mutex::new(PoolState {
+                entries,
+                shutdown: false,
+            }),
+            refill: Condvar::new(),
+        }
+    }
+
+    // Takes a pre-allocated dma-buf of the size, if any.
+    fn take(&self, size: Size) -> Option<OwnedFd> {
+        let mut state = self.state.lock().unwrap();
+        let entry = state.entries.iter_mut().find(|entry| entry.size == size)?;
+        let buf = entry.bufs.pop();
+        drop(state);
+
+        // refill even when the pool is empty, which means the pool is too small for the burst
+        self.refill.notify_one();
+
+        buf
+    }
+
+    fn alloc(&self, size: Size) -> Result<OwnedFd> {
+        match self.take(size) {
+            Some(buf) => Ok(buf),
+            None => (self.alloc)(size),
+        }
+    }
+
+    // Refills the pools until shutdown.
+    fn refill_thread(&self) {
+        let mut state = self.state.lock().unwrap();
+        loop {
+            if state.shutdown {
+                break;
+            }
+
+            let Some(size) = state.needs_refill() else {
+                state = self.refill.wait(state).unwrap();
+                continue;
+            };
+
+            // allocate without the lock held
+            drop(state);
+            let res = (self.alloc)(size);
+            state = self.state.lock().unwrap();
+
+            match res {
+                Ok(buf) => {
+                    if let Some(entry) = state.entries.iter_mut().find(|entry| entry.size == size) {
+                        entry.bufs.push(buf);
+                    }
+                }
+                Err(err) => {
+                    log::debug!("failed to refill dma-heap pool: {err}");
+                    state = self
+                        .refill
+                        .wait_timeout(state, POOL_RETRY_INTERVAL)
+                        .unwrap()
+                        .0;
+                }
+            }
+        }
+    }
+
+    fn shutdown(&self) {
+        self.state.lock().unwrap().shutdown = true;
+        self.refill.notify_one();
+    }
+}
 
 /// A dma-heap backend.
 pub struct Backend {
-    fd: OwnedFd,
+    // this is None when the backend can only import dma-bufs
+    fd: Option<Arc<OwnedFd>>,
+    pool: Option<Arc<Pool>>,
+    pool_thread: Option<thread::JoinHandle<()>>,
+}
+
+impl Drop for Backend {
+    fn drop(&mut self) {
+        if let Some(pool) = &self.pool {
+            pool.shutdown();
+        }
+        if let Some(pool_thread) = self.pool_thread.take() {
+            let _ = pool_thread.join();
+        }
+    }
 }
 
 impl super::Backend for Backend {
@@ -23,7 +159,11 @@ impl super::Backend for Backend {
         mt: MemoryType,
         dmabuf: Option<OwnedFd>,
     ) -> Result<()> {
-        let alloc = |size| utils::dma_heap_alloc(&self.fd, size);
+        let alloc = |size| match (&self.pool, &self.fd) {
+            (Some(pool), _) => pool.alloc(size),
+            (None, Some(fd)) => utils::dma_heap_alloc(fd.as_ref(), size),
+            (None, None) => Error::unsupported(),
+        };
         dma_buf::bind_memory(handle, mt, dmabuf, alloc)
     }
 }
@@ -33,6 +173,7 @@ impl super::Backend for Backend {
 pub struct Builder {
     heap_name: Option<String>,
     heap_fd: Option<OwnedFd>,
+    pool_sizes: Vec<(Size, usize)>,
 }
 
 impl Builder {
@@ -53,24 +194,112 @@ impl Builder {
         self
     }
 
+    /// Adds a pool of pre-allocated dma-bufs.
+    ///
+    /// Allocations of exactly `size` bytes take dma-bufs from the pool, and a background thread
+    /// refills the pool to `count` dma-bufs.  The pooled dma-bufs stay allocated for the
+    /// lifetime of the backend.
+    pub fn pool(mut self, size: Size, count: usize) -> Self {
+        self.pool_sizes.push((size, count));
+        self
+    }
+
     /// Builds a dma-heap backend.
     ///
-    /// One and only one of the heap name or the heap fd must be set.
+    /// At most one of the heap name or the heap fd can be set.  If neither is set, the backend
+    /// can only import dma-bufs.  This is useful for processes that have no access to dma-heaps.
+    /// Pools require a heap.
     pub fn build(self) -> Result<Backend> {
         if self.heap_name.is_some() && self.heap_fd.is_some() {
             return Error::user();
         }
 
-        if !utils::dma_heap_exists() {
-            return Error::unsupported();
+        let has_heap = self.heap_name.is_some() || self.heap_fd.is_some();
+        let pool_sizes: Vec<(Size, usize)> = self
+            .pool_sizes
+            .into_iter()
+            .filter(|&(_, count)| count > 0)
+            .collect();
+        if pool_sizes.iter().any(|&(size, _)| size == 0) || (!has_heap && !pool_sizes.is_empty()) {
+            return Error::user();
         }
 
         let heap_fd = if let Some(heap_name) = self.heap_name {
-            utils::dma_heap_open(&heap_name)?
+            if !utils::dma_heap_exists() {
+                return Error::unsupported();
+            }
+
+            Some(utils::dma_heap_open(&heap_name)?)
         } else {
-            self.heap_fd.unwrap()
+            self.heap_fd
+        };
+
+        let heap_fd = heap_fd.map(Arc::new);
+        let (pool, pool_thread) = match &heap_fd {
+            Some(heap_fd) if !pool_sizes.is_empty() => {
+                let heap_fd = heap_fd.clone();
+                let alloc = Box::new(move |size| utils::dma_heap_alloc(heap_fd.as_ref(), size));
+                let pool = Arc::new(Pool::new(&pool_sizes, alloc));
+
+                let thread_pool = pool.clone();
+                let pool_thread = thread::Builder::new()
+                    .name(String::from("hbm-dma-heap"))
+                    .spawn(move || thread_pool.refill_thread())?;
+
+                (Some(pool), Some(pool_thread))
+            }
+            _ => (None, None),
+        };
+
+        let backend = Backend {
+            fd: heap_fd,
+            pool,
+            pool_thread,
         };
 
-        Ok(Backend { fd: heap_fd })
+        Ok(backend)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+
+    #[test]
+    fn test_pool() {
+        let alloc_count = Arc::new(AtomicUsize::new(0));
+        let counter = alloc_count.clone();
+        let alloc = Box::new(move |size| {
+            counter.fetch_add(1, Ordering::SeqCst);
+            utils::memfd_create("test", size)
+        });
+
+        let pool = Arc::new(Pool::new(&[(4096, 2)], alloc));
+        let thread_pool = pool.clone();
+        let pool_thread = thread::spawn(move || thread_pool.refill_thread());
+
+        let wait_full = || {
+            while pool.state.lock().unwrap().needs_refill().is_some() {
+                thread::yield_now();
+            }
+        };
+
+        wait_full();
+        assert_eq!(alloc_count.load(Ordering::SeqCst), 2);
+
+        // pooled allocations are refilled in the background
+        assert!(pool.take(4096).is_some());
+        assert!(pool.alloc(4096).is_ok());
+        wait_full();
+        assert_eq!(alloc_count.load(Ordering::SeqCst), 4);
+
+        // other sizes bypass the pool
+        assert!(pool.take(8192).is_none());
+        assert!(pool.alloc(8192).is_ok());
+        assert_eq!(alloc_count.load(Ordering::SeqCst), 5);
+
+        pool.shutdown();
+        pool_thread.join().unwrap();
     }
 }
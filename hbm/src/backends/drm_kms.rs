@@ -6,16 +6,18 @@
 //! This module provides a backend for DRM KMS.
 
 use super::{Class, Constraint, Description, Extent, Handle, Layout, MemoryType};
+use crate::cache;
 use crate::dma_buf;
 use crate::formats;
-use crate::types::{Error, Format, Modifier, Result, Size};
+use crate::types::{Error, Format, Modifier, ModifierSet, Result, Size};
 use crate::utils;
 use drm::buffer::{Buffer as DrmBuffer, DrmFourcc};
 use drm::control::{plane, Device as DrmControlDevice};
 use drm::Device as DrmDevice;
 use std::collections::HashMap;
+use std::fs;
 use std::ops::{Bound, RangeBounds};
-use std::os::fd::{AsFd, BorrowedFd, OwnedFd};
+use std::os::fd::{AsFd, AsRawFd, BorrowedFd, OwnedFd};
 use std::os::unix::fs::MetadataExt;
 use std::path::{Path, PathBuf};
 
@@ -86,7 +88,7 @@ pub struct Backend {
 }
 
 impl Backend {
-    fn new(fd: OwnedFd, alloc_only: bool) -> Result<Self> {
+    fn new(fd: OwnedFd, alloc_only: bool, cache_dir: Option<&Path>) -> Result<Self> {
         let mut backend = Backend {
             device: Device(fd),
             alloc_only,
@@ -97,13 +99,20 @@ impl Backend {
         };
 
         if !backend.alloc_only {
-            backend.init()?;
+            backend.init(cache_dir)?;
         }
 
         Ok(backend)
     }
 
-    fn init(&mut self) -> Result<()> {
+    fn init(&mut self, cache_dir: Option<&Path>) -> Result<()> {
+        let cache_id = cache_dir.and_then(|_| self.get_cache_id());
+        if let (Some(cache_dir), Some((name, key))) = (cache_dir, &cache_id) {
+            if self.load_cache(cache_dir, name, key) {
+                return Ok(());
+            }
+        }
+
         self.device
             .set_client_capability(drm::ClientCapability::UniversalPlanes, true)?;
 
@@ -114,9 +123,94 @@ impl Backend {
             self.init_plane(plane)?;
         }
 
+        if let (Some(cache_dir), Some((name, key))) = (cache_dir, &cache_id) {
+            self.store_cache(cache_dir, name, key);
+        }
+
         Ok(())
     }
 
+    // Plane capabilities do not change until the kernel driver is reloaded.  Caches are keyed by
+    // the device id and the boot id to be safe.
+    fn get_cache_id(&self) -> Option<(String, String)> {
+        let fd_path = format!("/proc/self/fd/{}", self.device.as_fd().as_raw_fd());
+        let rdev = fs::metadata(fd_path).ok()?.rdev();
+        let boot_id = fs::read_to_string("/proc/sys/kernel/random/boot_id").ok()?;
+
+        let name = format!("drm-kms-{:x}", rdev);
+        let key = format!("{} {}", rdev, boot_id.trim());
+
+        Some((name, key))
+    }
+
+    // each cache entry is "size <max width> <max height>" or "<plane type> <format> <modifiers>"
+    fn load_cache(&mut self, cache_dir: &Path, name: &str, key: &str) -> bool {
+        let Some(entries) = cache::load(cache_dir, name, key) else {
+            return false;
+        };
+
+        let parse_u32 = |val: &str| val.parse::<u32>().ok();
+        let parse_u64 = |val: &str| val.parse::<u64>().ok();
+
+        let mut max_size = None;
+        let mut primary_formats = FormatTable::new();
+        let mut cursor_formats = FormatTable::new();
+        for entry in entries {
+            let mut vals = entry.split_whitespace();
+            let fmts = match vals.next() {
+                Some("size") => {
+                    let width = vals.next().and_then(parse_u32);
+                    let height = vals.next().and_then(parse_u32);
+                    max_size = width.zip(height);
+                    continue;
+                }
+                Some("primary") => &mut primary_formats,
+                Some("cursor") => &mut cursor_formats,
+                _ => return false,
+            };
+
+            let Some(fmt) = vals.next().and_then(parse_u32) else {
+                return false;
+            };
+            let Some(mods) = vals
+                .map(|val| parse_u64(val).map(Modifier))
+                .collect::<Option<Vec<Modifier>>>()
+            else {
+                return false;
+            };
+            fmts.insert(Format(fmt), mods);
+        }
+
+        let Some((max_width, max_height)) = max_size else {
+            return false;
+        };
+
+        self.max_width = max_width;
+        self.max_height = max_height;
+        self.primary_formats = primary_formats;
+        self.cursor_formats = cursor_formats;
+
+        true
+    }
+
+    fn store_cache(&self, cache_dir: &Path, name: &str, key: &str) {
+        let mut entries = vec![format!("size {} {}", self.max_width, self.max_height)];
+        for (ty, fmts) in [
+            ("primary", &self.primary_formats),
+            ("cursor", &self.cursor_formats),
+        ] {
+            for (fmt, mods) in fmts {
+                let mut entry = format!("{} {}", ty, fmt.0);
+                for modifier in mods {
+                    entry += &format!(" {}", modifier.0);
+                }
+                entries.push(entry);
+            }
+        }
+
+        cache::store(cache_dir, name, key, &entries);
+    }
+
     fn init_max_size(&mut self) -> Result<()> {
         let get_val = |b: Bound<&u32>| match b {
             Bound::Included(&v) => v,
@@ -223,7 +317,7 @@ impl Backend {
         usage: Usage,
         fmt: Format,
         modifier: Modifier,
-    ) -> Result<Vec<Modifier>> {
+    ) -> Result<ModifierSet> {
         let fmts = if usage.contains(Usage::CURSOR) {
             &self.cursor_formats
         } else {
@@ -233,13 +327,13 @@ impl Backend {
         let mods = fmts.get(&fmt).ok_or(Error::Unsupported)?;
 
         let mods = if modifier.is_invalid() {
-            mods.clone()
+            mods.iter().copied().collect()
         } else {
             if !mods.iter().any(|m| *m == modifier) {
                 return Error::unsupported();
             }
 
-            vec![modifier]
+            [modifier].into_iter().collect()
         };
 
         Ok(mods)
@@ -293,7 +387,7 @@ impl super::Backend for Backend {
             return Error::unsupported();
         }
 
-        let mut res = dma_buf::Resource::new(layout);
+        let mut res = dma_buf::Resource::new(class.format, layout);
         res.bind_memory(dmabuf);
         let handle = Handle::from(res);
 
@@ -318,6 +412,7 @@ pub struct Builder {
     node_fd: Option<OwnedFd>,
     device_id: Option<u64>,
     alloc_only: bool,
+    cache_dir: Option<PathBuf>,
 }
 
 impl Builder {
@@ -350,6 +445,15 @@ impl Builder {
         self
     }
 
+    /// Sets the directory of the capability cache.
+    ///
+    /// When set, queried DRM KMS properties are cached in the directory and are reused by later
+    /// builds during the same boot.
+    pub fn cache_dir(mut self, cache_dir: impl AsRef<Path>) -> Self {
+        self.cache_dir = Some(PathBuf::from(cache_dir.as_ref()));
+        self
+    }
+
     /// Builds a DRM KMS backend.
     ///
     /// One and only one of node path, node fd, or device id must be set.
@@ -372,6 +476,6 @@ impl Builder {
             open_drm_primary_device(self.node_path, self.device_id)?
         };
 
-        Backend::new(node_fd, self.alloc_only)
+        Backend::new(node_fd, self.alloc_only, self.cache_dir.as_deref())
     }
 }
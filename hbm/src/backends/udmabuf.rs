@@ -3,17 +3,90 @@
 
 //! A backend for udmabuf.
 //!
-//! This module provides a backend for udmabuf.
+//! This module provides a backend for udmabuf.  By default, each BO is a udmabuf of its own
+//! memfd.  The backend can optionally back large BOs with hugetlb memfds, and carve small BOs out
+//! of shared slabs.
 
 use super::{Handle, MemoryType};
 use crate::dma_buf;
-use crate::types::{Error, Result};
+use crate::types::{Error, Result, Size};
 use crate::utils;
 use std::os::fd::OwnedFd;
+use std::sync::Mutex;
+
+// the size of the hugetlb pages
+const HUGETLB_PAGE_SIZE: Size = 2 * 1024 * 1024;
+
+// BOs up to this fraction of the slab size are carved out of slabs
+const SLAB_MAX_FRACTION: Size = 4;
+
+// A memfd that udmabufs are carved out of.  It is freed when the backend moves on to the next
+// slab and all udmabufs of the slab are freed.
+struct Slab {
+    memfd: OwnedFd,
+    offset: Size,
+}
 
 /// A udmabuf backend.
 pub struct Backend {
     fd: OwnedFd,
+    hugetlb: bool,
+    slab_size: Size,
+    slab: Mutex<Option<Slab>>,
+}
+
+impl Backend {
+    fn alloc_memfd(&self, size: Size) -> Result<OwnedFd> {
+        let memfd = utils::memfd_create("udmabuf", size)?;
+        utils::udmabuf_alloc(&self.fd, memfd, 0, size)
+    }
+
+    fn alloc_hugetlb(&self, size: Size) -> Result<OwnedFd> {
+        // the tail of the last hugetlb page is wasted
+        let memfd_size = size.next_multiple_of(HUGETLB_PAGE_SIZE);
+        let memfd = utils::memfd_create_hugetlb("udmabuf", memfd_size)?;
+        utils::udmabuf_alloc(&self.fd, memfd, 0, size)
+    }
+
+    fn alloc_slab(&self, size: Size) -> Result<OwnedFd> {
+        let mut slab = self.slab.lock().unwrap();
+
+        let slab = match &mut *slab {
+            Some(slab) if slab.offset + size <= self.slab_size => slab,
+            _ => {
+                let memfd = utils::memfd_create("udmabuf-slab", self.slab_size)?;
+                slab.insert(Slab { memfd, offset: 0 })
+            }
+        };
+
+        let dmabuf = utils::udmabuf_alloc(&self.fd, &slab.memfd, slab.offset, size)?;
+        slab.offset += size;
+
+        Ok(dmabuf)
+    }
+
+    fn alloc(&self, size: Size) -> Result<OwnedFd> {
+        if self.slab_size == 0 && !self.hugetlb {
+            return self.alloc_memfd(size);
+        }
+
+        // udmabuf offsets and sizes must be page-aligned
+        let size = size.next_multiple_of(utils::page_size());
+
+        if size <= self.slab_size / SLAB_MAX_FRACTION {
+            return self.alloc_slab(size);
+        }
+
+        if self.hugetlb && size >= HUGETLB_PAGE_SIZE {
+            match self.alloc_hugetlb(size) {
+                Ok(dmabuf) => return Ok(dmabuf),
+                // hugetlb pages are reserved by the admin and can run out
+                Err(err) => log::debug!("failed to allocate from hugetlb: {err}"),
+            }
+        }
+
+        self.alloc_memfd(size)
+    }
 }
 
 impl super::Backend for Backend {
@@ -23,17 +96,16 @@ impl super::Backend for Backend {
         mt: MemoryType,
         dmabuf: Option<OwnedFd>,
     ) -> Result<()> {
-        let alloc = |size| {
-            let memfd = utils::memfd_create("udmabuf", size)?;
-            utils::udmabuf_alloc(&self.fd, memfd, size)
-        };
-        dma_buf::bind_memory(handle, mt, dmabuf, alloc)
+        dma_buf::bind_memory(handle, mt, dmabuf, |size| self.alloc(size))
     }
 }
 
 /// A udmabuf backend builder.
 #[derive(Default)]
-pub struct Builder;
+pub struct Builder {
+    hugetlb: bool,
+    slab_size: Size,
+}
 
 impl Builder {
     /// Creates a udmabuf backend builder.
@@ -41,13 +113,44 @@ impl Builder {
         Default::default()
     }
 
+    /// Backs BOs of at least 2MB with hugetlb memfds.
+    ///
+    /// This reduces TLB pressure and page table setup for large BOs, at the cost of rounding up
+    /// their memory to 2MB pages.  BOs fall back to regular memfds when no hugetlb page is
+    /// available.
+    pub fn hugetlb(mut self, hugetlb: bool) -> Self {
+        self.hugetlb = hugetlb;
+        self
+    }
+
+    /// Carves small BOs out of shared memfds of `slab_size` bytes.
+    ///
+    /// BOs of at most a quarter of the slab size share memfds to avoid creating a memfd per BO.
+    /// The memory of a slab is freed only after all BOs of the slab are freed.  A slab size of
+    /// zero disables slabs.
+    pub fn slab_size(mut self, slab_size: Size) -> Self {
+        self.slab_size = slab_size;
+        self
+    }
+
     /// Builds a udmabuf backend.
     pub fn build(self) -> Result<Backend> {
+        if self.slab_size % utils::page_size() != 0 {
+            return Error::user();
+        }
+
         if !utils::udmabuf_exists() {
             return Error::unsupported();
         }
 
         let fd = utils::udmabuf_open()?;
-        Ok(Backend { fd })
+        let backend = Backend {
+            fd,
+            hugetlb: self.hugetlb,
+            slab_size: self.slab_size,
+            slab: Mutex::new(None),
+        };
+
+        Ok(backend)
     }
 }
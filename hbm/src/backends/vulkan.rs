@@ -9,14 +9,17 @@ use super::{
     Class, Constraint, CopyBuffer, CopyBufferImage, Description, Extent, Flags, Handle,
     HandlePayload, Layout, MemoryType,
 };
+use crate::bo_cache;
 use crate::formats;
 use crate::sash;
-use crate::types::{Access, Error, Format, Mapping, Modifier, Result};
+use crate::types::{Access, Error, Format, Mapping, Modifier, Result, Size};
 use crate::utils;
 use ash::vk;
-use std::os::fd::{BorrowedFd, OwnedFd};
-use std::sync::Arc;
-use std::{num, ptr};
+use std::collections::HashMap;
+use std::os::fd::{AsFd, BorrowedFd, OwnedFd};
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, Mutex};
+use std::{mem, num, ptr};
 
 bitflags::bitflags! {
     /// A Vulkan backend usage.
@@ -193,10 +196,21 @@ fn best_mt_index(
     Ok(mt_idx)
 }
 
-fn get_memory(handle: &Handle) -> (&sash::Memory, vk::DeviceSize) {
+fn get_memory(handle: &Handle) -> &sash::Memory {
     match &handle.payload {
-        HandlePayload::Buffer(buf) => (buf.memory(), buf.size()),
-        HandlePayload::Image(img) => (img.memory(), img.size()),
+        HandlePayload::Buffer(buf) => buf.memory(),
+        HandlePayload::Image(img) => img.memory(),
+        _ => unreachable!(),
+    }
+}
+
+fn get_memory_types(
+    handle: &Handle,
+    required_flags: vk::MemoryPropertyFlags,
+) -> Vec<(u32, vk::MemoryPropertyFlags)> {
+    match &handle.payload {
+        HandlePayload::Buffer(buf) => buf.memory_types(required_flags),
+        HandlePayload::Image(img) => img.memory_types(required_flags),
         _ => unreachable!(),
     }
 }
@@ -215,22 +229,128 @@ fn get_image(handle: &Handle) -> &sash::Image {
     }
 }
 
+fn payload_id(payload: &HandlePayload) -> (vk::ObjectType, u64) {
+    match payload {
+        HandlePayload::Buffer(buf) => (vk::ObjectType::BUFFER, vk::Handle::as_raw(buf.handle())),
+        HandlePayload::Image(img) => (vk::ObjectType::IMAGE, vk::Handle::as_raw(img.handle())),
+        _ => unreachable!(),
+    }
+}
+
+// the max total size of the dma-bufs that idle imports keep alive
+const IMPORT_CACHE_BUDGET: Size = 128 * 1024 * 1024;
+
+// Imported payloads are interchangeable only when they import the same dma-buf with the same
+// parameters.  A dma-buf is identified by its inode, which cannot be reused while a cached
+// memory keeps the dma-buf alive.
+#[derive(Clone, Eq, Hash, PartialEq)]
+struct ImportKey {
+    file_id: (u64, u64),
+    flags: Flags,
+    format: Format,
+    usage: super::Usage,
+    extent: Extent,
+    layout: Layout,
+}
+
+#[derive(Clone)]
+struct LiveImport {
+    key: ImportKey,
+    // this is None until the memory is bound
+    mt_idx: Option<u32>,
+}
+
+struct IdleImport {
+    mt_idx: u32,
+    payload: HandlePayload,
+}
+
+// A cache of imported dma-bufs.
+//
+// Clients with buffer queues wrap the same few dma-bufs again and again.  Instead of destroying
+// the payloads of freed imports, we keep them bound and hand them back on matching imports.  This
+// skips object creation, memory import, and `get_dma_buf_mt_mask`.
+//
+// Note that an idle import keeps its dma-buf alive.  The total size of the dma-bufs is capped by
+// IMPORT_CACHE_BUDGET, and `trim` frees all idle imports.
+struct ImportCache {
+    // imports that are in use, keyed by payload ids
+    live: HashMap<(vk::ObjectType, u64), LiveImport>,
+    idle: bo_cache::Pool<ImportKey, IdleImport>,
+}
+
+impl Default for ImportCache {
+    fn default() -> Self {
+        Self {
+            live: HashMap::new(),
+            idle: bo_cache::Pool::new(IMPORT_CACHE_BUDGET),
+        }
+    }
+}
+
 /// A Vulkan backend.
 pub struct Backend {
     device: Arc<sash::Device>,
     copy_queue: sash::CopyQueue,
+    import_cache: Mutex<ImportCache>,
 }
 
 impl Backend {
-    fn new(device_index: Option<usize>, device_id: Option<u64>, debug: bool) -> Result<Self> {
-        let device = sash::Device::build("hbm", device_index, device_id, debug)?;
+    fn new(
+        device_index: Option<usize>,
+        device_id: Option<u64>,
+        debug: bool,
+        cache_dir: Option<&Path>,
+    ) -> Result<Self> {
+        let device = sash::Device::build("hbm", device_index, device_id, debug, cache_dir)?;
         let copy_queue = sash::CopyQueue::new(device.clone());
-        let backend = Self { device, copy_queue };
+        let backend = Self {
+            device,
+            copy_queue,
+            import_cache: Mutex::new(ImportCache::default()),
+        };
 
         log::info!("vulkan backend initialized");
 
         Ok(backend)
     }
+
+    fn create_payload(
+        &self,
+        flags: Flags,
+        fmt: Format,
+        usage: super::Usage,
+        extent: Extent,
+        layout: Layout,
+        dmabuf: Option<BorrowedFd>,
+    ) -> Result<HandlePayload> {
+        let payload = if fmt.is_invalid() {
+            let buf_info = get_buffer_info(flags, usage)?;
+            let buf = sash::Buffer::with_layout(
+                self.device.clone(),
+                buf_info,
+                extent.size(),
+                layout,
+                dmabuf,
+            )?;
+
+            HandlePayload::Buffer(buf)
+        } else {
+            let img_info = get_image_info(flags, fmt, usage)?;
+            let img = sash::Image::with_layout(
+                self.device.clone(),
+                img_info,
+                extent.width(),
+                extent.height(),
+                layout,
+                dmabuf,
+            )?;
+
+            HandlePayload::Image(img)
+        };
+
+        Ok(payload)
+    }
 }
 
 impl super::Backend for Backend {
@@ -299,32 +419,79 @@ impl super::Backend for Backend {
         layout: Layout,
         dmabuf: Option<BorrowedFd>,
     ) -> Result<Handle> {
-        let handle = if class.is_buffer() {
-            let buf_info = get_buffer_info(class.flags, class.usage)?;
-            let buf = sash::Buffer::with_layout(
-                self.device.clone(),
-                buf_info,
-                extent.size(),
-                layout,
-                dmabuf,
-            )?;
+        let Some(dmabuf) = dmabuf else {
+            let payload =
+                self.create_payload(class.flags, class.format, class.usage, extent, layout, None)?;
+            return Ok(Handle::new(payload));
+        };
 
-            Handle::new(HandlePayload::Buffer(buf))
-        } else {
-            let img_info = get_image_info(class.flags, class.format, class.usage)?;
-            let img = sash::Image::with_layout(
-                self.device.clone(),
-                img_info,
-                extent.width(),
-                extent.height(),
-                layout,
-                dmabuf,
-            )?;
+        let key = ImportKey {
+            file_id: utils::file_id(dmabuf)?,
+            flags: class.flags,
+            format: class.format,
+            usage: class.usage,
+            extent,
+            layout,
+        };
 
-            Handle::new(HandlePayload::Image(img))
+        let idle = self.import_cache.lock().unwrap().idle.take(&key);
+        let (payload, mt_idx) = match idle {
+            Some(idle) => (idle.payload, Some(idle.mt_idx)),
+            None => {
+                let payload = self.create_payload(
+                    key.flags,
+                    key.format,
+                    key.usage,
+                    key.extent,
+                    key.layout.clone(),
+                    Some(dmabuf),
+                )?;
+                (payload, None)
+            }
         };
 
-        Ok(handle)
+        let import = LiveImport { key, mt_idx };
+        self.import_cache
+            .lock()
+            .unwrap()
+            .live
+            .insert(payload_id(&payload), import);
+
+        Ok(Handle::new(payload))
+    }
+
+    fn free(&self, handle: Handle) {
+        let id = payload_id(&handle.payload);
+
+        let evicted = {
+            let mut cache = self.import_cache.lock().unwrap();
+            let Some(import) = cache.live.remove(&id) else {
+                return;
+            };
+            let Some(mt_idx) = import.mt_idx else {
+                return;
+            };
+
+            let size = import.key.layout.size;
+            let idle = IdleImport {
+                mt_idx,
+                payload: handle.payload,
+            };
+            cache.idle.put(&import.key, idle, size)
+        };
+
+        // destroy without the lock held
+        drop(evicted);
+    }
+
+    fn free_uncached(&self, handle: Handle) {
+        let id = payload_id(&handle.payload);
+        self.import_cache.lock().unwrap().live.remove(&id);
+    }
+
+    fn trim(&self) {
+        let evicted = self.import_cache.lock().unwrap().idle.trim(0);
+        drop(evicted);
     }
 
     fn layout(&self, handle: &Handle) -> Layout {
@@ -355,23 +522,65 @@ impl super::Backend for Backend {
         dmabuf: Option<OwnedFd>,
     ) -> Result<()> {
         let required_flags = mt_flags_from_mt(mt);
-        match handle.payload {
-            HandlePayload::Buffer(ref mut buf) => {
-                let mts = buf.memory_types(required_flags);
-                let mt_idx = best_mt_index(mts, required_flags)?;
-                buf.bind_memory(mt_idx, dmabuf)
+        let mut id = payload_id(&handle.payload);
+        let mut mt_idx = best_mt_index(get_memory_types(handle, required_flags), required_flags)?;
+
+        let is_import = dmabuf.is_some();
+        let import = if is_import {
+            self.import_cache.lock().unwrap().live.get(&id).cloned()
+        } else {
+            None
+        };
+
+        if let Some(LiveImport {
+            key,
+            mt_idx: Some(cached_mt_idx),
+        }) = import
+        {
+            // a cached import is bound already
+            if mt_idx == cached_mt_idx {
+                return Ok(());
             }
-            HandlePayload::Image(ref mut img) => {
-                let mts = img.memory_types(required_flags);
-                let mt_idx = best_mt_index(mts, required_flags)?;
-                img.bind_memory(mt_idx, dmabuf)
+
+            // it is bound to another memory type; replace it by a new payload
+            let payload = self.create_payload(
+                key.flags,
+                key.format,
+                key.usage,
+                key.extent,
+                key.layout.clone(),
+                dmabuf.as_ref().map(|fd| fd.as_fd()),
+            )?;
+            let old_payload = mem::replace(&mut handle.payload, payload);
+
+            {
+                let mut cache = self.import_cache.lock().unwrap();
+                cache.live.remove(&id);
+                id = payload_id(&handle.payload);
+                cache.live.insert(id, LiveImport { key, mt_idx: None });
             }
+            drop(old_payload);
+
+            mt_idx = best_mt_index(get_memory_types(handle, required_flags), required_flags)?;
+        }
+
+        let res = match handle.payload {
+            HandlePayload::Buffer(ref mut buf) => buf.bind_memory(mt_idx, dmabuf),
+            HandlePayload::Image(ref mut img) => img.bind_memory(mt_idx, dmabuf),
             _ => Error::unsupported(),
+        };
+
+        if res.is_ok() && is_import {
+            if let Some(import) = self.import_cache.lock().unwrap().live.get_mut(&id) {
+                import.mt_idx = Some(mt_idx);
+            }
         }
+
+        res
     }
 
     fn export_dma_buf(&self, handle: &Handle, name: Option<&str>) -> Result<OwnedFd> {
-        let (mem, _) = get_memory(handle);
+        let mem = get_memory(handle);
         let dmabuf = mem.export_dma_buf()?;
 
         if let Some(name) = name {
@@ -381,11 +590,12 @@ impl super::Backend for Backend {
         Ok(dmabuf)
     }
 
-    fn map(&self, handle: &Handle) -> Result<Mapping> {
-        let (mem, size) = get_memory(handle);
+    // vkMapMemory has no access type
+    fn map(&self, handle: &Handle, offset: Size, size: Size, _access: Access) -> Result<Mapping> {
+        let mem = get_memory(handle);
 
         let len = num::NonZeroUsize::try_from(usize::try_from(size)?)?;
-        let ptr = mem.map(0, size)?;
+        let ptr = mem.map(offset, size)?;
         let ptr = ptr::NonNull::new(ptr).unwrap();
         let mapping = Mapping { ptr, len };
 
@@ -393,18 +603,39 @@ impl super::Backend for Backend {
     }
 
     fn unmap(&self, handle: &Handle, _mapping: Mapping) {
-        let (mem, _) = get_memory(handle);
+        let mem = get_memory(handle);
         mem.unmap();
     }
 
-    fn flush(&self, handle: &Handle) {
-        let (mem, size) = get_memory(handle);
-        mem.flush(0, size);
+    fn flush(&self, handle: &Handle, offset: Size, size: Size) {
+        let mem = get_memory(handle);
+        mem.flush(offset, size);
     }
 
-    fn invalidate(&self, handle: &Handle) {
-        let (mem, size) = get_memory(handle);
-        mem.invalidate(0, size);
+    fn invalidate(&self, handle: &Handle, offset: Size, size: Size) {
+        let mem = get_memory(handle);
+        mem.invalidate(offset, size);
+    }
+
+    // there is no implicit synchronization and this only needs cache maintenance
+    fn begin_cpu_access(&self, handle: &Handle, access: Access, range: Option<(Size, Size)>) {
+        if let Some((offset, size)) = range {
+            if access.is_read() {
+                self.invalidate(handle, offset, size);
+            }
+        }
+    }
+
+    fn end_cpu_access(&self, handle: &Handle, access: Access, range: Option<(Size, Size)>) {
+        if let Some((offset, size)) = range {
+            if access.is_write() {
+                self.flush(handle, offset, size);
+            }
+        }
+    }
+
+    fn supports_device_copy(&self) -> bool {
+        true
     }
 
     fn copy_buffer(
@@ -414,10 +645,6 @@ impl super::Backend for Backend {
         copy: CopyBuffer,
         sync_fd: Option<OwnedFd>,
     ) -> Result<Option<OwnedFd>> {
-        if let Some(sync_fd) = sync_fd {
-            utils::poll(sync_fd, Access::Read)?;
-        }
-
         let dst = get_buffer(dst);
         let src = get_buffer(src);
         let region = vk::BufferCopy::default()
@@ -425,7 +652,7 @@ impl super::Backend for Backend {
             .dst_offset(copy.dst_offset)
             .size(copy.size);
 
-        self.copy_queue.copy_buffer(src, dst, region).and(Ok(None))
+        self.copy_queue.copy_buffer(src, dst, region, sync_fd)
     }
 
     fn copy_buffer_image(
@@ -435,26 +662,47 @@ impl super::Backend for Backend {
         copy: CopyBufferImage,
         sync_fd: Option<OwnedFd>,
     ) -> Result<Option<OwnedFd>> {
-        if let Some(sync_fd) = sync_fd {
-            utils::poll(sync_fd, Access::Read)?;
-        }
-
         if let HandlePayload::Buffer(_) = &dst.payload {
             let dst_buf = get_buffer(dst);
             let src_img = get_image(src);
             let region = src_img.get_copy_region(copy);
 
             self.copy_queue
-                .copy_image_to_buffer(src_img, dst_buf, region)
+                .copy_image_to_buffer(src_img, dst_buf, region, sync_fd)
         } else {
             let dst_img = get_image(dst);
             let src_buf = get_buffer(src);
             let region = dst_img.get_copy_region(copy);
 
             self.copy_queue
-                .copy_buffer_to_image(src_buf, dst_img, region)
+                .copy_buffer_to_image(src_buf, dst_img, region, sync_fd)
         }
-        .and(Ok(None))
+    }
+
+    fn copy_buffer_image_batch(
+        &self,
+        copies: &[(&Handle, &Handle, CopyBufferImage)],
+        sync_fd: Option<OwnedFd>,
+    ) -> Result<Option<OwnedFd>> {
+        let copies: Vec<sash::BufferImageCopy> = copies
+            .iter()
+            .map(|(dst, src, copy)| {
+                let (buffer, image, to_image) = if let HandlePayload::Buffer(_) = &dst.payload {
+                    (get_buffer(dst), get_image(src), false)
+                } else {
+                    (get_buffer(src), get_image(dst), true)
+                };
+
+                sash::BufferImageCopy {
+                    buffer,
+                    image,
+                    region: image.get_copy_region(*copy),
+                    to_image,
+                }
+            })
+            .collect();
+
+        self.copy_queue.copy_buffer_image_batch(&copies, sync_fd)
     }
 }
 
@@ -464,6 +712,7 @@ pub struct Builder {
     device_index: Option<usize>,
     device_id: Option<u64>,
     debug: bool,
+    cache_dir: Option<PathBuf>,
 }
 
 impl Builder {
@@ -490,6 +739,15 @@ impl Builder {
         self
     }
 
+    /// Sets the directory of the capability cache.
+    ///
+    /// When set, probed format properties are cached in the directory and are reused by later
+    /// builds until the driver changes.
+    pub fn cache_dir(mut self, cache_dir: impl AsRef<Path>) -> Self {
+        self.cache_dir = Some(PathBuf::from(cache_dir.as_ref()));
+        self
+    }
+
     /// Builds a Vulkan backend.
     pub fn build(mut self) -> Result<Backend> {
         match self.device_index.is_some() as i32 + self.device_id.is_some() as i32 {
@@ -502,6 +760,60 @@ impl Builder {
             }
         };
 
-        Backend::new(self.device_index, self.device_id, self.debug)
+        Backend::new(
+            self.device_index,
+            self.device_id,
+            self.debug,
+            self.cache_dir.as_deref(),
+        )
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::backends::Backend as _;
+
+    #[test]
+    fn test_free_uncached() {
+        // skip when there is no Vulkan device
+        let Ok(backend) = Builder::new().build() else {
+            return;
+        };
+
+        let desc = Description::new().flags(Flags::EXTERNAL | Flags::COPY);
+        let class = backend
+            .classify(desc, super::super::Usage::Vulkan(Usage::TRANSFER))
+            .unwrap();
+        let extent = Extent::Buffer(4096);
+
+        let mut bo = backend.with_constraint(&class, extent, None).unwrap();
+        backend
+            .bind_memory(&mut bo, MemoryType::empty(), None)
+            .unwrap();
+        let dmabuf = backend.export_dma_buf(&bo, None).unwrap();
+
+        let import = || {
+            let mut handle = backend
+                .with_layout(&class, extent, backend.layout(&bo), Some(dmabuf.as_fd()))
+                .unwrap();
+            let dmabuf = dmabuf.try_clone().unwrap();
+            backend
+                .bind_memory(&mut handle, MemoryType::empty(), Some(dmabuf))
+                .unwrap();
+            handle
+        };
+        let idle_count = || backend.import_cache.lock().unwrap().idle.trim(0).len();
+
+        // freed imports are recycled
+        backend.free(import());
+        assert_eq!(idle_count(), 1);
+
+        // imports freed with free_uncached are not
+        backend.free_uncached(import());
+        assert_eq!(idle_count(), 0);
+        assert!(backend.import_cache.lock().unwrap().live.is_empty());
+
+        backend.free(bo);
     }
 }
@@ -6,22 +6,175 @@
 //! This module defines `Bo`.
 
 use super::backends::{
-    Backend, Class, Constraint, CopyBuffer, CopyBufferImage, Extent, Flags, Handle, Layout,
+    self, Backend, Class, Constraint, CopyBuffer, CopyBufferImage, Extent, Flags, Handle, Layout,
     MemoryType,
 };
+use super::copy;
 use super::device::Device;
 use super::formats;
+use super::stats::{self, Counters, Operation};
 use super::types::{Access, Error, Format, Mapping, Result, Size};
 use super::utils;
-use std::os::fd::{BorrowedFd, OwnedFd};
-use std::sync::{Arc, Mutex};
+use std::mem::ManuallyDrop;
+use std::os::fd::{AsFd, BorrowedFd, OwnedFd};
+use std::sync::atomic::{AtomicPtr, AtomicU32, Ordering};
+use std::sync::{Arc, Mutex, MutexGuard, OnceLock};
+use std::{num, ptr};
+
+// copies no larger than this are done by the CPU when both BOs are mappable
+const CPU_COPY_THRESHOLD: Size = 64 * 1024;
+
+// the mapping of the range at offset
+struct MappedRange {
+    mapping: Mapping,
+    offset: Size,
+    access: Access,
+}
 
-struct BoState {
-    bound: bool,
-    mt: MemoryType,
+impl MappedRange {
+    fn contains(&self, offset: Size, size: Size, access: Access) -> bool {
+        let end = self.offset + self.mapping.len.get() as Size;
+        offset >= self.offset
+            && offset + size <= end
+            && (!access.is_read() || self.access.is_read())
+            && (!access.is_write() || self.access.is_write())
+    }
+
+    // this returns the range if it is within the mapping
+    fn range(&self, range: Option<(Size, Size)>) -> Option<(Size, Size)> {
+        let mapping_size = self.mapping.len.get() as Size;
+        let (offset, size) = range.unwrap_or((self.offset, mapping_size));
+        if size == 0
+            || offset < self.offset
+            || offset - self.offset > mapping_size
+            || size > mapping_size - (offset - self.offset)
+        {
+            return None;
+        }
+
+        Some((offset, size))
+    }
+}
+
+// the BO ranges of a CPU copy
+struct CpuCopyRanges {
+    dst: (Size, Size),
+    // this is ReadWrite when the copy does not write the entire dst range
+    dst_access: Access,
+    src: (Size, Size),
+}
+
+// the access type and the range of an ongoing CPU access
+type CpuAccess = (Access, Option<(Size, Size)>);
+
+// this returns true if a CPU access bracketed by the user already covers the access to the
+// range, such that the range needs no cache maintenance of its own
+fn cpu_access_covers(cpu_access: &CpuAccess, access: Access, range: (Size, Size)) -> bool {
+    let (bracket_access, bracket_range) = *cpu_access;
+    let range_covered = match bracket_range {
+        Some((offset, size)) => offset <= range.0 && range.0 + range.1 <= offset + size,
+        None => true,
+    };
+
+    range_covered
+        && (!access.is_read() || bracket_access.is_read())
+        && (!access.is_write() || bracket_access.is_write())
+}
 
-    mapping: Option<Mapping>,
-    map_count: u32,
+// A CPU copy between the mapped ranges of two BOs.
+//
+// This holds the CPU access locks of both BOs, such that the cache maintenance of the copy is
+// never interleaved with CPU accesses bracketed by the user.  A BO whose bracketed CPU access
+// covers its range is not synced, and the user's end_cpu_access makes the copy visible.
+struct CpuCopy<'a> {
+    dst: &'a Bo,
+    src: &'a Bo,
+    ranges: CpuCopyRanges,
+    mappings: (Mapping, Mapping),
+    // whether dst and src need cache maintenance
+    sync: (bool, bool),
+    _cpu_access: (
+        MutexGuard<'a, Option<CpuAccess>>,
+        MutexGuard<'a, Option<CpuAccess>>,
+    ),
+}
+
+impl<'a> CpuCopy<'a> {
+    // this locks and maps the ranges for a CPU copy, or returns None to fall back to a device
+    // copy
+    fn new(dst: &'a Bo, src: &'a Bo, ranges: CpuCopyRanges) -> Option<Self> {
+        // lock in address order to avoid deadlocks with copies in the opposite direction
+        let (dst_cpu_access, src_cpu_access) = if ptr::from_ref(dst) < ptr::from_ref(src) {
+            let dst_cpu_access = dst.cpu_access.lock().unwrap();
+            (dst_cpu_access, src.cpu_access.lock().unwrap())
+        } else {
+            let src_cpu_access = src.cpu_access.lock().unwrap();
+            (dst.cpu_access.lock().unwrap(), src_cpu_access)
+        };
+
+        let needs_sync = |cpu_access: &Option<CpuAccess>, access, range| match cpu_access {
+            Some(cpu_access) => cpu_access_covers(cpu_access, access, range).then_some(false),
+            None => Some(true),
+        };
+        let sync = (
+            needs_sync(&dst_cpu_access, ranges.dst_access, ranges.dst)?,
+            needs_sync(&src_cpu_access, Access::Read, ranges.src)?,
+        );
+
+        let (dst_range, src_range) = (ranges.dst, ranges.src);
+        let dst_mapping = dst
+            .map_range(dst_range.0, dst_range.1, ranges.dst_access)
+            .ok()?;
+        let Ok(src_mapping) = src.map_range(src_range.0, src_range.1, Access::Read) else {
+            dst.unmap();
+            return None;
+        };
+
+        Some(Self {
+            dst,
+            src,
+            ranges,
+            mappings: (dst_mapping, src_mapping),
+            sync,
+            _cpu_access: (dst_cpu_access, src_cpu_access),
+        })
+    }
+
+    // this waits for sync_fd and performs the copy
+    fn run<F>(self, sync_fd: Option<OwnedFd>, f: F) -> Result<()>
+    where
+        F: FnOnce(&Mapping, &Mapping),
+    {
+        if let Some(sync_fd) = sync_fd {
+            stats::wait(|| utils::poll(sync_fd, Access::Read))?;
+        }
+
+        let (dst, src, ranges) = (self.dst, self.src, &self.ranges);
+        if self.sync.1 {
+            src.sync_cpu_access(Access::Read, Some(ranges.src), true);
+        }
+        if self.sync.0 {
+            dst.sync_cpu_access(ranges.dst_access, Some(ranges.dst), true);
+        }
+
+        f(&self.mappings.0, &self.mappings.1);
+
+        if self.sync.0 {
+            dst.sync_cpu_access(ranges.dst_access, Some(ranges.dst), false);
+        }
+        if self.sync.1 {
+            src.sync_cpu_access(Access::Read, Some(ranges.src), false);
+        }
+
+        Ok(())
+    }
+}
+
+impl Drop for CpuCopy<'_> {
+    fn drop(&mut self) {
+        self.src.unmap();
+        self.dst.unmap();
+    }
 }
 
 /// A buffer object (BO).
@@ -29,14 +182,31 @@ struct BoState {
 /// A BO is an abstraction of a hardware buffer object.
 pub struct Bo {
     device: Arc<Device>,
-    handle: Handle,
+    // this is taken and freed by drop
+    handle: ManuallyDrop<Handle>,
 
     flags: Flags,
     format: Format,
     backend_index: usize,
     extent: Extent,
 
-    state: Mutex<BoState>,
+    // these are immutable after bind_memory
+    bound: bool,
+    mt: MemoryType,
+
+    // mapping points to a boxed MappedRange when map_count is non-zero.  map_count can go from
+    // non-zero to non-zero locklessly, but can only go from or to zero with map_lock held.
+    mapping: AtomicPtr<MappedRange>,
+    map_count: AtomicU32,
+    map_lock: Mutex<()>,
+
+    cpu_access: Mutex<Option<CpuAccess>>,
+
+    // when copy_class is set, device copies are routed to its backend, and copy_handle is the
+    // BO imported into the backend lazily
+    copy_class: Option<Box<Class>>,
+    copy_handle: OnceLock<Handle>,
+    import_lock: Mutex<()>,
 }
 
 fn merge_class_to_constraint(con: Option<Constraint>, class: &Class) -> Result<Option<Constraint>> {
@@ -50,11 +220,13 @@ fn merge_class_to_constraint(con: Option<Constraint>, class: &Class) -> Result<O
     }
 
     if !con.modifiers.is_empty() {
-        con.modifiers
-            .retain(|m1| class.modifiers.iter().any(|m2| m1 == m2));
-        if con.modifiers.is_empty() {
+        // keep the preference order of the class
+        let mut mods = class.modifiers.clone();
+        mods.intersect(&con.modifiers);
+        if mods.is_empty() {
             return Error::unsupported();
         }
+        con.modifiers = mods;
     }
 
     Ok(Some(con))
@@ -62,21 +234,22 @@ fn merge_class_to_constraint(con: Option<Constraint>, class: &Class) -> Result<O
 
 impl Bo {
     fn new(device: Arc<Device>, handle: Handle, class: &Class, extent: Extent) -> Self {
-        let state = BoState {
-            bound: false,
-            mt: MemoryType::empty(),
-            mapping: None,
-            map_count: 0,
-        };
-
         Self {
             device,
-            handle,
+            handle: ManuallyDrop::new(handle),
             flags: class.flags,
             format: class.format,
             backend_index: class.backend_index,
             extent,
-            state: Mutex::new(state),
+            bound: false,
+            mt: MemoryType::empty(),
+            mapping: AtomicPtr::new(ptr::null_mut()),
+            map_count: AtomicU32::new(0),
+            map_lock: Mutex::new(()),
+            cpu_access: Mutex::new(None),
+            copy_class: class.copy_class.clone(),
+            copy_handle: OnceLock::new(),
+            import_lock: Mutex::new(()),
         }
     }
 
@@ -94,7 +267,9 @@ impl Bo {
         let con = merge_class_to_constraint(con, class)?;
 
         let backend = device.backend(class.backend_index);
+        let span = device.counters(class.backend_index).span(Operation::Create);
         let handle = backend.with_constraint(class, extent, con)?;
+        drop(span);
         let bo = Self::new(device, handle, class, extent);
 
         Ok(bo)
@@ -115,7 +290,9 @@ impl Bo {
         }
 
         let backend = device.backend(class.backend_index);
+        let span = device.counters(class.backend_index).span(Operation::Create);
         let handle = backend.with_layout(class, extent, layout, dmabuf)?;
+        drop(span);
         let bo = Self::new(device, handle, class, extent);
 
         Ok(bo)
@@ -141,6 +318,65 @@ impl Bo {
         self.device.backend(self.backend_index)
     }
 
+    fn counters(&self) -> &Counters {
+        self.device.counters(self.backend_index)
+    }
+
+    fn copy_backend_index(&self) -> usize {
+        self.copy_class
+            .as_ref()
+            .map_or(self.backend_index, |class| class.backend_index)
+    }
+
+    fn copy_backend(&self) -> &dyn Backend {
+        self.device.backend(self.copy_backend_index())
+    }
+
+    // this returns the handle of the BO in the backend, importing the BO into the copy backend
+    // on first use
+    fn handle_for(&self, idx: usize) -> Result<&Handle> {
+        if idx == self.backend_index {
+            return Ok(&self.handle);
+        }
+
+        let class = match &self.copy_class {
+            Some(class) if class.backend_index == idx => class,
+            _ => return Error::unsupported(),
+        };
+
+        if let Some(handle) = self.copy_handle.get() {
+            return Ok(handle);
+        }
+
+        let _guard = self.import_lock.lock().unwrap();
+        if self.copy_handle.get().is_none() {
+            let handle = self.import(class)?;
+            // this never fails because of import_lock
+            let _ = self.copy_handle.set(handle);
+        }
+
+        Ok(self.copy_handle.get().unwrap())
+    }
+
+    fn import(&self, class: &Class) -> Result<Handle> {
+        let dmabuf = self.backend().export_dma_buf(&self.handle, None)?;
+
+        let backend = self.device.backend(class.backend_index);
+        let mut handle =
+            backend.with_layout(class, self.extent, self.layout(), Some(dmabuf.as_fd()))?;
+
+        let mts = backend.memory_types(&handle);
+        let res = backends::best_memory_type(&mts, Flags::COPY)
+            .ok_or(Error::Unsupported)
+            .and_then(|mt| backend.bind_memory(&mut handle, mt, Some(dmabuf)));
+        if let Err(err) = res {
+            backend.free(handle);
+            return Err(err);
+        }
+
+        Ok(handle)
+    }
+
     /// Returns the physical layout.
     pub fn layout(&self) -> Layout {
         self.backend().layout(&self.handle)
@@ -161,9 +397,32 @@ impl Bo {
         self.backend().memory_types(&self.handle)
     }
 
+    /// Returns the supported memory type that best suits the intended access pattern.
+    ///
+    /// The access pattern is described by the CPU access flags, such as `Flags::CPU_READBACK`,
+    /// of the BO.  When there is none, device access is assumed.
+    pub fn preferred_memory_type(&self) -> Option<MemoryType> {
+        backends::best_memory_type(&self.memory_types(), self.flags)
+    }
+
+    /// Returns the supported mappable memory type that best suits CPU access of the access type.
+    ///
+    /// CPU reads from uncached memory are slow, while CPU writes are fast with write-combined
+    /// memory and do not need cache flushes.
+    pub fn mappable_memory_type(&self, access: Access) -> Option<MemoryType> {
+        let flags = if access.is_read() {
+            Flags::MAP | Flags::CPU_READBACK
+        } else {
+            Flags::MAP | Flags::CPU_STREAM
+        };
+
+        backends::best_memory_type(&self.memory_types(), flags)
+    }
+
     /// Allocates or imports a memory, and binds the memory to a BO.
     ///
-    /// A BO without a memory bound cannot be exported, mapped, nor copied.
+    /// A BO without a memory bound cannot be exported, mapped, nor copied.  If `mt` is empty,
+    /// `preferred_memory_type` is used.
     ///
     /// As a note, two HBM BOs can refer to the same kernel space BO due to export/import.
     pub fn bind_memory(&mut self, mt: MemoryType, dmabuf: Option<OwnedFd>) -> Result<()> {
@@ -171,16 +430,25 @@ impl Bo {
             return Error::user();
         }
 
-        let mut state = self.state.lock().unwrap();
-        if state.bound {
+        if self.bound {
             return Error::user();
         }
 
+        let mt = if mt.is_empty() {
+            self.preferred_memory_type().unwrap_or(mt)
+        } else {
+            mt
+        };
+
+        let counters = self.device.counters(self.backend_index);
+        let span = counters.span(Operation::BindMemory);
         let backend = self.device.backend(self.backend_index);
         backend.bind_memory(&mut self.handle, mt, dmabuf)?;
+        drop(span);
 
-        state.bound = true;
-        state.mt = mt;
+        self.bound = true;
+        self.mt = mt;
+        counters.add_bo(mt, self.layout().size);
 
         Ok(())
     }
@@ -196,83 +464,280 @@ impl Bo {
             return Error::user();
         }
 
-        let state = self.state.lock().unwrap();
-        if !state.bound {
+        if !self.bound {
             return Error::user();
         }
 
         self.backend().export_dma_buf(&self.handle, name)
     }
 
-    /// Maps a BO for CPU access.
+    fn validate_range(&self, offset: Size, size: Size) -> bool {
+        let bo_size = self.layout().size;
+        size > 0 && offset <= bo_size && size <= bo_size - offset
+    }
+
+    // this must be called with a map count held
+    fn mapped(&self) -> &MappedRange {
+        let ptr = self.mapping.load(Ordering::Acquire);
+        // SAFETY: ptr points to a live MappedRange because a map count is held
+        unsafe { &*ptr }
+    }
+
+    // this increments the map count and returns the mapping, if the BO is mapped
+    fn acquire_mapped(&self) -> Option<&MappedRange> {
+        self.map_count
+            .fetch_update(Ordering::Acquire, Ordering::Relaxed, |count| {
+                (count > 0).then_some(count + 1)
+            })
+            .ok()?;
+
+        Some(self.mapped())
+    }
+
+    fn map_first(&self, offset: Size, size: Size, access: Access) -> Result<&MappedRange> {
+        let _guard = self.map_lock.lock().unwrap();
+
+        // another thread might have mapped the BO
+        if let Some(mapped) = self.acquire_mapped() {
+            return Ok(mapped);
+        }
+
+        let span = self.counters().span(Operation::Map);
+        let mapping = self.backend().map(&self.handle, offset, size, access)?;
+        drop(span);
+        let mapped = Box::new(MappedRange {
+            mapping,
+            offset,
+            access,
+        });
+        self.mapping.store(Box::into_raw(mapped), Ordering::Release);
+        self.map_count.store(1, Ordering::Release);
+
+        Ok(self.mapped())
+    }
+
+    /// Maps a BO for CPU access of the specified access type.
     ///
     /// Recursive mapping is allowed and returns the same mapping.
-    pub fn map(&mut self) -> Result<Mapping> {
-        if !self.can_map() {
+    pub fn map(&self, access: Access) -> Result<Mapping> {
+        let size = self.layout().size;
+        self.map_range(0, size, access)
+    }
+
+    /// Maps a range of a BO for CPU access of the specified access type.
+    ///
+    /// The returned mapping covers the range.  Recursive mapping is allowed as long as the range
+    /// is within the range of the first mapping and the access type is allowed by the first
+    /// mapping, and returns a part of the first mapping.
+    ///
+    /// Flushes are no-ops for read-only mappings, and invalidations are no-ops for write-only
+    /// mappings.
+    pub fn map_range(&self, offset: Size, size: Size, access: Access) -> Result<Mapping> {
+        if !self.can_map() || !self.validate_range(offset, size) {
             return Error::user();
         }
 
-        let mut state = self.state.lock().unwrap();
-        if !state.bound || !state.mt.contains(MemoryType::MAPPABLE) {
+        if !self.bound || !self.mt.contains(MemoryType::MAPPABLE) {
             return Error::user();
         }
 
-        if state.map_count == 0 {
-            let mapping = self.backend().map(&self.handle)?;
-            state.mapping = Some(mapping);
-            state.map_count = 1;
-        } else {
-            state.map_count += 1;
+        let len = num::NonZeroUsize::try_from(usize::try_from(size)?)?;
+        let mapped = match self.acquire_mapped() {
+            Some(mapped) => mapped,
+            None => self.map_first(offset, size, access)?,
+        };
+        if !mapped.contains(offset, size, access) {
+            self.unmap();
+            return Error::user();
         }
 
-        Ok(state.mapping.unwrap())
+        let ptr_offset = (offset - mapped.offset) as usize;
+        let ptr = mapped
+            .mapping
+            .ptr
+            .as_ptr()
+            .cast::<u8>()
+            .wrapping_add(ptr_offset);
+        let mapping = Mapping {
+            ptr: ptr::NonNull::new(ptr.cast()).unwrap(),
+            len,
+        };
+
+        Ok(mapping)
     }
 
     /// Unmaps a BO.
-    pub fn unmap(&mut self) {
-        let mut state = self.state.lock().unwrap();
-
-        match state.map_count {
-            0 => (),
-            1 => {
-                let mapping = state.mapping.take().unwrap();
-                self.backend().unmap(&self.handle, mapping);
-                state.map_count = 0;
-            }
-            _ => state.map_count -= 1,
+    pub fn unmap(&self) {
+        // this is not the last unmap
+        if self
+            .map_count
+            .fetch_update(Ordering::Release, Ordering::Relaxed, |count| {
+                (count > 1).then_some(count - 1)
+            })
+            .is_ok()
+        {
+            return;
+        }
+
+        let _guard = self.map_lock.lock().unwrap();
+        if self.map_count.load(Ordering::Acquire) == 0 {
+            return;
+        }
+        if self.map_count.fetch_sub(1, Ordering::AcqRel) > 1 {
+            return;
         }
+
+        let ptr = self.mapping.swap(ptr::null_mut(), Ordering::Acquire);
+        // SAFETY: ptr was leaked by map_first and the map count has dropped to zero
+        let mapped = unsafe { Box::from_raw(ptr) };
+        self.backend().unmap(&self.handle, mapped.mapping);
+    }
+
+    // this returns the range if it is within the mapping and needs cache maintenance
+    fn mapped_range(
+        &self,
+        mapped: &MappedRange,
+        range: Option<(Size, Size)>,
+    ) -> Option<(Size, Size)> {
+        if self.mt.contains(MemoryType::COHERENT) {
+            return None;
+        }
+
+        mapped.range(range)
     }
 
     /// Flushes the CPU cache for the BO mapping.
     ///
     /// If the memory type is coherent, the CPU cache is not flushed.
     pub fn flush(&self) {
-        let state = self.state.lock().unwrap();
+        self.flush_range_optional(None);
+    }
+
+    /// Flushes the CPU cache for a range of the BO mapping.
+    ///
+    /// The range must be within the BO mapping, otherwise this is a no-op.  If the memory type is
+    /// coherent, the CPU cache is not flushed.  Some backends flush the entire BO mapping.
+    pub fn flush_range(&self, offset: Size, size: Size) {
+        self.flush_range_optional(Some((offset, size)));
+    }
 
-        if state.map_count > 0 && !state.mt.contains(MemoryType::COHERENT) {
-            self.backend().flush(&self.handle);
+    fn flush_range_optional(&self, range: Option<(Size, Size)>) {
+        let Some(mapped) = self.acquire_mapped() else {
+            return;
+        };
+
+        if mapped.access.is_write() {
+            if let Some((offset, size)) = self.mapped_range(mapped, range) {
+                self.backend().flush(&self.handle, offset, size);
+            }
         }
+
+        self.unmap();
     }
 
     /// Invalidates the CPU cache for the BO mapping.
     ///
     /// If the memory type is coherent, the CPU cache is not invalidated.
     pub fn invalidate(&self) {
-        let state = self.state.lock().unwrap();
+        self.invalidate_range_optional(None);
+    }
+
+    /// Invalidates the CPU cache for a range of the BO mapping.
+    ///
+    /// The range must be within the BO mapping, otherwise this is a no-op.  If the memory type is
+    /// coherent, the CPU cache is not invalidated.  Some backends invalidate the entire BO
+    /// mapping.
+    pub fn invalidate_range(&self, offset: Size, size: Size) {
+        self.invalidate_range_optional(Some((offset, size)));
+    }
+
+    fn invalidate_range_optional(&self, range: Option<(Size, Size)>) {
+        let Some(mapped) = self.acquire_mapped() else {
+            return;
+        };
+
+        if mapped.access.is_read() {
+            if let Some((offset, size)) = self.mapped_range(mapped, range) {
+                self.backend().invalidate(&self.handle, offset, size);
+            }
+        }
+
+        self.unmap();
+    }
+
+    /// Begins CPU access to a BO.
+    ///
+    /// This waits for pending device accesses and makes device writes visible to the CPU.  All
+    /// CPU accesses of the specified access type should be bracketed by `begin_cpu_access` and
+    /// `end_cpu_access`.  CPU accesses cannot be nested.
+    pub fn begin_cpu_access(&self, access: Access) -> Result<()> {
+        self.begin_cpu_access_optional(access, None)
+    }
+
+    /// Begins CPU access to a range of a BO.
+    ///
+    /// This is similar to `begin_cpu_access`, except that cache maintenance by this and the
+    /// matching `end_cpu_access` is limited to the range.  The range must be within the BO
+    /// mapping for the limit to apply.  Some backends maintain the entire BO mapping.
+    pub fn begin_cpu_access_range(&self, access: Access, offset: Size, size: Size) -> Result<()> {
+        if !self.validate_range(offset, size) {
+            return Error::user();
+        }
+
+        self.begin_cpu_access_optional(access, Some((offset, size)))
+    }
+
+    fn begin_cpu_access_optional(&self, access: Access, range: Option<(Size, Size)>) -> Result<()> {
+        if !self.bound {
+            return Error::user();
+        }
+
+        let mut cpu_access = self.cpu_access.lock().unwrap();
+        if cpu_access.is_some() {
+            return Error::user();
+        }
+
+        self.sync_cpu_access(access, range, true);
+        *cpu_access = Some((access, range));
+
+        Ok(())
+    }
+
+    /// Ends CPU access to a BO.
+    ///
+    /// This makes CPU writes visible to the device.
+    pub fn end_cpu_access(&self) -> Result<()> {
+        let Some((access, range)) = self.cpu_access.lock().unwrap().take() else {
+            return Error::user();
+        };
+
+        self.sync_cpu_access(access, range, false);
+
+        Ok(())
+    }
+
+    // this begins or ends CPU access, with cache maintenance on the range of the BO mapping
+    fn sync_cpu_access(&self, access: Access, range: Option<(Size, Size)>, begin: bool) {
+        let mapped = self.acquire_mapped();
+        let range = mapped.and_then(|mapped| self.mapped_range(mapped, range));
+
+        if begin {
+            self.backend().begin_cpu_access(&self.handle, access, range);
+        } else {
+            self.backend().end_cpu_access(&self.handle, access, range);
+        }
 
-        if state.map_count > 0 && !state.mt.contains(MemoryType::COHERENT) {
-            self.backend().invalidate(&self.handle);
+        if mapped.is_some() {
+            self.unmap();
         }
     }
 
-    // this should not be used if the mutex needs to remain locked for synchronization
-    fn is_bound(&self) -> bool {
-        let state = self.state.lock().unwrap();
-        state.bound
+    pub(crate) fn is_mapped(&self) -> bool {
+        self.map_count.load(Ordering::Relaxed) > 0
     }
 
     fn validate_copy(&self, src: &Bo) -> bool {
-        self.can_copy() && self.is_bound() && src.can_copy() && src.is_bound()
+        self.can_copy() && self.bound && src.can_copy() && src.bound
     }
 
     fn validate_copy_buffer(&self, src: &Bo, copy: &CopyBuffer) -> bool {
@@ -341,7 +806,7 @@ impl Bo {
     fn wait_copy(&self, sync_fd: Option<OwnedFd>, wait: bool) -> Option<OwnedFd> {
         if wait {
             sync_fd.and_then(|sync_fd| {
-                let _ = utils::poll(sync_fd, Access::Read);
+                let _ = stats::wait(|| utils::poll(sync_fd, Access::Read));
                 None
             })
         } else {
@@ -349,6 +814,33 @@ impl Bo {
         }
     }
 
+    fn can_cpu_copy(&self) -> bool {
+        self.can_map() && self.mt.contains(MemoryType::MAPPABLE)
+    }
+
+    // this returns true if a copy of the size should be done by the CPU
+    fn use_cpu_copy(&self, src: &Bo, size: Size) -> bool {
+        // src and dst must not overlap
+        if ptr::eq(self, src) || !self.can_cpu_copy() || !src.can_cpu_copy() {
+            return false;
+        }
+
+        size <= CPU_COPY_THRESHOLD || !self.copy_backend().supports_device_copy()
+    }
+
+    // this returns the parameters of a CPU copy, if the copy should be done by the CPU
+    fn cpu_copy_buffer_image_params(
+        &self,
+        src: &Bo,
+        copy: &CopyBufferImage,
+    ) -> Option<copy::BufferImageParams> {
+        let img = if self.is_buffer() { src } else { self };
+        let params =
+            copy::BufferImageParams::new(img.format, &img.layout(), copy, self.is_buffer())?;
+
+        self.use_cpu_copy(src, params.size()).then_some(params)
+    }
+
     /// Copies between two BOs that are both buffers.
     ///
     /// `sync_fd` is an optional sync file that the copy operation waits for.
@@ -366,8 +858,30 @@ impl Bo {
             return Error::user();
         }
 
-        self.backend()
-            .copy_buffer(&self.handle, &src.handle, copy, sync_fd)
+        let _span = self
+            .device
+            .counters(self.copy_backend_index())
+            .span(Operation::Copy);
+
+        if self.use_cpu_copy(src, copy.size) {
+            let ranges = CpuCopyRanges {
+                dst: (copy.dst_offset, copy.size),
+                dst_access: Access::Write,
+                src: (copy.src_offset, copy.size),
+            };
+            if let Some(cpu_copy) = CpuCopy::new(self, src, ranges) {
+                let size = usize::try_from(copy.size)?;
+                cpu_copy.run(sync_fd, |dst, src| copy::copy_buffer(dst, src, size))?;
+                return Ok(None);
+            }
+        }
+
+        let idx = self.copy_backend_index();
+        let dst_handle = self.handle_for(idx)?;
+        let src_handle = src.handle_for(idx)?;
+        self.device
+            .backend(idx)
+            .copy_buffer(dst_handle, src_handle, copy, sync_fd)
             .map(|sync_fd| self.wait_copy(sync_fd, wait))
     }
 
@@ -388,15 +902,108 @@ impl Bo {
             return Error::user();
         }
 
-        self.backend()
-            .copy_buffer_image(&self.handle, &src.handle, copy, sync_fd)
+        let _span = self
+            .device
+            .counters(self.copy_backend_index())
+            .span(Operation::Copy);
+
+        if let Some(params) = self.cpu_copy_buffer_image_params(src, &copy) {
+            let ranges = CpuCopyRanges {
+                dst: params.dst_range,
+                dst_access: params.dst_access(),
+                src: params.src_range,
+            };
+            if let Some(cpu_copy) = CpuCopy::new(self, src, ranges) {
+                cpu_copy.run(sync_fd, |dst, src| {
+                    copy::copy_buffer_image(dst, src, &params)
+                })?;
+                return Ok(None);
+            }
+        }
+
+        let idx = self.copy_backend_index();
+        let dst_handle = self.handle_for(idx)?;
+        let src_handle = src.handle_for(idx)?;
+        self.device
+            .backend(idx)
+            .copy_buffer_image(dst_handle, src_handle, copy, sync_fd)
             .map(|sync_fd| self.wait_copy(sync_fd, wait))
     }
+
+    fn validate_copy_buffer_image_batch(copies: &[(&Bo, &Bo, CopyBufferImage)]) -> bool {
+        let (first, _, _) = match copies.first() {
+            Some(copy) => copy,
+            None => return false,
+        };
+
+        copies.iter().all(|(dst, src, copy)| {
+            let same_backend = |bo: &Bo| {
+                Arc::ptr_eq(&bo.device, &first.device) && bo.backend_index == first.backend_index
+            };
+            // the copies are not ordered within a batch
+            let is_src = |bo: &Bo| copies.iter().any(|(_, other, _)| ptr::eq(bo, *other));
+
+            same_backend(dst)
+                && same_backend(src)
+                && !is_src(dst)
+                && dst.validate_copy_buffer_image(src, copy)
+        })
+    }
+
+    /// Copies between pairs of BOs where one is a buffer and one is an image, as a batch.
+    ///
+    /// Each element of `copies` is a `(dst, src, copy)` tuple.  This is similar to calling
+    /// `copy_buffer_image` for each element, except the backend can submit all copies at once.
+    /// The copies may cover different planes and different BOs, but all BOs must belong to the
+    /// same backend, and no BO can be both a destination and a source in the same batch.
+    ///
+    /// `sync_fd` and `wait` have the same meanings as in `copy_buffer_image`, and apply to the
+    /// entire batch.
+    pub fn copy_buffer_image_batch(
+        copies: &[(&Bo, &Bo, CopyBufferImage)],
+        sync_fd: Option<OwnedFd>,
+        wait: bool,
+    ) -> Result<Option<OwnedFd>> {
+        if !Self::validate_copy_buffer_image_batch(copies) {
+            return Error::user();
+        }
+
+        let (first, _, _) = copies[0];
+        let idx = first.copy_backend_index();
+        let _span = first.device.counters(idx).span(Operation::Copy);
+        let handles = copies
+            .iter()
+            .map(|(dst, src, copy)| Ok((dst.handle_for(idx)?, src.handle_for(idx)?, *copy)))
+            .collect::<Result<Vec<(&Handle, &Handle, CopyBufferImage)>>>()?;
+
+        first
+            .device
+            .backend(idx)
+            .copy_buffer_image_batch(&handles, sync_fd)
+            .map(|sync_fd| first.wait_copy(sync_fd, wait))
+    }
 }
 
 impl Drop for Bo {
     fn drop(&mut self) {
-        self.unmap();
-        self.backend().free(&self.handle);
+        let ptr = *self.mapping.get_mut();
+        if !ptr.is_null() {
+            // SAFETY: ptr was leaked by map_first and there is no other user
+            let mapped = unsafe { Box::from_raw(ptr) };
+            self.backend().unmap(&self.handle, mapped.mapping);
+        }
+
+        // the BO owns the dma-buf of the copy handle, which goes away with the BO
+        if let Some(handle) = self.copy_handle.take() {
+            self.copy_backend().free_uncached(handle);
+        }
+
+        if self.bound {
+            self.counters().remove_bo(self.mt, self.layout().size);
+        }
+
+        // SAFETY: the handle is not used after this
+        let handle = unsafe { ManuallyDrop::take(&mut self.handle) };
+        self.backend().free(handle);
     }
 }
@@ -0,0 +1,350 @@
+// Copyright 2024 Google LLC
+// SPDX-License-Identifier: MIT
+
+//! BO cache-related types.
+//!
+//! This module defines `BoCache` and `CachedBo`, and the `Pool` that backends can use to cache
+//! their own objects.
+
+use super::backends::{Class, Constraint, Extent, MemoryType};
+use super::bo::Bo;
+use super::device::Device;
+use super::types::{Result, Size};
+use std::collections::{BTreeMap, HashMap, VecDeque};
+use std::hash::Hash;
+use std::ops::{Deref, DerefMut};
+use std::sync::{Arc, Mutex};
+
+// BOs are interchangeable only when they are created and bound with the same parameters
+#[derive(Clone, Eq, Hash, PartialEq)]
+struct Key {
+    class: Class,
+    extent: Extent,
+    con: Option<Constraint>,
+    mt: MemoryType,
+}
+
+struct Entry<T> {
+    // the release order of the entry
+    seq: u64,
+    bo: T,
+    size: Size,
+}
+
+// A pool of interchangeable objects, capped by a memory budget in bytes.
+//
+// Objects are interchangeable when they have equal keys.  When the budget is exceeded, the least
+// recently released objects are evicted.  The pool is generic such that backends can use it and
+// it can be tested without a device.
+pub(crate) struct Pool<K, T> {
+    // cached entries grouped by their keys; the front of each list is the least recently released
+    entries: HashMap<K, VecDeque<Entry<T>>>,
+    // the keys of all cached entries in their release order, for LRU eviction
+    lru: BTreeMap<u64, K>,
+    next_seq: u64,
+    size: Size,
+    budget: Size,
+}
+
+impl<K: Clone + Eq + Hash, T> Pool<K, T> {
+    pub(crate) fn new(budget: Size) -> Self {
+        Self {
+            entries: HashMap::new(),
+            lru: BTreeMap::new(),
+            next_seq: 0,
+            size: 0,
+            budget,
+        }
+    }
+
+    pub(crate) fn take(&mut self, key: &K) -> Option<T> {
+        // hand out the most recently released object
+        let list = self.entries.get_mut(key)?;
+        let entry = list.pop_back().unwrap();
+        if list.is_empty() {
+            self.entries.remove(key);
+        }
+
+        self.lru.remove(&entry.seq);
+        self.size -= entry.size;
+
+        Some(entry.bo)
+    }
+
+    // This returns the evicted objects, so that they can be freed without the lock held.  The
+    // object is evicted right away when it is larger than the budget.
+    pub(crate) fn put(&mut self, key: &K, bo: T, size: Size) -> Vec<T> {
+        if size > self.budget {
+            return vec![bo];
+        }
+
+        let seq = self.next_seq;
+        self.next_seq += 1;
+
+        let entry = Entry { seq, bo, size };
+        match self.entries.get_mut(key) {
+            Some(list) => list.push_back(entry),
+            None => {
+                self.entries.insert(key.clone(), VecDeque::from([entry]));
+            }
+        }
+        self.lru.insert(seq, key.clone());
+        self.size += size;
+
+        self.trim(self.budget)
+    }
+
+    // this returns the evicted objects, so that they can be freed without the lock held
+    pub(crate) fn trim(&mut self, budget: Size) -> Vec<T> {
+        let mut evicted = Vec::new();
+        while self.size > budget {
+            // the least recently released entry is at the front of the list of its key
+            let (_, key) = self.lru.pop_first().unwrap();
+            let list = self.entries.get_mut(&key).unwrap();
+            let entry = list.pop_front().unwrap();
+            if list.is_empty() {
+                self.entries.remove(&key);
+            }
+
+            self.size -= entry.size;
+            evicted.push(entry.bo);
+        }
+
+        evicted
+    }
+}
+
+/// A BO cache.
+///
+/// A BO cache keeps recently released BOs and hands them back on allocations with matching
+/// parameters.  This avoids the costs of BO creation, memory allocation, and BO destruction for
+/// clients that repeatedly allocate and free BOs of the same shapes.
+///
+/// The total size of the cached BOs is capped by a memory budget.  When the budget is exceeded,
+/// the least recently released BOs are freed.
+pub struct BoCache {
+    device: Arc<Device>,
+    pool: Arc<Mutex<Pool<Key, Bo>>>,
+}
+
+impl BoCache {
+    /// Creates a BO cache with a memory budget in bytes.
+    pub fn new(device: Arc<Device>, budget: Size) -> Self {
+        Self {
+            device,
+            pool: Arc::new(Mutex::new(Pool::new(budget))),
+        }
+    }
+
+    /// Allocates a BO with an optional constraint, and binds a memory of the memory type.
+    ///
+    /// This is similar to calling `Bo::with_constraint` followed by `Bo::bind_memory`, except
+    /// that a cached BO is returned when there is one with the same parameters.
+    pub fn allocate(
+        &self,
+        class: &Class,
+        extent: Extent,
+        con: Option<Constraint>,
+        mt: MemoryType,
+    ) -> Result<CachedBo> {
+        let key = Key {
+            class: class.clone(),
+            extent,
+            con,
+            mt,
+        };
+
+        let cached = self.pool.lock().unwrap().take(&key);
+        let bo = match cached {
+            Some(bo) => bo,
+            None => {
+                let mut bo =
+                    Bo::with_constraint(self.device.clone(), class, extent, key.con.clone())?;
+                bo.bind_memory(mt, None)?;
+                bo
+            }
+        };
+
+        let bo = CachedBo {
+            bo: Some(bo),
+            key,
+            pool: self.pool.clone(),
+        };
+
+        Ok(bo)
+    }
+
+    /// Returns the total size of the cached BOs in bytes.
+    pub fn size(&self) -> Size {
+        self.pool.lock().unwrap().size
+    }
+
+    /// Sets the memory budget in bytes, freeing cached BOs as needed.
+    pub fn set_budget(&self, budget: Size) {
+        let evicted = {
+            let mut pool = self.pool.lock().unwrap();
+            pool.budget = budget;
+            pool.trim(budget)
+        };
+        drop(evicted);
+    }
+
+    /// Frees cached BOs until their total size is no more than `size` bytes.
+    ///
+    /// `trim(0)` frees all cached BOs.  The memory budget is not changed.
+    pub fn trim(&self, size: Size) {
+        let evicted = self.pool.lock().unwrap().trim(size);
+        drop(evicted);
+    }
+}
+
+/// A BO allocated from a `BoCache`.
+///
+/// A cached BO dereferences to `Bo`.  When it is dropped, the BO is returned to the cache instead
+/// of being freed, unless it is still mapped or is larger than the memory budget.
+///
+/// The cache does not know whether the BO is still in use by the GPU or by the holders of its
+/// exported dma-bufs.  The user must ensure that it is no longer in use before dropping it.
+pub struct CachedBo {
+    // this is always Some until the cached BO is dropped or unwrapped
+    bo: Option<Bo>,
+    key: Key,
+    pool: Arc<Mutex<Pool<Key, Bo>>>,
+}
+
+impl CachedBo {
+    /// Detaches the BO from the cache.  The BO will be freed normally when dropped.
+    pub fn into_inner(mut self) -> Bo {
+        self.bo.take().unwrap()
+    }
+}
+
+impl Deref for CachedBo {
+    type Target = Bo;
+
+    fn deref(&self) -> &Bo {
+        self.bo.as_ref().unwrap()
+    }
+}
+
+impl DerefMut for CachedBo {
+    fn deref_mut(&mut self) -> &mut Bo {
+        self.bo.as_mut().unwrap()
+    }
+}
+
+impl Drop for CachedBo {
+    fn drop(&mut self) {
+        let Some(bo) = self.bo.take() else {
+            return;
+        };
+
+        // a mapped BO is not in a pristine state
+        if bo.is_mapped() {
+            return;
+        }
+
+        let size = bo.layout().size;
+        let evicted = self.pool.lock().unwrap().put(&self.key, bo, size);
+        drop(evicted);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::backends::Description;
+
+    fn key(size: Size) -> Key {
+        Key {
+            class: Class::new(Description::new()),
+            extent: Extent::Buffer(size),
+            con: None,
+            mt: MemoryType::empty(),
+        }
+    }
+
+    #[test]
+    fn test_pool_take() {
+        let mut pool = Pool::new(100);
+        let a = key(1);
+        let b = key(2);
+
+        assert_eq!(pool.take(&a), None);
+
+        assert!(pool.put(&a, 1, 10).is_empty());
+        assert!(pool.put(&a, 2, 10).is_empty());
+        assert_eq!(pool.size, 20);
+
+        // misses on a different key
+        assert_eq!(pool.take(&b), None);
+
+        // hits the most recently released BO first
+        assert_eq!(pool.take(&a), Some(2));
+        assert_eq!(pool.take(&a), Some(1));
+        assert_eq!(pool.take(&a), None);
+        assert_eq!(pool.size, 0);
+        assert!(pool.entries.is_empty());
+        assert!(pool.lru.is_empty());
+    }
+
+    #[test]
+    fn test_pool_lru() {
+        let mut pool = Pool::new(30);
+        let a = key(1);
+        let b = key(2);
+
+        assert!(pool.put(&a, 1, 10).is_empty());
+        assert!(pool.put(&b, 2, 10).is_empty());
+        assert!(pool.put(&a, 3, 10).is_empty());
+
+        // evicts the least recently released BO across keys
+        assert_eq!(pool.put(&b, 4, 10), [1]);
+        assert_eq!(pool.trim(10), [2, 3]);
+        assert_eq!(pool.size, 10);
+
+        assert_eq!(pool.take(&a), None);
+        assert_eq!(pool.take(&b), Some(4));
+        assert!(pool.entries.is_empty());
+        assert!(pool.lru.is_empty());
+    }
+
+    #[test]
+    fn test_pool_bytes() {
+        // the budget is in bytes regardless of the number of cached objects
+        let mut pool: Pool<u32, &str> = Pool::new(64);
+
+        assert!(pool.put(&1, "a", 8).is_empty());
+        assert!(pool.put(&1, "b", 8).is_empty());
+        assert!(pool.put(&2, "c", 16).is_empty());
+        assert!(pool.put(&3, "d", 32).is_empty());
+        assert_eq!(pool.size, 64);
+
+        assert_eq!(pool.put(&2, "e", 24), ["a", "b", "c"]);
+        assert_eq!(pool.size, 56);
+
+        assert_eq!(pool.take(&1), None);
+        assert_eq!(pool.take(&2), Some("e"));
+        assert_eq!(pool.trim(0), ["d"]);
+        assert!(pool.entries.is_empty());
+        assert!(pool.lru.is_empty());
+    }
+
+    #[test]
+    fn test_pool_budget() {
+        let mut pool = Pool::new(20);
+        let a = key(1);
+
+        // BOs larger than the budget are not cached
+        assert_eq!(pool.put(&a, 1, 30), [1]);
+        assert_eq!(pool.size, 0);
+
+        assert!(pool.put(&a, 2, 15).is_empty());
+        assert_eq!(pool.put(&a, 3, 15), [2]);
+        assert_eq!(pool.size, 15);
+
+        assert_eq!(pool.trim(0), [3]);
+        assert_eq!(pool.size, 0);
+        assert!(pool.entries.is_empty());
+    }
+}
@@ -0,0 +1,104 @@
+// Copyright 2024 Google LLC
+// SPDX-License-Identifier: MIT
+
+//! On-disk capability caches.
+//!
+//! Backends can persist the results of expensive probing to avoid reprobing on every process
+//! start.  A cache is a text file whose first line is a key, followed by backend-defined entries,
+//! one per line.  Whenever the key does not match, the cache is considered stale.
+
+use std::fs;
+use std::io::Write;
+use std::path::Path;
+use std::process;
+use std::sync::atomic::{AtomicU64, Ordering};
+
+// temporary files are unique per store, even for concurrent stores of a cache in a process
+static NEXT_TMP_ID: AtomicU64 = AtomicU64::new(0);
+
+fn versioned_key(key: &str) -> String {
+    // invalidate all caches when hbm is updated
+    format!("hbm-{} {}", env!("CARGO_PKG_VERSION"), key)
+}
+
+// Loads the entries of a cache, if the cache exists and has a matching key.
+pub fn load(dir: &Path, name: &str, key: &str) -> Option<Vec<String>> {
+    let path = dir.join(name);
+    let data = fs::read_to_string(&path).ok()?;
+
+    let mut lines = data.lines();
+    if lines.next()? != versioned_key(key) {
+        log::debug!("ignoring stale cache {}", path.display());
+        return None;
+    }
+
+    Some(lines.map(String::from).collect())
+}
+
+// Stores the entries of a cache.
+//
+// Errors are logged and otherwise ignored.  The cache is replaced atomically such that
+// concurrent processes never see partial caches.
+pub fn store(dir: &Path, name: &str, key: &str, entries: &[String]) {
+    let path = dir.join(name);
+    let tmp_id = NEXT_TMP_ID.fetch_add(1, Ordering::Relaxed);
+    let tmp_path = dir.join(format!("{}.{}.{}.tmp", name, process::id(), tmp_id));
+
+    let res = fs::create_dir_all(dir)
+        .and_then(|_| {
+            let mut file = fs::OpenOptions::new()
+                .write(true)
+                .create_new(true)
+                .open(&tmp_path)?;
+            writeln!(file, "{}", versioned_key(key))?;
+            for entry in entries {
+                writeln!(file, "{}", entry)?;
+            }
+            file.sync_all()
+        })
+        .and_then(|_| fs::rename(&tmp_path, &path));
+
+    if let Err(err) = res {
+        log::debug!("failed to store cache {}: {}", path.display(), err);
+        let _ = fs::remove_file(&tmp_path);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_cache() {
+        let dir = std::env::temp_dir().join(format!("hbm-cache-test-{}", process::id()));
+        let entries = vec![String::from("1 2 3"), String::from("4")];
+
+        assert!(load(&dir, "test", "key").is_none());
+
+        store(&dir, "test", "key", &entries);
+        assert_eq!(load(&dir, "test", "key"), Some(entries));
+        assert!(load(&dir, "test", "other key").is_none());
+
+        let _ = fs::remove_dir_all(&dir);
+    }
+
+    #[test]
+    fn test_cache_concurrent_store() {
+        let dir = std::env::temp_dir().join(format!("hbm-cache-concurrent-{}", process::id()));
+        let entries = |idx: usize| vec![format!("{idx}"); 1024];
+
+        std::thread::scope(|s| {
+            for idx in 0..8 {
+                let dir = &dir;
+                s.spawn(move || store(dir, "test", "key", &entries(idx)));
+            }
+        });
+
+        // the cache is one of the stores in its entirety
+        let loaded = load(&dir, "test", "key").unwrap();
+        assert!((0..8).any(|idx| loaded == entries(idx)));
+        assert_eq!(fs::read_dir(&dir).unwrap().count(), 1);
+
+        let _ = fs::remove_dir_all(&dir);
+    }
+}
@@ -0,0 +1,282 @@
+// Copyright 2024 Google LLC
+// SPDX-License-Identifier: MIT
+
+//! CPU copies.
+//!
+//! This module copies between BO mappings with the CPU.  It is used for small copies, where a
+//! device submission costs more than the copy itself, and for backends without device copies.
+
+use super::backends::{CopyBufferImage, Layout};
+use super::formats;
+use super::types::{Access, Format, Mapping, Size};
+use std::{cmp, slice, thread};
+
+// copies at least this large are split across threads
+const PARALLEL_COPY_THRESHOLD: usize = 4 * 1024 * 1024;
+const PARALLEL_COPY_MAX_THREADS: usize = 4;
+
+// The parameters of a buffer-image copy.
+//
+// The ranges are the BO ranges to map, and the strides are relative to the starts of the ranges.
+pub struct BufferImageParams {
+    pub dst_range: (Size, Size),
+    pub dst_stride: usize,
+    pub src_range: (Size, Size),
+    pub src_stride: usize,
+    pub row_size: usize,
+    pub height: usize,
+}
+
+impl BufferImageParams {
+    // Returns the parameters of a buffer-image copy, or None if the image is not linear.
+    //
+    // `fmt` and `layout` are those of the image.  `to_buffer` is true if the buffer is the dst.
+    pub fn new(
+        fmt: Format,
+        layout: &Layout,
+        copy: &CopyBufferImage,
+        to_buffer: bool,
+    ) -> Option<Self> {
+        if !layout.modifier.is_linear() || copy.plane >= layout.plane_count {
+            return None;
+        }
+
+        let plane = copy.plane as usize;
+        let fmt_class = formats::format_class(fmt).ok()?;
+        let bpp = fmt_class.block_size[plane] as Size;
+        let row_size = copy.width as Size * bpp;
+        let rows = copy.height as Size - 1;
+
+        let img_stride = layout.strides[plane];
+        let img_offset = layout.offsets[plane] + copy.y as Size * img_stride + copy.x as Size * bpp;
+        let img_range = (img_offset, img_stride * rows + row_size);
+        let buf_range = (copy.offset, copy.stride * rows + row_size);
+
+        let img_stride = usize::try_from(img_stride).ok()?;
+        let buf_stride = usize::try_from(copy.stride).ok()?;
+        let row_size = usize::try_from(row_size).ok()?;
+        let height = copy.height as usize;
+
+        let params = if to_buffer {
+            Self {
+                dst_range: buf_range,
+                dst_stride: buf_stride,
+                src_range: img_range,
+                src_stride: img_stride,
+                row_size,
+                height,
+            }
+        } else {
+            Self {
+                dst_range: img_range,
+                dst_stride: img_stride,
+                src_range: buf_range,
+                src_stride: buf_stride,
+                row_size,
+                height,
+            }
+        };
+
+        Some(params)
+    }
+
+    pub fn size(&self) -> Size {
+        (self.row_size * self.height) as Size
+    }
+
+    // Returns the CPU access to the dst range.
+    //
+    // When the rows of the dst are strided, the copy does not write the bytes between the rows.
+    // The range must be invalidated before the copy such that flushing the partially written
+    // cache lines after the copy does not write back stale bytes.
+    pub fn dst_access(&self) -> Access {
+        if self.height > 1 && self.dst_stride != self.row_size {
+            Access::ReadWrite
+        } else {
+            Access::Write
+        }
+    }
+}
+
+fn as_slice(mapping: &Mapping) -> &[u8] {
+    // SAFETY: the mapping is valid for reads of len bytes while it is mapped
+    unsafe { slice::from_raw_parts(mapping.ptr.as_ptr().cast(), mapping.len.get()) }
+}
+
+#[allow(clippy::mut_from_ref)]
+fn as_mut_slice(mapping: &Mapping) -> &mut [u8] {
+    // SAFETY: the mapping is valid for writes of len bytes while it is mapped, and the caller
+    // holds the only slice of the mapping
+    unsafe { slice::from_raw_parts_mut(mapping.ptr.as_ptr().cast(), mapping.len.get()) }
+}
+
+fn thread_count(size: usize) -> usize {
+    if size < PARALLEL_COPY_THRESHOLD {
+        return 1;
+    }
+
+    let max_threads = thread::available_parallelism().map_or(1, |n| n.get());
+    cmp::min(max_threads, PARALLEL_COPY_MAX_THREADS)
+}
+
+fn copy_rows(
+    dst: &mut [u8],
+    dst_stride: usize,
+    src: &[u8],
+    src_stride: usize,
+    row_size: usize,
+    height: usize,
+) {
+    if dst_stride == row_size && src_stride == row_size {
+        let size = row_size * height;
+        dst[..size].copy_from_slice(&src[..size]);
+        return;
+    }
+
+    for row in 0..height {
+        let dst_offset = dst_stride * row;
+        let src_offset = src_stride * row;
+        dst[dst_offset..dst_offset + row_size]
+            .copy_from_slice(&src[src_offset..src_offset + row_size]);
+    }
+}
+
+// Copies `size` bytes from the start of src to the start of dst.  The mappings must not
+// overlap.
+pub fn copy_buffer(dst: &Mapping, src: &Mapping, size: usize) {
+    let dst = &mut as_mut_slice(dst)[..size];
+    let src = &as_slice(src)[..size];
+
+    let chunk_size = size.div_ceil(thread_count(size));
+    if chunk_size == size {
+        dst.copy_from_slice(src);
+        return;
+    }
+
+    thread::scope(|scope| {
+        for (dst, src) in dst.chunks_mut(chunk_size).zip(src.chunks(chunk_size)) {
+            scope.spawn(move || dst.copy_from_slice(src));
+        }
+    });
+}
+
+// Copies between the mapped ranges of a buffer-image copy.  The mappings must not overlap.
+pub fn copy_buffer_image(dst: &Mapping, src: &Mapping, params: &BufferImageParams) {
+    let range_size = |stride: usize| stride * (params.height - 1) + params.row_size;
+    let dst = &mut as_mut_slice(dst)[..range_size(params.dst_stride)];
+    let src = &as_slice(src)[..range_size(params.src_stride)];
+
+    let thread_count = thread_count(params.row_size * params.height);
+    let rows_per_thread = params.height.div_ceil(thread_count);
+    if rows_per_thread == params.height {
+        copy_rows(
+            dst,
+            params.dst_stride,
+            src,
+            params.src_stride,
+            params.row_size,
+            params.height,
+        );
+        return;
+    }
+
+    // split at row boundaries such that each thread copies disjoint rows
+    let dst_chunks = dst.chunks_mut(params.dst_stride * rows_per_thread);
+    let src_chunks = src.chunks(params.src_stride * rows_per_thread);
+    thread::scope(|scope| {
+        for (i, (dst, src)) in dst_chunks.zip(src_chunks).enumerate() {
+            let height = cmp::min(rows_per_thread, params.height - rows_per_thread * i);
+            scope.spawn(move || {
+                copy_rows(
+                    dst,
+                    params.dst_stride,
+                    src,
+                    params.src_stride,
+                    params.row_size,
+                    height,
+                )
+            });
+        }
+    });
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::{num, ptr};
+
+    fn mapping(data: &mut [u8]) -> Mapping {
+        Mapping {
+            ptr: ptr::NonNull::new(data.as_mut_ptr().cast()).unwrap(),
+            len: num::NonZeroUsize::new(data.len()).unwrap(),
+        }
+    }
+
+    #[test]
+    fn test_copy_buffer() {
+        // large enough to be split across threads
+        let size = PARALLEL_COPY_THRESHOLD + 3;
+        let mut src: Vec<u8> = (0..size).map(|i| i as u8).collect();
+        let mut dst = vec![0u8; size + 1];
+
+        copy_buffer(&mapping(&mut dst), &mapping(&mut src), size);
+        assert_eq!(&dst[..size], &src[..]);
+        assert_eq!(dst[size], 0);
+    }
+
+    #[test]
+    fn test_copy_buffer_image() {
+        let fmt = formats::R8;
+        let layout = Layout::new()
+            .size(64)
+            .modifier(formats::MOD_LINEAR)
+            .plane_count(1)
+            .stride(0, 16);
+        let copy = CopyBufferImage {
+            offset: 0,
+            stride: 8,
+            plane: 0,
+            x: 1,
+            y: 1,
+            width: 2,
+            height: 2,
+        };
+
+        let params = BufferImageParams::new(fmt, &layout, &copy, true).unwrap();
+        assert_eq!(params.dst_range, (0, 10));
+        assert_eq!(params.src_range, (17, 18));
+        assert_eq!(params.size(), 4);
+        assert_eq!(params.dst_access(), Access::ReadWrite);
+
+        let mut img: Vec<u8> = (0..64).collect();
+        let mut buf = vec![0u8; 10];
+        copy_buffer_image(&mapping(&mut buf), &mapping(&mut img[17..35]), &params);
+        assert_eq!(buf, [17, 18, 0, 0, 0, 0, 0, 0, 33, 34]);
+
+        let params = BufferImageParams::new(fmt, &layout, &copy, false).unwrap();
+        assert_eq!(params.dst_range, (17, 18));
+        assert_eq!(params.src_range, (0, 10));
+        assert_eq!(params.dst_access(), Access::ReadWrite);
+
+        // the image row stride is larger than the copy width
+        let mut buf: Vec<u8> = (0..10).collect();
+        let mut img = vec![0xffu8; 64];
+        copy_buffer_image(&mapping(&mut img[17..35]), &mapping(&mut buf), &params);
+        assert_eq!(&img[16..20], [0xff, 0, 1, 0xff]);
+        assert!(img[20..33].iter().all(|&b| b == 0xff));
+        assert_eq!(&img[32..36], [0xff, 8, 9, 0xff]);
+
+        // the tightly packed rows of a buffer dst are written entirely
+        let packed = CopyBufferImage { stride: 2, ..copy };
+        let params = BufferImageParams::new(fmt, &layout, &packed, true).unwrap();
+        assert_eq!(params.dst_range, (0, 4));
+        assert_eq!(params.dst_access(), Access::Write);
+
+        let single_row = CopyBufferImage { height: 1, ..copy };
+        let params = BufferImageParams::new(fmt, &layout, &single_row, false).unwrap();
+        assert_eq!(params.dst_access(), Access::Write);
+
+        let tiled = layout.modifier(formats::MOD_INVALID);
+        assert!(BufferImageParams::new(fmt, &tiled, &copy, true).is_none());
+    }
+}
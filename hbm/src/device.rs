@@ -5,16 +5,36 @@
 //!
 //! This module defines `Device` and `Builder`
 
-use super::backends::{Backend, Class, Constraint, Description, Extent, Usage};
-use super::types::{Error, Format, Modifier, Result};
-use std::collections::HashSet;
+use super::backends::{Backend, Class, Constraint, Description, Extent, Flags, Usage};
+use super::formats;
+use super::stats::{BackendStats, Counters, Operation};
+use super::types::{Error, Format, Modifier, ModifierSet, Result};
+use std::cmp;
 use std::sync::Arc;
 
+// This sorts the supported modifiers by preference, after they have been intersected among all
+// backends.
+fn rank_modifiers(flags: Flags, mods: &mut ModifierSet) -> Result<()> {
+    // not all backends can tell compressed modifiers apart
+    if flags.contains(Flags::NO_COMPRESSION) {
+        mods.retain(|m| !formats::is_compressed_modifier(*m));
+        if mods.is_empty() {
+            return Error::unsupported();
+        }
+    }
+
+    mods.sort_by_key(|m| cmp::Reverse(formats::modifier_rank(*m)));
+
+    Ok(())
+}
+
 /// A device.
 ///
 /// A device consists of one or more backends to interact with the underlying subsystems and hardware.
 pub struct Device {
     backends: Vec<Box<dyn Backend>>,
+    // one per backend
+    counters: Vec<Counters>,
 }
 
 impl Device {
@@ -57,41 +77,49 @@ impl Device {
             return Error::user();
         }
 
-        if self.backends.len() == 1 {
-            self.backends[0].classify(desc, usage[0])
+        let mut class = if self.backends.len() == 1 {
+            self.backend_classify(0, desc, usage[0])
         } else {
-            // this is unused and needs more work
             self.multi_classify(desc, usage)
+        }?;
+
+        if !desc.is_buffer() {
+            rank_modifiers(desc.flags, &mut class.modifiers)?;
         }
-        .inspect(|class| {
-            assert_eq!(class.modifiers.is_empty(), desc.is_buffer());
-        })
+        assert_eq!(class.modifiers.is_empty(), desc.is_buffer());
+
+        Ok(class)
+    }
+
+    fn backend_classify(&self, idx: usize, desc: Description, usage: Usage) -> Result<Class> {
+        let _span = self.counters(idx).span(Operation::Classify);
+        self.backends[idx].classify(desc, usage)
     }
 
     fn multi_classify(&self, desc: Description, usage: &[Usage]) -> Result<Class> {
         // call classify from all backends and merge the results
         let mut max_extent = Extent::max_supported(&desc);
-        let mut mods: Option<HashSet<Modifier>> = None;
+        let mut mods: Option<ModifierSet> = None;
         let mut con = Constraint::new();
         let mut required_idx = None;
-        for (idx, (backend, &usage)) in self.backends.iter().zip(usage.iter()).enumerate() {
+        let mut classes = Vec::new();
+        for (idx, &usage) in usage.iter().enumerate() {
             if usage == Usage::Unused {
                 continue;
             }
 
-            let class = backend.classify(desc, usage)?;
+            let class = self.backend_classify(idx, desc, usage)?;
 
             max_extent.intersect(class.max_extent);
 
             if !desc.is_buffer() {
-                let backend_mods: HashSet<Modifier> = class.modifiers.into_iter().collect();
-                mods = Some(match mods {
-                    Some(mods) => mods.intersection(&backend_mods).copied().collect(),
-                    None => backend_mods,
-                });
+                match &mut mods {
+                    Some(mods) => mods.intersect(&class.modifiers),
+                    None => mods = Some(class.modifiers.clone()),
+                }
             }
 
-            if let Some(backend_con) = class.constraint {
+            if let Some(backend_con) = class.constraint.clone() {
                 con.merge(backend_con);
             }
 
@@ -102,39 +130,72 @@ impl Device {
                     return Error::unsupported();
                 }
             }
+
+            // the classes are only needed to route device copies
+            if desc.flags.contains(Flags::COPY) {
+                classes.push((idx, class));
+            }
         }
 
         if max_extent.is_empty() {
             return Error::unsupported();
         }
 
-        let mods: Vec<Modifier> = if desc.is_buffer() {
-            Vec::new()
-        } else {
-            let mods = mods.unwrap_or_default();
-            if mods.is_empty() {
-                return Error::unsupported();
-            }
-
-            mods.into_iter().collect()
-        };
+        let mods = mods.unwrap_or_default();
+        if !desc.is_buffer() && mods.is_empty() {
+            return Error::unsupported();
+        }
 
         let idx = required_idx.unwrap_or(0);
-        let class = Class::new(desc)
+        let mut class = Class::new(desc)
             .usage(usage[idx])
             .max_extent(max_extent)
             .modifiers(mods)
             .constraint(con)
             .backend_index(idx);
 
+        // allocate from the backend, but route device copies to another backend if needed
+        if desc.flags.contains(Flags::COPY) && !self.backends[idx].supports_device_copy() {
+            if let Some(copy_class) = self.classify_copy(desc, usage, classes) {
+                class = class.copy_class(copy_class);
+            }
+        }
+
         Ok(class)
     }
 
+    // this returns the class of a backend that supports device copies, for importing BOs
+    fn classify_copy(
+        &self,
+        desc: Description,
+        usage: &[Usage],
+        classes: Vec<(usize, Class)>,
+    ) -> Option<Class> {
+        let (idx, class) = classes
+            .into_iter()
+            .find(|(idx, _)| self.backends[*idx].supports_device_copy())?;
+
+        // importing requires EXTERNAL
+        let class = if desc.flags.contains(Flags::EXTERNAL) {
+            class
+        } else {
+            let desc = desc.flags(desc.flags | Flags::EXTERNAL);
+            self.backend_classify(idx, desc, usage[idx]).ok()?
+        };
+
+        Some(class.backend_index(idx))
+    }
+
     /// Returns the supported modifiers of a BO class.
     ///
     /// If the BO class is for a buffer, there is no modifier and the returned slice is empty.
     /// Otherwise, the returned slice is non-empty.
     ///
+    /// The modifiers are supported by all backends used by the BO class, and are sorted by
+    /// preference.  Compressed modifiers, such as AFBC, DCC, and CCS, come first to save memory
+    /// bandwidth, followed by other tiled modifiers and then `DRM_FORMAT_MOD_LINEAR`.  Compressed
+    /// modifiers are never returned when `Flags::NO_COMPRESSION` is set.
+    ///
     /// If HBM supports modifiers, `DRM_FORMAT_MOD_INVALID` is never returned.
     ///
     /// If HBM does not support modifiers, only `DRM_FORMAT_MOD_INVALID` and/or
@@ -143,9 +204,29 @@ impl Device {
         &class.modifiers
     }
 
+    /// Returns the statistics of the backends, in the order the backends were added.
+    ///
+    /// The statistics are cumulative since the device was built, except for the live BOs.
+    pub fn stats(&self) -> Vec<BackendStats> {
+        self.counters.iter().map(Counters::snapshot).collect()
+    }
+
+    /// Frees the resources that the backends keep for recycling, such as idle imports.
+    ///
+    /// BOs are not affected.  This can be called when the system is low on memory.
+    pub fn trim(&self) {
+        for backend in &self.backends {
+            backend.trim();
+        }
+    }
+
     pub(crate) fn backend(&self, idx: usize) -> &dyn Backend {
         self.backends[idx].as_ref()
     }
+
+    pub(crate) fn counters(&self, idx: usize) -> &Counters {
+        &self.counters[idx]
+    }
 }
 
 /// A device builder.
@@ -177,8 +258,10 @@ impl Builder {
             return Error::user();
         }
 
+        let counters = self.backends.iter().map(|_| Default::default()).collect();
         let dev = Device {
             backends: self.backends,
+            counters,
         };
 
         Ok(Arc::new(dev))
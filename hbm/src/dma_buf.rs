@@ -6,20 +6,25 @@
 //! This module provides high-level helpers that backends can use to work with dma-bufs.
 
 use super::backends::{
-    Class, Constraint, Description, Extent, Flags, Handle, HandlePayload, Layout, MemoryType, Usage,
+    Class, Constraint, CopyBuffer, CopyBufferImage, Description, Extent, Flags, Handle,
+    HandlePayload, Layout, MemoryType, Usage,
 };
-use super::types::{Access, Error, Mapping, Result, Size};
+use super::copy;
+use super::types::{Access, Error, Format, Mapping, Result, Size};
 use super::utils;
 use std::os::fd::{BorrowedFd, OwnedFd};
+use std::ptr;
 
 pub struct Resource {
+    format: Format,
     layout: Layout,
     dmabuf: Option<OwnedFd>,
 }
 
 impl Resource {
-    pub fn new(layout: Layout) -> Self {
+    pub fn new(format: Format, layout: Layout) -> Self {
         Self {
+            format,
             layout,
             dmabuf: None,
         }
@@ -65,8 +70,8 @@ pub fn classify(desc: Description, usage: Usage) -> Result<Class> {
     let mut class = Class::new(desc)
         .usage(usage)
         .max_extent(Extent::max_supported(&desc));
-    if desc.is_buffer() {
-        class = class.modifiers(vec![desc.modifier]);
+    if !desc.is_buffer() {
+        class = class.modifiers([desc.modifier].into_iter().collect());
     }
 
     Ok(class)
@@ -74,7 +79,7 @@ pub fn classify(desc: Description, usage: Usage) -> Result<Class> {
 
 pub fn with_constraint(class: &Class, extent: Extent, con: Option<Constraint>) -> Result<Handle> {
     let layout = Layout::packed(class, extent, con)?;
-    let handle = Handle::from(Resource::new(layout));
+    let handle = Handle::from(Resource::new(class.format, layout));
 
     Ok(handle)
 }
@@ -93,7 +98,7 @@ pub fn with_layout(
         return Error::user();
     }
 
-    let handle = Handle::from(Resource::new(layout));
+    let handle = Handle::from(Resource::new(class.format, layout));
 
     Ok(handle)
 }
@@ -156,11 +161,9 @@ pub fn export_dma_buf(handle: &Handle, name: Option<&str>) -> Result<OwnedFd> {
     Ok(dmabuf)
 }
 
-pub fn map(handle: &Handle) -> Result<Mapping> {
+pub fn map(handle: &Handle, offset: Size, size: Size, access: Access) -> Result<Mapping> {
     let dmabuf = get_resource(handle).dmabuf();
-
-    let len = utils::seek_end(dmabuf)?;
-    let mapping = utils::mmap(dmabuf, len, Access::ReadWrite)?;
+    let mapping = utils::mmap(dmabuf, offset, size, access)?;
 
     Ok(mapping)
 }
@@ -172,30 +175,129 @@ pub fn unmap(_handle: &Handle, mapping: Mapping) {
 // utils::dma_buf_sync is supposed to be used as follows
 //
 //  - utils::dma_buf_sync(dmabuf, access, true)
-//  - cpu access with the specified access type
-//  - utils::dma_buf_sync(dmabuf, access, false)
-//
-// But for our purposes, we assume it works as follows
-//
-//  - utils::dma_buf_sync(dmabuf, access, true)
 //    - waits for the implicit fences (if any)
 //    - makes sure device writes are available in the cpu domain (if any)
 //    - Access::Read further invalidates the cpu cache
+//  - cpu access with the specified access type
 //  - utils::dma_buf_sync(dmabuf, access, false)
 //    - Access::Write flushes the cpu cache and makes sure cpu writes are available in the device
 //      domain
 //
-// and abuse it for flush/invalidate.  This is incorrect, but we don't really use
-// utils::dma_buf_sync yet anyway.
+// begin_cpu_access and end_cpu_access follow that.  Standalone flushes and invalidations only
+// do the halves that matter.
+//
+// DMA_BUF_IOCTL_SYNC has no range.  Ranged flushes and invalidations cover the entire dma-buf.
 
-pub fn flush(handle: &Handle) {
+pub fn begin_cpu_access(handle: &Handle, access: Access) {
     let dmabuf = get_resource(handle).dmabuf();
 
-    let _ = utils::dma_buf_sync(dmabuf, Access::ReadWrite, false);
+    let _ = utils::dma_buf_sync(dmabuf, access, true);
 }
 
-pub fn invalidate(handle: &Handle) {
+pub fn end_cpu_access(handle: &Handle, access: Access) {
     let dmabuf = get_resource(handle).dmabuf();
 
-    let _ = utils::dma_buf_sync(dmabuf, Access::ReadWrite, true);
+    let _ = utils::dma_buf_sync(dmabuf, access, false);
+}
+
+pub fn flush(handle: &Handle, _offset: Size, _size: Size) {
+    end_cpu_access(handle, Access::Write);
+}
+
+pub fn invalidate(handle: &Handle, _offset: Size, _size: Size) {
+    begin_cpu_access(handle, Access::Read);
+}
+
+// a range of a dma-buf that is mapped and under CPU access for a CPU copy
+struct CopyMapping<'a> {
+    dmabuf: &'a OwnedFd,
+    mapping: Mapping,
+    access: Access,
+}
+
+impl<'a> CopyMapping<'a> {
+    fn new(res: &'a Resource, range: (Size, Size), access: Access) -> Result<Self> {
+        let dmabuf = res.dmabuf();
+        let mapping = utils::mmap(dmabuf, range.0, range.1, access)?;
+        let _ = utils::dma_buf_sync(dmabuf, access, true);
+
+        Ok(Self {
+            dmabuf,
+            mapping,
+            access,
+        })
+    }
+}
+
+impl Drop for CopyMapping<'_> {
+    fn drop(&mut self) {
+        let _ = utils::dma_buf_sync(self.dmabuf, self.access, false);
+        let _ = utils::munmap(self.mapping);
+    }
+}
+
+fn wait_sync_fd(sync_fd: Option<OwnedFd>) -> Result<()> {
+    if let Some(sync_fd) = sync_fd {
+        utils::poll(sync_fd, Access::Read)?;
+    }
+
+    Ok(())
+}
+
+// Copies between two dma-buf resources that are both buffers with the CPU.  The copy is
+// complete when this returns.
+pub fn copy_buffer(
+    dst: &Handle,
+    src: &Handle,
+    copy: CopyBuffer,
+    sync_fd: Option<OwnedFd>,
+) -> Result<Option<OwnedFd>> {
+    // src and dst must not overlap
+    if ptr::eq(dst, src) {
+        return Error::unsupported();
+    }
+
+    wait_sync_fd(sync_fd)?;
+
+    let size = usize::try_from(copy.size)?;
+    let dst = CopyMapping::new(
+        get_resource(dst),
+        (copy.dst_offset, copy.size),
+        Access::Write,
+    )?;
+    let src = CopyMapping::new(
+        get_resource(src),
+        (copy.src_offset, copy.size),
+        Access::Read,
+    )?;
+    copy::copy_buffer(&dst.mapping, &src.mapping, size);
+
+    Ok(None)
+}
+
+// Copies between two dma-buf resources where one is a buffer and one is a linear image with the
+// CPU.  The copy is complete when this returns.
+pub fn copy_buffer_image(
+    dst: &Handle,
+    src: &Handle,
+    copy: CopyBufferImage,
+    sync_fd: Option<OwnedFd>,
+) -> Result<Option<OwnedFd>> {
+    let dst = get_resource(dst);
+    let src = get_resource(src);
+
+    let to_buffer = dst.format.is_invalid();
+    let img = if to_buffer { src } else { dst };
+    let Some(params) = copy::BufferImageParams::new(img.format, &img.layout, &copy, to_buffer)
+    else {
+        return Error::unsupported();
+    };
+
+    wait_sync_fd(sync_fd)?;
+
+    let dst = CopyMapping::new(dst, params.dst_range, params.dst_access())?;
+    let src = CopyMapping::new(src, params.src_range, Access::Read)?;
+    copy::copy_buffer_image(&dst.mapping, &src.mapping, &params);
+
+    Ok(None)
 }
@@ -57,6 +57,32 @@ mod consts {
     pub const DRM_FORMAT_MOD_INVALID: u64 =
         fourcc_mod_code!(DRM_FORMAT_MOD_VENDOR_NONE, DRM_FORMAT_RESERVED);
     pub const DRM_FORMAT_MOD_LINEAR: u64 = fourcc_mod_code!(DRM_FORMAT_MOD_VENDOR_NONE, 0);
+
+    pub const DRM_FORMAT_MOD_VENDOR_INTEL: u64 = 0x01;
+    pub const DRM_FORMAT_MOD_VENDOR_AMD: u64 = 0x02;
+    pub const DRM_FORMAT_MOD_VENDOR_NVIDIA: u64 = 0x03;
+    pub const DRM_FORMAT_MOD_VENDOR_QCOM: u64 = 0x05;
+    pub const DRM_FORMAT_MOD_VENDOR_ARM: u64 = 0x08;
+    pub const DRM_FORMAT_MOD_VENDOR_AMLOGIC: u64 = 0x0a;
+
+    // the CCS modifiers of I915_FORMAT_MOD_*, from Y_TILED_CCS to 4_TILED_BMG_CCS
+    pub const I915_FORMAT_MOD_CCS_CODES: [u64; 13] =
+        [4, 5, 6, 7, 8, 10, 11, 12, 13, 14, 15, 16, 17];
+
+    pub const AMD_FMT_MOD_DCC_SHIFT: u64 = 13;
+
+    pub const NVIDIA_BLOCK_LINEAR_2D: u64 = 0x10;
+    pub const NVIDIA_COMPRESSION_SHIFT: u64 = 23;
+    pub const NVIDIA_COMPRESSION_MASK: u64 = 0x7;
+
+    pub const DRM_FORMAT_MOD_QCOM_COMPRESSED: u64 = 0x1;
+    pub const DRM_FORMAT_MOD_QCOM_TILED2: u64 = 0x2;
+    pub const DRM_FORMAT_MOD_QCOM_TILED3: u64 = 0x3;
+
+    pub const DRM_FORMAT_MOD_ARM_TYPE_SHIFT: u64 = 52;
+    pub const DRM_FORMAT_MOD_ARM_TYPE_MASK: u64 = 0xf;
+    pub const DRM_FORMAT_MOD_ARM_TYPE_AFBC: u64 = 0x00;
+    pub const DRM_FORMAT_MOD_ARM_TYPE_AFRC: u64 = 0x02;
 }
 
 pub const INVALID: Format = Format(consts::DRM_FORMAT_INVALID);
@@ -93,6 +119,45 @@ pub const KNOWN_FORMATS: [Format; 24] = [
     Format(consts::DRM_FORMAT_YVU420),
 ];
 
+// Returns true if a modifier is known to compress, such as AFBC, DCC, and CCS.
+pub fn is_compressed_modifier(modifier: Modifier) -> bool {
+    let vendor = modifier.0 >> 56;
+    let val = modifier.0 & ((1 << 56) - 1);
+
+    match vendor {
+        consts::DRM_FORMAT_MOD_VENDOR_INTEL => consts::I915_FORMAT_MOD_CCS_CODES.contains(&val),
+        consts::DRM_FORMAT_MOD_VENDOR_AMD => (val >> consts::AMD_FMT_MOD_DCC_SHIFT) & 1 != 0,
+        consts::DRM_FORMAT_MOD_VENDOR_NVIDIA => {
+            val & consts::NVIDIA_BLOCK_LINEAR_2D != 0
+                && (val >> consts::NVIDIA_COMPRESSION_SHIFT) & consts::NVIDIA_COMPRESSION_MASK != 0
+        }
+        // QCOM modifiers are enumerated rather than bitfields
+        consts::DRM_FORMAT_MOD_VENDOR_QCOM => val == consts::DRM_FORMAT_MOD_QCOM_COMPRESSED,
+        consts::DRM_FORMAT_MOD_VENDOR_ARM => {
+            let ty = (val >> consts::DRM_FORMAT_MOD_ARM_TYPE_SHIFT)
+                & consts::DRM_FORMAT_MOD_ARM_TYPE_MASK;
+            ty == consts::DRM_FORMAT_MOD_ARM_TYPE_AFBC || ty == consts::DRM_FORMAT_MOD_ARM_TYPE_AFRC
+        }
+        // all Amlogic modifiers are FBC
+        consts::DRM_FORMAT_MOD_VENDOR_AMLOGIC => true,
+        _ => false,
+    }
+}
+
+// Returns the preference rank of a modifier.  Higher is better.
+//
+// Compressed modifiers save memory bandwidth and are preferred over other tiled modifiers, which
+// are in turn preferred over linear.
+pub fn modifier_rank(modifier: Modifier) -> u32 {
+    if is_compressed_modifier(modifier) {
+        2
+    } else if modifier.is_linear() {
+        0
+    } else {
+        1
+    }
+}
+
 pub fn fourcc(fmt: Format) -> String {
     let bytes = fmt.0.to_le_bytes();
     if let Ok(s) = str::from_utf8(&bytes) {
@@ -344,6 +409,36 @@ mod tests {
         assert_eq!(consts::DRM_FORMAT_MOD_LINEAR, 0);
     }
 
+    #[test]
+    fn test_modifier_rank() {
+        // I915_FORMAT_MOD_Y_TILED and I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS
+        let y_tiled = Modifier((consts::DRM_FORMAT_MOD_VENDOR_INTEL << 56) | 2);
+        let y_tiled_ccs = Modifier((consts::DRM_FORMAT_MOD_VENDOR_INTEL << 56) | 6);
+        // AMD GFX9 64K_S_X with and without DCC
+        let amd = Modifier((consts::DRM_FORMAT_MOD_VENDOR_AMD << 56) | (25 << 8) | 1);
+        let amd_dcc = Modifier(amd.0 | (1 << consts::AMD_FMT_MOD_DCC_SHIFT));
+        // DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_BLOCK_SIZE_16x16)
+        let afbc = Modifier((consts::DRM_FORMAT_MOD_VENDOR_ARM << 56) | 1);
+        // DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED
+        let arm_misc = Modifier((consts::DRM_FORMAT_MOD_VENDOR_ARM << 56) | (1 << 52) | 1);
+        // DRM_FORMAT_MOD_QCOM_COMPRESSED, DRM_FORMAT_MOD_QCOM_TILED2, and
+        // DRM_FORMAT_MOD_QCOM_TILED3
+        let qcom = |val| Modifier((consts::DRM_FORMAT_MOD_VENDOR_QCOM << 56) | val);
+        let ubwc = qcom(consts::DRM_FORMAT_MOD_QCOM_COMPRESSED);
+        let tiled2 = qcom(consts::DRM_FORMAT_MOD_QCOM_TILED2);
+        let tiled3 = qcom(consts::DRM_FORMAT_MOD_QCOM_TILED3);
+
+        for modifier in [y_tiled_ccs, amd_dcc, afbc, ubwc] {
+            assert!(super::is_compressed_modifier(modifier));
+            assert_eq!(super::modifier_rank(modifier), 2);
+        }
+        for modifier in [y_tiled, amd, arm_misc, tiled2, tiled3, MOD_INVALID] {
+            assert!(!super::is_compressed_modifier(modifier));
+            assert_eq!(super::modifier_rank(modifier), 1);
+        }
+        assert_eq!(super::modifier_rank(MOD_LINEAR), 0);
+    }
+
     #[test]
     fn test_fourcc() {
         assert_eq!(super::fourcc(R8), String::from("'R8  '"));
@@ -15,15 +15,21 @@
 
 mod backends;
 mod bo;
+mod bo_cache;
+mod cache;
+mod copy;
 mod device;
 mod dma_buf;
 mod formats;
 #[cfg(feature = "ash")]
 mod sash;
+mod stats;
 mod types;
 mod utils;
 
 pub use backends::*;
 pub use bo::*;
+pub use bo_cache::*;
 pub use device::*;
+pub use stats::*;
 pub use types::*;
@@ -6,22 +6,32 @@
 //! This module provides a safe allocator using ash.
 
 use super::backends::{Constraint, CopyBufferImage, Layout};
+use super::cache;
 use super::formats;
-use super::types::{Error, Modifier, Result};
+use super::stats;
+use super::types::{Access, Error, Modifier, ModifierSet, Result};
 use super::utils;
 use ash::vk;
-use std::collections::HashMap;
+use std::cell::RefCell;
+use std::collections::{HashMap, VecDeque};
 use std::os::fd::{AsFd, AsRawFd, BorrowedFd, FromRawFd, IntoRawFd, OwnedFd, RawFd};
-use std::sync::{atomic, Arc, Mutex};
-use std::{cmp, ffi, ptr, slice, thread};
+use std::path::Path;
+use std::sync::{atomic, Arc, Mutex, RwLock, Weak};
+use std::{cmp, ffi, ptr, slice};
 
 const REQUIRED_API_VERSION: u32 = vk::API_VERSION_1_1;
 
-// TODO VK_KHR_external_semaphore_fd
+// max number of in-flight command buffers per thread
+const PER_THREAD_CMD_COUNT: usize = 4;
+
+// max number of queues to create
+const MAX_QUEUE_COUNT: u32 = 4;
+
 #[derive(Clone, Copy)]
 enum ExtId {
     KhrDriverProperties,
     KhrExternalMemoryFd,
+    KhrExternalSemaphoreFd,
     KhrImageFormatList,
     KhrMaintenance4,
     ExtExternalMemoryDmaBuf,
@@ -36,6 +46,7 @@ enum ExtId {
 const EXT_TABLE: [(ExtId, &ffi::CStr, bool); ExtId::Count as usize] = [
     (ExtId::KhrDriverProperties,        ash::khr::driver_properties::NAME,          false),
     (ExtId::KhrExternalMemoryFd,        ash::khr::external_memory_fd::NAME,         true),
+    (ExtId::KhrExternalSemaphoreFd,     ash::khr::external_semaphore_fd::NAME,      false),
     (ExtId::KhrImageFormatList,         ash::khr::image_format_list::NAME,          false),
     (ExtId::KhrMaintenance4,            ash::khr::maintenance4::NAME,               true),
     (ExtId::ExtExternalMemoryDmaBuf,    ash::ext::external_memory_dma_buf::NAME,    true),
@@ -243,22 +254,37 @@ struct FormatProperties {
 #[derive(Default)]
 struct PhysicalDeviceProperties {
     ext_image_drm_format_modifier: bool,
+    khr_external_semaphore_fd: bool,
 
     driver_id: vk::DriverId,
+    // the format cache is keyed by these
+    cache_name: String,
+    cache_key: String,
+
     max_image_dimension_2d: u32,
     max_uniform_buffer_range: u32,
     max_storage_buffer_range: u32,
     max_buffer_size: vk::DeviceSize,
+    non_coherent_atom_size: vk::DeviceSize,
 
     protected_memory: bool,
     image_compression_control: bool,
 
+    // this is transfer-only when there is a dedicated transfer queue family
     queue_family: u32,
+    queue_count: u32,
+    queue_family_transfer_only: bool,
+    // this supports graphics or compute, for copies that a transfer-only queue family cannot do
+    fallback_queue_family: Option<u32>,
+
     memory_types: Vec<vk::MemoryPropertyFlags>,
 
-    formats: HashMap<vk::Format, FormatProperties>,
+    // Formats are probed lazily and memoized.  None means the format is unsupported.
+    formats: RwLock<HashMap<vk::Format, Option<Arc<FormatProperties>>>>,
 
     external_memory_type: vk::ExternalMemoryHandleTypeFlags,
+    sync_fd_export: bool,
+    sync_fd_import: bool,
 }
 
 struct PhysicalDevice {
@@ -273,6 +299,7 @@ impl PhysicalDevice {
         instance: Instance,
         dev_idx: Option<usize>,
         dev_id: Option<u64>,
+        cache_dir: Option<&Path>,
     ) -> Result<(Self, DeviceCreateInfo)> {
         let mut physical_dev = Self {
             instance,
@@ -280,12 +307,17 @@ impl PhysicalDevice {
             properties: Default::default(),
         };
 
-        let dev_info = physical_dev.init(dev_idx, dev_id)?;
+        let dev_info = physical_dev.init(dev_idx, dev_id, cache_dir)?;
 
         Ok((physical_dev, dev_info))
     }
 
-    fn init(&mut self, dev_idx: Option<usize>, dev_id: Option<u64>) -> Result<DeviceCreateInfo> {
+    fn init(
+        &mut self,
+        dev_idx: Option<usize>,
+        dev_id: Option<u64>,
+        cache_dir: Option<&Path>,
+    ) -> Result<DeviceCreateInfo> {
         // SAFETY: no VUID violation
         let handles = unsafe { self.instance.handle.enumerate_physical_devices() }
             .or(Error::ctx("failed to enumerate devices"))?;
@@ -297,7 +329,7 @@ impl PhysicalDevice {
                 }
             }
 
-            self.probe(handle, dev_id).ok()
+            self.probe(handle, dev_id, cache_dir).ok()
         });
 
         dev_info.ok_or(Error::Context("failed to find any device"))
@@ -307,6 +339,7 @@ impl PhysicalDevice {
         &mut self,
         handle: vk::PhysicalDevice,
         dev_id: Option<u64>,
+        cache_dir: Option<&Path>,
     ) -> Result<DeviceCreateInfo> {
         // reset handle and properties
         self.handle = handle;
@@ -318,9 +351,10 @@ impl PhysicalDevice {
         self.probe_features();
         self.probe_queue_families()?;
         self.probe_memory_types();
-        self.probe_formats();
+        self.probe_formats(cache_dir);
 
         self.probe_external_memory();
+        self.probe_external_semaphore();
 
         Ok(dev_info)
     }
@@ -359,6 +393,8 @@ impl PhysicalDevice {
 
         self.properties.ext_image_drm_format_modifier =
             dev_info.extensions[ExtId::ExtImageDrmFormatModifier as usize];
+        self.properties.khr_external_semaphore_fd =
+            dev_info.extensions[ExtId::KhrExternalSemaphoreFd as usize];
 
         Ok(())
     }
@@ -366,9 +402,11 @@ impl PhysicalDevice {
     fn probe_properties(&mut self, dev_id: Option<u64>) -> Result<()> {
         let mut maint4_props = vk::PhysicalDeviceMaintenance4Properties::default();
         let mut drv_props = vk::PhysicalDeviceDriverProperties::default();
+        let mut id_props = vk::PhysicalDeviceIDProperties::default();
         let mut props = vk::PhysicalDeviceProperties2::default()
             .push_next(&mut maint4_props)
-            .push_next(&mut drv_props);
+            .push_next(&mut drv_props)
+            .push_next(&mut id_props);
 
         let mut drm_props = vk::PhysicalDeviceDrmPropertiesEXT::default();
         if dev_id.is_some() {
@@ -391,6 +429,18 @@ impl PhysicalDevice {
 
         self.properties.driver_id = drv_props.driver_id;
 
+        let driver_uuid: String = id_props
+            .driver_uuid
+            .iter()
+            .map(|byte| format!("{:02x}", byte))
+            .collect();
+        self.properties.cache_name =
+            format!("vulkan-{:04x}-{:04x}", props.vendor_id, props.device_id);
+        self.properties.cache_key = format!(
+            "{} {} {}",
+            driver_uuid, props.driver_version, self.properties.ext_image_drm_format_modifier as u32
+        );
+
         if !self.properties.ext_image_drm_format_modifier {
             // If we have to go ahead without VK_EXT_image_drm_format_modifier,
             //
@@ -418,6 +468,7 @@ impl PhysicalDevice {
         self.properties.max_uniform_buffer_range = limits.max_uniform_buffer_range;
         self.properties.max_storage_buffer_range = limits.max_storage_buffer_range;
         self.properties.max_buffer_size = maint4_props.max_buffer_size;
+        self.properties.non_coherent_atom_size = limits.non_coherent_atom_size;
 
         Ok(())
     }
@@ -453,21 +504,34 @@ impl PhysicalDevice {
             height: 1,
             depth: 1,
         };
-        let required_flags = vk::QueueFlags::TRANSFER;
+        let general_flags = vk::QueueFlags::GRAPHICS | vk::QueueFlags::COMPUTE;
+        // graphics and compute queues support transfers implicitly
+        let can_transfer = |props: &vk::QueueFamilyProperties| {
+            props.min_image_transfer_granularity == required_granularity
+                && props
+                    .queue_flags
+                    .intersects(general_flags | vk::QueueFlags::TRANSFER)
+        };
 
-        self.properties.queue_family = props_list
-            .into_iter()
-            .enumerate()
-            .find_map(|(idx, props)| {
-                if props.min_image_transfer_granularity == required_granularity
-                    && props.queue_flags.contains(required_flags)
-                {
-                    Some(idx as u32)
-                } else {
-                    None
-                }
-            })
-            .ok_or(Error::Unsupported)?;
+        let general = props_list
+            .iter()
+            .position(|props| can_transfer(props) && props.queue_flags.intersects(general_flags));
+        // prefer a dedicated transfer queue family, which is likely backed by a dma engine
+        let dedicated = props_list
+            .iter()
+            .position(|props| can_transfer(props) && !props.queue_flags.intersects(general_flags));
+
+        let (queue_family, fallback_queue_family) = match (dedicated, general) {
+            (Some(dedicated), general) => (dedicated, general),
+            (None, Some(general)) => (general, None),
+            (None, None) => return Error::unsupported(),
+        };
+
+        self.properties.queue_family = queue_family as u32;
+        self.properties.queue_count =
+            cmp::min(props_list[queue_family].queue_count, MAX_QUEUE_COUNT);
+        self.properties.queue_family_transfer_only = dedicated.is_some();
+        self.properties.fallback_queue_family = fallback_queue_family.map(|idx| idx as u32);
 
         Ok(())
     }
@@ -559,32 +623,176 @@ impl PhysicalDevice {
         }
     }
 
-    fn probe_formats(&mut self) {
-        for drm_fmt in formats::KNOWN_FORMATS {
-            /* some drm formats cannot be mapped */
-            let fmt = formats::to_vk(drm_fmt);
-            if fmt.is_err() {
-                continue;
-            }
+    fn probe_formats(&mut self, cache_dir: Option<&Path>) {
+        // without a cache, formats are probed by format_properties on demand
+        let Some(cache_dir) = cache_dir else {
+            return;
+        };
+
+        self.load_formats(cache_dir);
+
+        // Probe the known formats that the cache misses, and store the cache now rather than at
+        // teardown, which short-lived processes often skip.  All formats with format classes are
+        // known formats, so format_properties never probes afterward.
+        let fmts = self.properties.formats.get_mut().unwrap();
+        let mut missed: Vec<vk::Format> = formats::KNOWN_FORMATS
+            .into_iter()
+            .filter_map(|drm_fmt| formats::to_vk(drm_fmt).ok())
+            .map(|(fmt, _)| fmt)
+            .filter(|fmt| !fmts.contains_key(fmt))
+            .collect();
+        if missed.is_empty() {
+            return;
+        }
+
+        // some drm formats map to the same vk formats
+        missed.sort();
+        missed.dedup();
+        for fmt in missed {
+            let fmt_props = self.probe_format(fmt).map(Arc::new);
+            self.properties
+                .formats
+                .get_mut()
+                .unwrap()
+                .insert(fmt, fmt_props);
+        }
+
+        self.store_formats(cache_dir);
+    }
 
-            /* some drm formats map to the same vk formats */
-            let fmt = fmt.unwrap().0;
-            if self.properties.formats.contains_key(&fmt) {
-                continue;
+    fn format_class(fmt: vk::Format) -> Option<&'static formats::FormatClass> {
+        // some drm formats map to the same vk formats, with the same format classes
+        formats::KNOWN_FORMATS.into_iter().find_map(|drm_fmt| {
+            let (vk_fmt, _) = formats::to_vk(drm_fmt).ok()?;
+            if vk_fmt == fmt {
+                formats::format_class(drm_fmt).ok()
+            } else {
+                None
             }
+        })
+    }
 
-            let fmt_class = formats::format_class(drm_fmt).unwrap();
-            let mods = self.get_format_properties(fmt, fmt_class.plane_count as u32);
-            if mods.is_empty() {
-                continue;
+    fn probe_format(&self, fmt: vk::Format) -> Option<FormatProperties> {
+        let fmt_class = Self::format_class(fmt)?;
+        let mods = self.get_format_properties(fmt, fmt_class.plane_count as u32);
+        if mods.is_empty() {
+            return None;
+        }
+
+        let fmt_props = FormatProperties {
+            format_class: fmt_class,
+            modifiers: mods,
+        };
+
+        Some(fmt_props)
+    }
+
+    fn format_properties(&self, fmt: vk::Format) -> Option<Arc<FormatProperties>> {
+        if let Some(fmt_props) = self.properties.formats.read().unwrap().get(&fmt) {
+            return fmt_props.clone();
+        }
+
+        // two threads can probe the same format, which is harmless
+        let fmt_props = self.probe_format(fmt).map(Arc::new);
+        self.properties
+            .formats
+            .write()
+            .unwrap()
+            .entry(fmt)
+            .or_insert(fmt_props)
+            .clone()
+    }
+
+    // Each cache entry is "<vk format> <modifier> <plane count> <tiling features>", or
+    // "<vk format>" when the format is unsupported.
+    fn parse_format_entry(
+        entry: &str,
+    ) -> Option<(vk::Format, Option<vk::DrmFormatModifierPropertiesEXT>)> {
+        let mut vals = entry.split_whitespace().map(|val| val.parse::<u64>().ok());
+        let mut next_val = || vals.next().flatten();
+
+        let fmt = vk::Format::from_raw(i32::try_from(next_val()?).ok()?);
+        let Some(modifier) = next_val() else {
+            return Some((fmt, None));
+        };
+        let mod_props = vk::DrmFormatModifierPropertiesEXT {
+            drm_format_modifier: modifier,
+            drm_format_modifier_plane_count: u32::try_from(next_val()?).ok()?,
+            drm_format_modifier_tiling_features: vk::FormatFeatureFlags::from_raw(
+                u32::try_from(next_val()?).ok()?,
+            ),
+        };
+
+        Some((fmt, Some(mod_props)))
+    }
+
+    fn load_formats(&mut self, cache_dir: &Path) {
+        let props = &self.properties;
+        let Some(entries) = cache::load(cache_dir, &props.cache_name, &props.cache_key) else {
+            return;
+        };
+
+        let mut cached: HashMap<vk::Format, Vec<vk::DrmFormatModifierPropertiesEXT>> =
+            HashMap::new();
+        for entry in entries {
+            let Some((fmt, mod_props)) = Self::parse_format_entry(&entry) else {
+                return;
+            };
+            let mods = cached.entry(fmt).or_default();
+            if let Some(mod_props) = mod_props {
+                mods.push(mod_props);
             }
+        }
+
+        let mut fmts = HashMap::new();
+        for (fmt, mods) in cached {
+            let Some(fmt_class) = Self::format_class(fmt) else {
+                return;
+            };
 
-            let fmt_props = FormatProperties {
-                format_class: fmt_class,
-                modifiers: mods,
+            let fmt_props = if mods.is_empty() {
+                None
+            } else {
+                Some(Arc::new(FormatProperties {
+                    format_class: fmt_class,
+                    modifiers: mods,
+                }))
             };
-            self.properties.formats.insert(fmt, fmt_props);
+            fmts.insert(fmt, fmt_props);
         }
+
+        self.properties.formats = RwLock::new(fmts);
+    }
+
+    fn store_formats(&self, cache_dir: &Path) {
+        let props = &self.properties;
+        let entries: Vec<String> = props
+            .formats
+            .read()
+            .unwrap()
+            .iter()
+            .flat_map(|(fmt, fmt_props)| {
+                let entries: Vec<String> = match fmt_props {
+                    Some(fmt_props) => fmt_props
+                        .modifiers
+                        .iter()
+                        .map(|mod_props| {
+                            format!(
+                                "{} {} {} {}",
+                                fmt.as_raw(),
+                                mod_props.drm_format_modifier,
+                                mod_props.drm_format_modifier_plane_count,
+                                mod_props.drm_format_modifier_tiling_features.as_raw()
+                            )
+                        })
+                        .collect(),
+                    None => vec![format!("{}", fmt.as_raw())],
+                };
+                entries
+            })
+            .collect();
+
+        cache::store(cache_dir, &props.cache_name, &props.cache_key, &entries);
     }
 
     fn probe_external_memory(&mut self) {
@@ -595,6 +803,33 @@ impl PhysicalDevice {
             vk::ExternalMemoryHandleTypeFlags::OPAQUE_FD
         };
     }
+
+    fn probe_external_semaphore(&mut self) {
+        if !self.properties.khr_external_semaphore_fd {
+            return;
+        }
+
+        let external_info = vk::PhysicalDeviceExternalSemaphoreInfo::default()
+            .handle_type(vk::ExternalSemaphoreHandleTypeFlags::SYNC_FD);
+        let mut external_props = vk::ExternalSemaphoreProperties::default();
+
+        // SAFETY: no VUID violation
+        unsafe {
+            self.instance
+                .handle
+                .get_physical_device_external_semaphore_properties(
+                    self.handle,
+                    &external_info,
+                    &mut external_props,
+                );
+        }
+
+        let feats = external_props.external_semaphore_features;
+        self.properties.sync_fd_export =
+            feats.contains(vk::ExternalSemaphoreFeatureFlags::EXPORTABLE);
+        self.properties.sync_fd_import =
+            feats.contains(vk::ExternalSemaphoreFeatureFlags::IMPORTABLE);
+    }
 }
 
 pub struct BufferInfo {
@@ -618,7 +853,7 @@ pub struct ImageInfo {
 
 pub struct ImageProperties {
     pub max_extent: u32,
-    pub modifiers: Vec<Modifier>,
+    pub modifiers: ModifierSet,
 }
 
 // this is for scanout hack
@@ -650,6 +885,7 @@ unsafe impl vk::ExtendsImageCreateInfo for WsiImageCreateInfoMESA {}
 
 struct DeviceDispatch {
     memory: ash::khr::external_memory_fd::Device,
+    semaphore: ash::khr::external_semaphore_fd::Device,
     modifier: ash::ext::image_drm_format_modifier::Device,
 }
 
@@ -657,6 +893,8 @@ pub struct Device {
     physical_device: PhysicalDevice,
     handle: ash::Device,
     dispatch: DeviceDispatch,
+
+    memory_pool: Mutex<MemoryPool>,
 }
 
 impl Device {
@@ -665,9 +903,10 @@ impl Device {
         dev_idx: Option<usize>,
         dev_id: Option<u64>,
         debug: bool,
+        cache_dir: Option<&Path>,
     ) -> Result<Arc<Device>> {
         let instance = Instance::new(name, debug)?;
-        let (physical_dev, dev_info) = PhysicalDevice::new(instance, dev_idx, dev_id)?;
+        let (physical_dev, dev_info) = PhysicalDevice::new(instance, dev_idx, dev_id, cache_dir)?;
         let dev = Self::new(physical_dev, dev_info)?;
 
         Ok(Arc::new(dev))
@@ -683,6 +922,7 @@ impl Device {
             physical_device,
             handle,
             dispatch,
+            memory_pool: Default::default(),
         };
 
         Ok(dev)
@@ -694,10 +934,16 @@ impl Device {
     ) -> Result<ash::Device> {
         let props = &physical_dev.properties;
 
-        let queue_prio = 1.0;
-        let queue_info = vk::DeviceQueueCreateInfo::default()
+        let queue_prios = vec![1.0; props.queue_count as usize];
+        let mut queue_infos = vec![vk::DeviceQueueCreateInfo::default()
             .queue_family_index(props.queue_family)
-            .queue_priorities(slice::from_ref(&queue_prio));
+            .queue_priorities(&queue_prios)];
+        if let Some(fallback_queue_family) = props.fallback_queue_family {
+            let queue_info = vk::DeviceQueueCreateInfo::default()
+                .queue_family_index(fallback_queue_family)
+                .queue_priorities(&queue_prios[..1]);
+            queue_infos.push(queue_info);
+        }
 
         let enabled_exts: Vec<*const ffi::c_char> = dev_info
             .extensions
@@ -721,7 +967,7 @@ impl Device {
             .push_next(&mut img_comp_feats);
 
         let dev_info = vk::DeviceCreateInfo::default()
-            .queue_create_infos(slice::from_ref(&queue_info))
+            .queue_create_infos(&queue_infos)
             .enabled_extension_names(&enabled_exts)
             .push_next(&mut feats);
 
@@ -741,11 +987,14 @@ impl Device {
         let instance_handle = &physical_dev.instance.handle;
         DeviceDispatch {
             memory: ash::khr::external_memory_fd::Device::new(instance_handle, handle),
+            semaphore: ash::khr::external_semaphore_fd::Device::new(instance_handle, handle),
             modifier: ash::ext::image_drm_format_modifier::Device::new(instance_handle, handle),
         }
     }
 
     fn destroy(&self) {
+        self.memory_pool.lock().unwrap().destroy(self);
+
         // SAFETY: no VUID violation
         unsafe {
             self.handle.destroy_device(None);
@@ -760,30 +1009,43 @@ impl Device {
         &self.physical_device.properties
     }
 
-    fn get_queue(&self) -> vk::Queue {
-        // SAFETY: queue_family has 1 queue
-        unsafe {
-            self.handle
-                .get_device_queue(self.properties().queue_family, 0)
+    // this returns the queues of queue_family followed by the queue of fallback_queue_family
+    fn get_queues(&self) -> Vec<(u32, vk::Queue)> {
+        let props = self.properties();
+
+        let mut queues: Vec<(u32, u32)> = (0..props.queue_count)
+            .map(|idx| (props.queue_family, idx))
+            .collect();
+        if let Some(fallback_queue_family) = props.fallback_queue_family {
+            queues.push((fallback_queue_family, 0));
         }
+
+        queues
+            .into_iter()
+            .map(|(family, idx)| {
+                // SAFETY: the queue was requested in create_device
+                let handle = unsafe { self.handle.get_device_queue(family, idx) };
+                (family, handle)
+            })
+            .collect()
+    }
+
+    fn format_properties(&self, fmt: vk::Format) -> Option<Arc<FormatProperties>> {
+        self.physical_device.format_properties(fmt)
     }
 
     fn format_plane_count(&self, fmt: vk::Format) -> u32 {
-        let fmt_props = self.properties().formats.get(&fmt).unwrap();
+        let fmt_props = self.format_properties(fmt).unwrap();
         fmt_props.format_class.plane_count as u32
     }
 
     fn format_block_size(&self, fmt: vk::Format, plane: u32) -> u32 {
-        let fmt_props = self.properties().formats.get(&fmt).unwrap();
+        let fmt_props = self.format_properties(fmt).unwrap();
         fmt_props.format_class.block_size[plane as usize] as u32
     }
 
     pub fn memory_plane_count(&self, fmt: vk::Format, modifier: Modifier) -> Result<u32> {
-        let fmt_props = self
-            .properties()
-            .formats
-            .get(&fmt)
-            .ok_or(Error::Unsupported)?;
+        let fmt_props = self.format_properties(fmt).ok_or(Error::Unsupported)?;
 
         fmt_props
             .modifiers
@@ -955,13 +1217,11 @@ impl Device {
         }
 
         let fmt_props = self
-            .properties()
-            .formats
-            .get(&img_info.format)
+            .format_properties(img_info.format)
             .ok_or(Error::Unsupported)?;
 
         // get supported modifiers
-        let mut mods: Vec<Modifier> = fmt_props
+        let mut mods: ModifierSet = fmt_props
             .modifiers
             .iter()
             .filter_map(|mod_props| {
@@ -993,7 +1253,7 @@ impl Device {
 
         // without modifier support, pick optimal when both are supported
         if !self.properties().ext_image_drm_format_modifier && mods.len() > 1 {
-            mods = vec![formats::MOD_INVALID];
+            mods = [formats::MOD_INVALID].into_iter().collect();
         }
 
         let props = ImageProperties {
@@ -1052,6 +1312,10 @@ impl Drop for Device {
 pub struct Memory {
     device: Arc<Device>,
     handle: vk::DeviceMemory,
+    size: vk::DeviceSize,
+
+    // this is set when the memory is a sub-allocation of a pooled memory block
+    suballoc: Option<Suballocation>,
 }
 
 impl Memory {
@@ -1063,9 +1327,37 @@ impl Memory {
         external: bool,
         dmabuf: Option<OwnedFd>,
     ) -> Result<Self> {
-        let handle =
-            Self::allocate_memory(&device, size, mt_idx, dedicated_info, external, dmabuf)?;
-        let mem = Self { device, handle };
+        let handle = Self::allocate_memory(
+            &device,
+            size,
+            mt_idx,
+            Some(dedicated_info),
+            external,
+            dmabuf,
+        )?;
+        let mem = Self {
+            device,
+            handle,
+            size,
+            suballoc: None,
+        };
+
+        Ok(mem)
+    }
+
+    fn with_pooled_buffer(buf: &Buffer, mt_idx: u32) -> Result<Self> {
+        let dev = &buf.device;
+        let (handle, suballoc) = dev
+            .memory_pool
+            .lock()
+            .unwrap()
+            .alloc(dev, mt_idx, buf.size, buf.align)?;
+        let mem = Self {
+            device: dev.clone(),
+            handle,
+            size: suballoc.size,
+            suballoc: Some(suballoc),
+        };
 
         Ok(mem)
     }
@@ -1098,14 +1390,16 @@ impl Memory {
         dev: &Device,
         size: vk::DeviceSize,
         mt_idx: u32,
-        mut dedicated_info: vk::MemoryDedicatedAllocateInfo,
+        mut dedicated_info: Option<vk::MemoryDedicatedAllocateInfo>,
         external: bool,
         dmabuf: Option<OwnedFd>,
     ) -> Result<vk::DeviceMemory> {
         let mut mem_info = vk::MemoryAllocateInfo::default()
             .allocation_size(size)
-            .memory_type_index(mt_idx)
-            .push_next(&mut dedicated_info);
+            .memory_type_index(mt_idx);
+        if let Some(dedicated_info) = dedicated_info.as_mut() {
+            mem_info = mem_info.push_next(dedicated_info);
+        }
 
         let mut export_info = vk::ExportMemoryAllocateInfo::default();
         if external {
@@ -1156,13 +1450,59 @@ impl Memory {
     }
 
     fn destroy(&self) {
+        if let Some(suballoc) = &self.suballoc {
+            self.device
+                .memory_pool
+                .lock()
+                .unwrap()
+                .free(&self.device, suballoc);
+            return;
+        }
+
         // SAFETY: no VUID violation
         unsafe {
             self.device.handle.free_memory(self.handle, None);
         }
     }
 
+    // This converts a range of the memory to a range of the vk::DeviceMemory, aligned to
+    // nonCoherentAtomSize as required by flushes and invalidations.  Suballocations are aligned
+    // to nonCoherentAtomSize and do not share atoms.
+    fn aligned_range(
+        &self,
+        offset: vk::DeviceSize,
+        size: vk::DeviceSize,
+    ) -> (vk::DeviceSize, vk::DeviceSize) {
+        let atom = self.device.properties().non_coherent_atom_size;
+        let base = self.suballoc.map_or(0, |suballoc| suballoc.offset);
+
+        let start = base + offset;
+        let end = cmp::min(start + size, base + self.size);
+        let start = start - start % atom;
+        let end = cmp::min(end.next_multiple_of(atom), base + self.size);
+
+        (start, end - start)
+    }
+
+    // this returns the range of a flush or an invalidation
+    fn mapped_range(
+        &self,
+        offset: vk::DeviceSize,
+        size: vk::DeviceSize,
+    ) -> vk::MappedMemoryRange<'static> {
+        let (offset, size) = self.aligned_range(offset, size);
+
+        vk::MappedMemoryRange::default()
+            .memory(self.handle)
+            .offset(offset)
+            .size(size)
+    }
+
     pub fn export_dma_buf(&self) -> Result<OwnedFd> {
+        if self.suballoc.is_some() {
+            return Error::unsupported();
+        }
+
         let fd_info = vk::MemoryGetFdInfoKHR::default()
             .memory(self.handle)
             .handle_type(self.device.properties().external_memory_type);
@@ -1176,30 +1516,53 @@ impl Memory {
     }
 
     pub fn map(&self, offset: vk::DeviceSize, size: vk::DeviceSize) -> Result<*mut ffi::c_void> {
+        if let Some(suballoc) = &self.suballoc {
+            let block_ptr = self
+                .device
+                .memory_pool
+                .lock()
+                .unwrap()
+                .map(&self.device, suballoc)?;
+            let block_offset = usize::try_from(suballoc.offset + offset)?;
+            // SAFETY: the suballocation is within the persistently mapped block
+            let ptr = unsafe { block_ptr.cast::<u8>().add(block_offset) };
+
+            return Ok(ptr.cast());
+        }
+
+        // map the aligned range such that flushes and invalidations of the range are within the
+        // mapping
+        let (map_offset, map_size) = self.aligned_range(offset, size);
         let flags = vk::MemoryMapFlags::empty();
 
-        // SAFETY: no VUID violation because the caller always maps the entire memory
+        // SAFETY: no VUID violation because the caller maps a valid range and unmaps before
+        // mapping again
         let ptr = unsafe {
             self.device
                 .handle
-                .map_memory(self.handle, offset, size, flags)
+                .map_memory(self.handle, map_offset, map_size, flags)
         }?;
 
-        Ok(ptr)
+        let ptr_offset = usize::try_from(offset - map_offset)?;
+        let ptr = ptr.cast::<u8>().wrapping_add(ptr_offset);
+
+        Ok(ptr.cast())
     }
 
     pub fn unmap(&self) {
+        // pooled memory blocks stay mapped until they are freed
+        if self.suballoc.is_some() {
+            return;
+        }
+
         // SAFETY: no VUID violation
         unsafe { self.device.handle.unmap_memory(self.handle) };
     }
 
     pub fn flush(&self, offset: vk::DeviceSize, size: vk::DeviceSize) {
-        let range = vk::MappedMemoryRange::default()
-            .memory(self.handle)
-            .offset(offset)
-            .size(size);
+        let range = self.mapped_range(offset, size);
 
-        // SAFETY: no VUID violation because the caller always flushes the entire memory
+        // SAFETY: no VUID violation because the caller flushes a range within the mapping
         let _ = unsafe {
             self.device
                 .handle
@@ -1208,12 +1571,9 @@ impl Memory {
     }
 
     pub fn invalidate(&self, offset: vk::DeviceSize, size: vk::DeviceSize) {
-        let range = vk::MappedMemoryRange::default()
-            .memory(self.handle)
-            .offset(offset)
-            .size(size);
+        let range = self.mapped_range(offset, size);
 
-        // SAFETY: no VUID violation because the caller always invalidates the entire memory
+        // SAFETY: no VUID violation because the caller invalidates a range within the mapping
         let _ = unsafe {
             self.device
                 .handle
@@ -1228,12 +1588,220 @@ impl Drop for Memory {
     }
 }
 
+// Small non-external buffers are sub-allocated from memory blocks.  This avoids one
+// vkAllocateMemory per buffer and keeps us below maxMemoryAllocationCount.
+const MEMORY_BLOCK_SIZE: vk::DeviceSize = 4 * 1024 * 1024;
+const MEMORY_POOL_MAX_SIZE: vk::DeviceSize = 256 * 1024;
+
+#[derive(Clone, Copy)]
+struct Suballocation {
+    block_id: u64,
+    offset: vk::DeviceSize,
+    size: vk::DeviceSize,
+}
+
+struct MemoryBlock {
+    id: u64,
+    mt_idx: u32,
+    handle: vk::DeviceMemory,
+
+    // sorted and coalesced (offset, size) pairs
+    free_ranges: Vec<(vk::DeviceSize, vk::DeviceSize)>,
+
+    // this is non-null once the block is mapped, and stays mapped until the block is freed
+    ptr: *mut ffi::c_void,
+}
+
+impl MemoryBlock {
+    fn alloc(&mut self, size: vk::DeviceSize, align: vk::DeviceSize) -> Option<vk::DeviceSize> {
+        // first fit
+        let (idx, offset) = self.free_ranges.iter().enumerate().find_map(
+            |(idx, &(range_offset, range_size))| {
+                let offset = range_offset.next_multiple_of(align);
+                if offset + size <= range_offset + range_size {
+                    Some((idx, offset))
+                } else {
+                    None
+                }
+            },
+        )?;
+
+        let (range_offset, range_size) = self.free_ranges.remove(idx);
+        let range_end = range_offset + range_size;
+        if offset + size < range_end {
+            self.free_ranges
+                .insert(idx, (offset + size, range_end - offset - size));
+        }
+        if range_offset < offset {
+            self.free_ranges
+                .insert(idx, (range_offset, offset - range_offset));
+        }
+
+        Some(offset)
+    }
+
+    fn free(&mut self, offset: vk::DeviceSize, size: vk::DeviceSize) {
+        let idx = self
+            .free_ranges
+            .partition_point(|&(range_offset, _)| range_offset < offset);
+        self.free_ranges.insert(idx, (offset, size));
+
+        let ranges = &mut self.free_ranges;
+        if idx + 1 < ranges.len() && ranges[idx].0 + ranges[idx].1 == ranges[idx + 1].0 {
+            ranges[idx].1 += ranges[idx + 1].1;
+            ranges.remove(idx + 1);
+        }
+        if idx > 0 && ranges[idx - 1].0 + ranges[idx - 1].1 == ranges[idx].0 {
+            ranges[idx - 1].1 += ranges[idx].1;
+            ranges.remove(idx);
+        }
+    }
+
+    fn is_empty(&self) -> bool {
+        self.free_ranges == [(0, MEMORY_BLOCK_SIZE)]
+    }
+}
+
+#[derive(Default)]
+struct MemoryPool {
+    blocks: Vec<MemoryBlock>,
+    next_block_id: u64,
+}
+
+// SAFETY: block mappings are process-wide and are only created or destroyed with the pool locked
+unsafe impl Send for MemoryPool {}
+
+impl MemoryPool {
+    fn alloc(
+        &mut self,
+        dev: &Device,
+        mt_idx: u32,
+        size: vk::DeviceSize,
+        align: vk::DeviceSize,
+    ) -> Result<(vk::DeviceMemory, Suballocation)> {
+        // suballocations must not share atoms, otherwise invalidating one suballocation can
+        // discard unflushed writes to another
+        let atom = dev.properties().non_coherent_atom_size;
+        let align = cmp::max(align, atom);
+        let size = size.next_multiple_of(atom);
+
+        let found = self
+            .blocks
+            .iter_mut()
+            .filter(|block| block.mt_idx == mt_idx)
+            .find_map(|block| {
+                block
+                    .alloc(size, align)
+                    .map(|offset| (block.id, block.handle, offset))
+            });
+        let (block_id, handle, offset) = match found {
+            Some(found) => found,
+            None => {
+                let mut block = self.create_block(dev, mt_idx)?;
+                let offset = block.alloc(size, align).ok_or(Error::Unsupported)?;
+                let found = (block.id, block.handle, offset);
+                self.blocks.push(block);
+
+                found
+            }
+        };
+
+        let suballoc = Suballocation {
+            block_id,
+            offset,
+            size,
+        };
+
+        Ok((handle, suballoc))
+    }
+
+    fn free(&mut self, dev: &Device, suballoc: &Suballocation) {
+        let Some(idx) = self
+            .blocks
+            .iter()
+            .position(|block| block.id == suballoc.block_id)
+        else {
+            return;
+        };
+
+        let block = &mut self.blocks[idx];
+        block.free(suballoc.offset, suballoc.size);
+
+        // keep one empty block per memory type to avoid thrashing
+        let mt_idx = block.mt_idx;
+        if block.is_empty()
+            && self
+                .blocks
+                .iter()
+                .filter(|block| block.mt_idx == mt_idx && block.is_empty())
+                .count()
+                > 1
+        {
+            let block = self.blocks.swap_remove(idx);
+            Self::destroy_block(dev, block);
+        }
+    }
+
+    fn map(&mut self, dev: &Device, suballoc: &Suballocation) -> Result<*mut ffi::c_void> {
+        let block = self
+            .blocks
+            .iter_mut()
+            .find(|block| block.id == suballoc.block_id)
+            .unwrap();
+
+        if block.ptr.is_null() {
+            let flags = vk::MemoryMapFlags::empty();
+
+            // SAFETY: no VUID violation because the entire block is mapped once
+            let ptr = unsafe {
+                dev.handle
+                    .map_memory(block.handle, 0, vk::WHOLE_SIZE, flags)
+            }?;
+            block.ptr = ptr;
+        }
+
+        Ok(block.ptr)
+    }
+
+    fn create_block(&mut self, dev: &Device, mt_idx: u32) -> Result<MemoryBlock> {
+        let handle = Memory::allocate_memory(dev, MEMORY_BLOCK_SIZE, mt_idx, None, false, None)?;
+
+        let id = self.next_block_id;
+        self.next_block_id += 1;
+
+        let block = MemoryBlock {
+            id,
+            mt_idx,
+            handle,
+            free_ranges: vec![(0, MEMORY_BLOCK_SIZE)],
+            ptr: ptr::null_mut(),
+        };
+
+        Ok(block)
+    }
+
+    fn destroy_block(dev: &Device, block: MemoryBlock) {
+        // SAFETY: no VUID violation because all suballocations have been freed
+        unsafe {
+            dev.handle.free_memory(block.handle, None);
+        }
+    }
+
+    fn destroy(&mut self, dev: &Device) {
+        for block in self.blocks.drain(..) {
+            Self::destroy_block(dev, block);
+        }
+    }
+}
+
 pub struct Buffer {
     device: Arc<Device>,
     handle: vk::Buffer,
 
     size: vk::DeviceSize,
+    align: vk::DeviceSize,
     mt_mask: u32,
+    dedicated: bool,
     external: bool,
 
     memory: Option<Memory>,
@@ -1246,7 +1814,9 @@ impl Buffer {
             device,
             handle,
             size: 0,
+            align: 0,
             mt_mask: 0,
+            dedicated: false,
             external: buf_info.external,
             memory: None,
         };
@@ -1318,7 +1888,8 @@ impl Buffer {
 
     fn init_memory_requirements(&mut self) {
         let reqs_info = vk::BufferMemoryRequirementsInfo2::default().buffer(self.handle);
-        let mut reqs = vk::MemoryRequirements2::default();
+        let mut dedicated_reqs = vk::MemoryDedicatedRequirements::default();
+        let mut reqs = vk::MemoryRequirements2::default().push_next(&mut dedicated_reqs);
 
         // SAFETY: no VUID violation
         unsafe {
@@ -1327,9 +1898,16 @@ impl Buffer {
                 .get_buffer_memory_requirements2(&reqs_info, &mut reqs);
         }
 
-        let reqs = reqs.memory_requirements;
-        self.size = reqs.size;
-        self.mt_mask = reqs.memory_type_bits;
+        let mem_reqs = reqs.memory_requirements;
+        self.size = mem_reqs.size;
+        self.align = mem_reqs.alignment;
+        self.mt_mask = mem_reqs.memory_type_bits;
+        self.dedicated = dedicated_reqs.prefers_dedicated_allocation == vk::TRUE
+            || dedicated_reqs.requires_dedicated_allocation == vk::TRUE;
+    }
+
+    fn can_use_memory_pool(&self, dmabuf: &Option<OwnedFd>) -> bool {
+        dmabuf.is_none() && !self.external && !self.dedicated && self.size <= MEMORY_POOL_MAX_SIZE
     }
 
     fn destroy(&self) {
@@ -1339,6 +1917,10 @@ impl Buffer {
         }
     }
 
+    pub fn handle(&self) -> vk::Buffer {
+        self.handle
+    }
+
     pub fn size(&self) -> vk::DeviceSize {
         self.size
     }
@@ -1355,11 +1937,17 @@ impl Buffer {
     }
 
     pub fn bind_memory(&mut self, mt_idx: u32, dmabuf: Option<OwnedFd>) -> Result<()> {
-        let mem = Memory::with_buffer(self, mt_idx, dmabuf)?;
+        let mem = if self.can_use_memory_pool(&dmabuf) {
+            Memory::with_pooled_buffer(self, mt_idx)?
+        } else {
+            Memory::with_buffer(self, mt_idx, dmabuf)?
+        };
+        let mem_offset = mem.suballoc.map_or(0, |suballoc| suballoc.offset);
 
         let bind_info = vk::BindBufferMemoryInfo::default()
             .buffer(self.handle)
-            .memory(mem.handle);
+            .memory(mem.handle)
+            .memory_offset(mem_offset);
 
         // SAFETY: no VUID violation
         unsafe {
@@ -1440,7 +2028,7 @@ impl Image {
         let mut mods = mods;
         if let Some(con) = &con {
             if !con.modifiers.is_empty() {
-                mods = &con.modifiers;
+                mods = &con.modifiers[..];
             }
         }
 
@@ -1642,6 +2230,10 @@ impl Image {
         }
     }
 
+    pub fn handle(&self) -> vk::Image {
+        self.handle
+    }
+
     pub fn size(&self) -> vk::DeviceSize {
         self.size
     }
@@ -1781,18 +2373,29 @@ struct SimpleCommandBuffer {
     pool: vk::CommandPool,
     handle: vk::CommandBuffer,
     fence: vk::Fence,
-    // this is atomic only because rust does not know this is per-thread
+    // this is null when sync fd export is not supported
+    semaphore: vk::Semaphore,
+    // this is null when sync fd import is not supported
+    wait_semaphore: vk::Semaphore,
     pending: atomic::AtomicBool,
+
+    // index into CopyQueue::queues
+    queue_index: usize,
+    queue_family: u32,
 }
 
 impl SimpleCommandBuffer {
-    fn new(device: Arc<Device>) -> Result<Self> {
+    fn new(device: Arc<Device>, queue_index: usize, queue_family: u32) -> Result<Self> {
         let mut cmd = Self {
             device,
             pool: Default::default(),
             handle: Default::default(),
             fence: Default::default(),
+            semaphore: Default::default(),
+            wait_semaphore: Default::default(),
             pending: atomic::AtomicBool::new(false),
+            queue_index,
+            queue_family,
         };
         cmd.init()?;
 
@@ -1803,6 +2406,7 @@ impl SimpleCommandBuffer {
         self.init_command_pool()?;
         self.init_command_buffer()?;
         self.init_fence()?;
+        self.init_semaphore()?;
 
         Ok(())
     }
@@ -1810,7 +2414,7 @@ impl SimpleCommandBuffer {
     fn init_command_pool(&mut self) -> Result<()> {
         let pool_info = vk::CommandPoolCreateInfo::default()
             .flags(vk::CommandPoolCreateFlags::RESET_COMMAND_BUFFER)
-            .queue_family_index(self.device.properties().queue_family);
+            .queue_family_index(self.queue_family);
 
         // SAFETY: no VUID violation
         self.pool = unsafe { self.device.handle.create_command_pool(&pool_info, None) }
@@ -1842,6 +2446,30 @@ impl SimpleCommandBuffer {
         Ok(())
     }
 
+    fn init_semaphore(&mut self) -> Result<()> {
+        if self.device.properties().sync_fd_export {
+            let mut export_info = vk::ExportSemaphoreCreateInfo::default()
+                .handle_types(vk::ExternalSemaphoreHandleTypeFlags::SYNC_FD);
+            let semaphore_info = vk::SemaphoreCreateInfo::default().push_next(&mut export_info);
+
+            self.semaphore =
+                // SAFETY: no VUID violation
+                unsafe { self.device.handle.create_semaphore(&semaphore_info, None) }
+                    .map_err(Error::from)?;
+        }
+
+        if self.device.properties().sync_fd_import {
+            let semaphore_info = vk::SemaphoreCreateInfo::default();
+
+            self.wait_semaphore =
+                // SAFETY: no VUID violation
+                unsafe { self.device.handle.create_semaphore(&semaphore_info, None) }
+                    .map_err(Error::from)?;
+        }
+
+        Ok(())
+    }
+
     fn destroy(&self) {
         let _ = self.ensure_idle_fence();
 
@@ -1854,12 +2482,24 @@ impl SimpleCommandBuffer {
         unsafe {
             self.device.handle.destroy_fence(self.fence, None);
         }
+
+        // SAFETY: no VUID violation unless pending is true
+        unsafe {
+            self.device.handle.destroy_semaphore(self.semaphore, None);
+        }
+
+        // SAFETY: no VUID violation unless pending is true
+        unsafe {
+            self.device
+                .handle
+                .destroy_semaphore(self.wait_semaphore, None);
+        }
     }
 
     fn ensure_idle_fence(&self) -> Result<()> {
-        if self.pending.load(atomic::Ordering::Relaxed) {
+        if self.is_pending() {
             if self.wait_fence().is_ok() {
-                self.pending.store(false, atomic::Ordering::Relaxed);
+                self.set_pending(false);
                 Ok(())
             } else {
                 Error::device()
@@ -1869,6 +2509,28 @@ impl SimpleCommandBuffer {
         }
     }
 
+    // Relaxed is enough for pending.  It is only accessed by the thread using the command buffer,
+    // and by destroy, which runs when the last Arc is dropped on any thread.  Dropping the last
+    // Arc synchronizes with all prior uses.
+    fn is_pending(&self) -> bool {
+        self.pending.load(atomic::Ordering::Relaxed)
+    }
+
+    fn set_pending(&self, pending: bool) {
+        self.pending.store(pending, atomic::Ordering::Relaxed);
+    }
+
+    fn is_idle(&self) -> bool {
+        if !self.is_pending() {
+            return true;
+        }
+
+        // SAFETY: no VUID violation
+        let signaled = unsafe { self.device.handle.get_fence_status(self.fence) };
+
+        signaled.unwrap_or(false)
+    }
+
     fn reset_fence(&self) -> Result<()> {
         self.ensure_idle_fence()?;
 
@@ -1899,16 +2561,76 @@ impl SimpleCommandBuffer {
         unsafe { self.device.handle.end_command_buffer(self.handle) }.map_err(Error::from)
     }
 
-    fn wait_fence(&self) -> Result<()> {
-        // SAFETY: no VUID violation because of how CopyQueue uses this
-        unsafe {
+    fn can_export_sync_fd(&self) -> bool {
+        self.semaphore != vk::Semaphore::null()
+    }
+
+    fn export_sync_fd(&self) -> Result<Option<OwnedFd>> {
+        let fd_info = vk::SemaphoreGetFdInfoKHR::default()
+            .semaphore(self.semaphore)
+            .handle_type(vk::ExternalSemaphoreHandleTypeFlags::SYNC_FD);
+
+        // SAFETY: no VUID violation because CopyQueue only calls this after a submission that
+        // signals the semaphore
+        let raw_fd = unsafe { self.device.dispatch.semaphore.get_semaphore_fd(&fd_info) }?;
+
+        // -1 means the semaphore has already signaled
+        if raw_fd < 0 {
+            return Ok(None);
+        }
+
+        // SAFETY: raw_fd is a valid sync file
+        let sync_fd = unsafe { OwnedFd::from_raw_fd(raw_fd) };
+
+        Ok(Some(sync_fd))
+    }
+
+    // this returns the sync fd back on failures
+    fn import_sync_fd(&self, sync_fd: OwnedFd) -> Option<OwnedFd> {
+        if self.wait_semaphore == vk::Semaphore::null() {
+            return Some(sync_fd);
+        }
+
+        // SYNC_FD import requires temporary import and transfers the ownership on success
+        let raw_fd = sync_fd.into_raw_fd();
+        let import_info = vk::ImportSemaphoreFdInfoKHR::default()
+            .semaphore(self.wait_semaphore)
+            .flags(vk::SemaphoreImportFlags::TEMPORARY)
+            .handle_type(vk::ExternalSemaphoreHandleTypeFlags::SYNC_FD)
+            .fd(raw_fd);
+
+        // SAFETY: no VUID violation because CopyQueue only calls this when the command buffer is
+        // idle
+        let res = unsafe {
             self.device
-                .handle
-                .wait_for_fences(slice::from_ref(&self.fence), true, u64::MAX)
+                .dispatch
+                .semaphore
+                .import_semaphore_fd(&import_info)
+        };
+
+        if res.is_ok() {
+            return None;
         }
-        .map_err(|res| {
+
+        // SAFETY: raw_fd is from sync_fd.into_raw_fd and was not consumed
+        let sync_fd = unsafe { OwnedFd::from_raw_fd(raw_fd) };
+
+        Some(sync_fd)
+    }
+
+    fn wait_fence(&self) -> Result<()> {
+        let res = stats::wait(|| {
+            // SAFETY: no VUID violation because of how CopyQueue uses this
+            unsafe {
+                self.device
+                    .handle
+                    .wait_for_fences(slice::from_ref(&self.fence), true, u64::MAX)
+            }
+        });
+
+        res.map_err(|res| {
             if res != vk::Result::ERROR_DEVICE_LOST {
-                self.pending.store(true, atomic::Ordering::Relaxed);
+                self.set_pending(true);
             }
             Error::from(res)
         })
@@ -1943,47 +2665,172 @@ struct PipelineBarrierScope {
     dst_image_layout: vk::ImageLayout,
 }
 
+pub struct BufferImageCopy<'a> {
+    pub buffer: &'a Buffer,
+    pub image: &'a Image,
+    pub region: vk::BufferImageCopy,
+    // true when the buffer is the src and the image is the dst
+    pub to_image: bool,
+}
+
+static NEXT_COPY_QUEUE_ID: atomic::AtomicU64 = atomic::AtomicU64::new(0);
+
+// The command buffers of a copy queue on all threads.  This holds the only strong refs such that
+// the command buffers are destroyed when the copy queue is dropped, on whichever thread.
+type CommandBufferRegistry = Mutex<Vec<Arc<SimpleCommandBuffer>>>;
+
+struct PerThreadCommandBuffers {
+    registry: Weak<CommandBufferRegistry>,
+    // the front is the least recently submitted
+    ring: VecDeque<Weak<SimpleCommandBuffer>>,
+    queue_index: usize,
+}
+
+impl PerThreadCommandBuffers {
+    fn is_stale(&self) -> bool {
+        self.registry.strong_count() == 0
+    }
+}
+
+impl Drop for PerThreadCommandBuffers {
+    fn drop(&mut self) {
+        // destroy the command buffers when the thread exits before the copy queue is dropped
+        if let Some(registry) = self.registry.upgrade() {
+            let owned = |cmd: &Arc<SimpleCommandBuffer>| {
+                self.ring
+                    .iter()
+                    .any(|other| other.as_ptr() == Arc::as_ptr(cmd))
+            };
+            registry.lock().unwrap().retain(|cmd| !owned(cmd));
+        }
+    }
+}
+
+thread_local! {
+    // Per-thread command buffers of all copy queues, keyed by copy queue ids and whether they
+    // are for the fallback queue.  The copy queues own the command buffers and entries only hold
+    // weak refs.  Stale entries of dropped copy queues are pruned when new entries are added.
+    static PER_THREAD_CMDS: RefCell<HashMap<(u64, bool), PerThreadCommandBuffers>> =
+        RefCell::new(HashMap::new());
+}
+
+struct Queue {
+    family: u32,
+    handle: Mutex<vk::Queue>,
+}
+
 pub struct CopyQueue {
+    id: u64,
     device: Arc<Device>,
-    handle: Mutex<vk::Queue>,
+    cmds: Arc<CommandBufferRegistry>,
+
+    // the first queue_count queues are from queue_family, and the optional last queue is from
+    // fallback_queue_family
+    queues: Vec<Queue>,
+    queue_count: usize,
 
-    per_thread_cmds: Mutex<HashMap<thread::ThreadId, Arc<SimpleCommandBuffer>>>,
+    // threads are assigned to queues in a round-robin fashion
+    next_queue_index: atomic::AtomicUsize,
 }
 
 impl CopyQueue {
     pub fn new(device: Arc<Device>) -> Self {
-        let handle = device.get_queue();
+        let id = NEXT_COPY_QUEUE_ID.fetch_add(1, atomic::Ordering::Relaxed);
+        let queue_count = device.properties().queue_count as usize;
+        let queues = device
+            .get_queues()
+            .into_iter()
+            .map(|(family, handle)| Queue {
+                family,
+                handle: Mutex::new(handle),
+            })
+            .collect();
+
         Self {
+            id,
             device,
-            handle: Mutex::new(handle),
-            per_thread_cmds: Default::default(),
+            cmds: Default::default(),
+            queues,
+            queue_count,
+            next_queue_index: atomic::AtomicUsize::new(0),
         }
     }
 
-    fn lookup_per_thread_cmd(&self) -> Option<Arc<SimpleCommandBuffer>> {
-        let tid = thread::current().id();
-        let cmds = self.per_thread_cmds.lock().unwrap();
+    fn select_queue(&self, fallback: bool) -> usize {
+        if fallback {
+            self.queues.len() - 1
+        } else {
+            let idx = self
+                .next_queue_index
+                .fetch_add(1, atomic::Ordering::Relaxed);
+            idx % self.queue_count
+        }
+    }
 
-        cmds.get(&tid).cloned()
+    fn create_cmd(&self, queue_index: usize) -> Result<Arc<SimpleCommandBuffer>> {
+        let queue_family = self.queues[queue_index].family;
+        let cmd = SimpleCommandBuffer::new(self.device.clone(), queue_index, queue_family)?;
+
+        Ok(Arc::new(cmd))
     }
 
-    fn create_per_thread_cmd(&self) -> Result<Arc<SimpleCommandBuffer>> {
-        let cmd = SimpleCommandBuffer::new(self.device.clone())?;
-        let cmd = Arc::new(cmd);
+    fn lookup_or_create_per_thread_cmd(&self, fallback: bool) -> Result<Arc<SimpleCommandBuffer>> {
+        let res = PER_THREAD_CMDS.try_with(|cmds| {
+            let mut cmds = cmds.borrow_mut();
+            let key = (self.id, fallback);
+            if !cmds.contains_key(&key) {
+                cmds.retain(|_, other| !other.is_stale());
+            }
+            let cmds = cmds.entry(key).or_insert_with(|| PerThreadCommandBuffers {
+                registry: Arc::downgrade(&self.cmds),
+                ring: VecDeque::new(),
+                queue_index: self.select_queue(fallback),
+            });
+            let ring = &mut cmds.ring;
+
+            // Reuse the front if it is idle or if the ring is full, in which case reset_fence
+            // waits for it.  Otherwise, grow the ring.
+            let front = ring.front().and_then(Weak::upgrade);
+            let cmd = match front {
+                Some(cmd) if ring.len() >= PER_THREAD_CMD_COUNT || cmd.is_idle() => {
+                    ring.pop_front();
+                    cmd
+                }
+                _ => {
+                    let cmd = self.create_cmd(cmds.queue_index)?;
+                    self.cmds.lock().unwrap().push(cmd.clone());
+                    cmd
+                }
+            };
+            ring.push_back(Arc::downgrade(&cmd));
 
-        let tid = thread::current().id();
-        let mut cmds = self.per_thread_cmds.lock().unwrap();
+            Ok(cmd)
+        });
 
-        cmds.insert(tid, cmd.clone());
+        match res {
+            Ok(res) => res,
+            // the thread-local storage is being destroyed
+            Err(_) => self.create_cmd(self.select_queue(fallback)),
+        }
+    }
 
-        Ok(cmd)
+    // Transfer-only queue families require buffer offsets of buffer-image copies to be multiples
+    // of 4.  Other copies go to the fallback queue family.
+    fn needs_fallback_queue(&self, buffer_offsets: &[vk::DeviceSize]) -> Result<bool> {
+        let props = self.device.properties();
+        if !props.queue_family_transfer_only || buffer_offsets.iter().all(|off| off % 4 == 0) {
+            return Ok(false);
+        }
+
+        if props.fallback_queue_family.is_none() {
+            return Error::unsupported();
+        }
+
+        Ok(true)
     }
 
-    fn get_per_thread_cmd(&self) -> Result<Arc<SimpleCommandBuffer>> {
-        let cmd = match self.lookup_per_thread_cmd() {
-            Some(cmd) => cmd,
-            None => self.create_per_thread_cmd()?,
-        };
+    fn get_per_thread_cmd(&self, fallback: bool) -> Result<Arc<SimpleCommandBuffer>> {
+        let cmd = self.lookup_or_create_per_thread_cmd(fallback)?;
 
         cmd.reset_fence()?;
         cmd.begin()?;
@@ -1991,9 +2838,37 @@ impl CopyQueue {
         Ok(cmd)
     }
 
-    fn submit_cmd(&self, cmd: &SimpleCommandBuffer) -> Result<()> {
-        let submit_info = vk::SubmitInfo::default().command_buffers(slice::from_ref(&cmd.handle));
-        let handle = *self.handle.lock().unwrap();
+    fn wait_sync_fd(&self, cmd: &SimpleCommandBuffer, sync_fd: Option<OwnedFd>) -> Result<bool> {
+        let sync_fd = match sync_fd {
+            Some(sync_fd) => sync_fd,
+            None => return Ok(false),
+        };
+
+        // import the sync fd and let the gpu wait for it, or fall back to waiting on the cpu
+        let sync_fd = match cmd.import_sync_fd(sync_fd) {
+            Some(sync_fd) => sync_fd,
+            None => return Ok(true),
+        };
+
+        utils::poll(sync_fd, Access::Read)?;
+
+        Ok(false)
+    }
+
+    fn submit_cmd(&self, cmd: &SimpleCommandBuffer, wait: bool) -> Result<()> {
+        let wait_stage_mask = vk::PipelineStageFlags::ALL_COMMANDS;
+        let mut submit_info =
+            vk::SubmitInfo::default().command_buffers(slice::from_ref(&cmd.handle));
+        if wait {
+            submit_info = submit_info
+                .wait_semaphores(slice::from_ref(&cmd.wait_semaphore))
+                .wait_dst_stage_mask(slice::from_ref(&wait_stage_mask));
+        }
+        if cmd.can_export_sync_fd() {
+            submit_info = submit_info.signal_semaphores(slice::from_ref(&cmd.semaphore));
+        }
+
+        let handle = *self.queues[cmd.queue_index].handle.lock().unwrap();
         // SAFETY: no VUID violation
         unsafe {
             self.device
@@ -2003,13 +2878,56 @@ impl CopyQueue {
         .map_err(Error::from)
     }
 
-    fn execute_per_thread_cmd(&self, cmd: Arc<SimpleCommandBuffer>) -> Result<()> {
+    fn remove_per_thread_cmd(&self, cmd: &Arc<SimpleCommandBuffer>) {
+        let _ = PER_THREAD_CMDS.try_with(|cmds| {
+            for fallback in [false, true] {
+                if let Some(cmds) = cmds.borrow_mut().get_mut(&(self.id, fallback)) {
+                    cmds.ring.retain(|other| other.as_ptr() != Arc::as_ptr(cmd));
+                }
+            }
+        });
+        self.cmds
+            .lock()
+            .unwrap()
+            .retain(|other| !Arc::ptr_eq(other, cmd));
+    }
+
+    fn execute_per_thread_cmd(
+        &self,
+        cmd: Arc<SimpleCommandBuffer>,
+        sync_fd: Option<OwnedFd>,
+    ) -> Result<Option<OwnedFd>> {
         cmd.end()?;
-        self.submit_cmd(&cmd)?;
-        cmd.wait_fence()
+
+        let wait = self.wait_sync_fd(&cmd, sync_fd)?;
+        self.submit_cmd(&cmd, wait)?;
+
+        if cmd.can_export_sync_fd() {
+            // the fence will be waited for in reset_fence before the next use
+            cmd.set_pending(true);
+
+            match cmd.export_sync_fd() {
+                Ok(sync_fd) => return Ok(sync_fd),
+                Err(err) => {
+                    log::warn!("failed to export sync fd: {}", err);
+
+                    // the semaphore is left signaled; wait and throw away the command buffer
+                    cmd.ensure_idle_fence()?;
+                    self.remove_per_thread_cmd(&cmd);
+
+                    return Ok(None);
+                }
+            }
+        }
+
+        cmd.wait_fence().and(Ok(None))
     }
 
-    fn get_pipeline_barrier_scope(&self, ty: PipelineBarrierType) -> PipelineBarrierScope {
+    fn get_pipeline_barrier_scope(
+        &self,
+        ty: PipelineBarrierType,
+        queue_family: u32,
+    ) -> PipelineBarrierScope {
         // We assume all resources are owned by the foreign queue and, in the case of images, have
         // been initialized to the GENERAL layout.  Strictly speaking, the layout part is not
         // guaranteed unless we always explicitly transition the layout and release the ownership
@@ -2029,7 +2947,7 @@ impl CopyQueue {
                 src_access_mask = vk::AccessFlags::NONE;
                 src_image_layout = vk::ImageLayout::GENERAL;
 
-                dst_queue_family = self.device.properties().queue_family;
+                dst_queue_family = queue_family;
                 dst_stage_mask = vk::PipelineStageFlags::TRANSFER;
                 if ty == PipelineBarrierType::AcquireSrc {
                     dst_access_mask = vk::AccessFlags::TRANSFER_READ;
@@ -2040,7 +2958,7 @@ impl CopyQueue {
                 }
             }
             PipelineBarrierType::ReleaseSrc | PipelineBarrierType::ReleaseDst => {
-                src_queue_family = self.device.properties().queue_family;
+                src_queue_family = queue_family;
                 src_stage_mask = vk::PipelineStageFlags::TRANSFER;
                 if ty == PipelineBarrierType::ReleaseSrc {
                     src_access_mask = vk::AccessFlags::NONE;
@@ -2070,46 +2988,30 @@ impl CopyQueue {
         }
     }
 
-    fn cmd_buffer_barrier(
-        &self,
-        cmd: vk::CommandBuffer,
+    fn get_buffer_barrier(
         buf: vk::Buffer,
-        scope: PipelineBarrierScope,
-    ) {
-        let buf_barrier = vk::BufferMemoryBarrier::default()
+        scope: &PipelineBarrierScope,
+    ) -> vk::BufferMemoryBarrier<'static> {
+        vk::BufferMemoryBarrier::default()
             .src_access_mask(scope.src_access_mask)
             .dst_access_mask(scope.dst_access_mask)
             .src_queue_family_index(scope.src_queue_family)
             .dst_queue_family_index(scope.dst_queue_family)
             .buffer(buf)
-            .size(vk::WHOLE_SIZE);
-
-        // SAFETY: no VUID violation
-        unsafe {
-            self.device.handle.cmd_pipeline_barrier(
-                cmd,
-                scope.src_stage_mask,
-                scope.dst_stage_mask,
-                scope.dependency_flags,
-                &[],
-                slice::from_ref(&buf_barrier),
-                &[],
-            );
-        }
+            .size(vk::WHOLE_SIZE)
     }
 
-    fn cmd_image_barrier(
-        &self,
-        cmd: vk::CommandBuffer,
+    fn get_image_barrier(
         img: vk::Image,
         aspect: vk::ImageAspectFlags,
-        scope: PipelineBarrierScope,
-    ) {
+        scope: &PipelineBarrierScope,
+    ) -> vk::ImageMemoryBarrier<'static> {
         let img_subres = vk::ImageSubresourceRange::default()
             .aspect_mask(aspect)
             .level_count(1)
             .layer_count(1);
-        let img_barrier = vk::ImageMemoryBarrier::default()
+
+        vk::ImageMemoryBarrier::default()
             .src_access_mask(scope.src_access_mask)
             .dst_access_mask(scope.dst_access_mask)
             .old_layout(scope.src_image_layout)
@@ -2117,8 +3019,16 @@ impl CopyQueue {
             .src_queue_family_index(scope.src_queue_family)
             .dst_queue_family_index(scope.dst_queue_family)
             .image(img)
-            .subresource_range(img_subres);
+            .subresource_range(img_subres)
+    }
 
+    fn cmd_pipeline_barrier(
+        &self,
+        cmd: vk::CommandBuffer,
+        scope: &PipelineBarrierScope,
+        buf_barriers: &[vk::BufferMemoryBarrier],
+        img_barriers: &[vk::ImageMemoryBarrier],
+    ) {
         // SAFETY: VUID-VkImageMemoryBarrier-oldLayout-01197 violation on first image acquire (see
         // get_pipeline_barrier_scope)
         unsafe {
@@ -2128,19 +3038,102 @@ impl CopyQueue {
                 scope.dst_stage_mask,
                 scope.dependency_flags,
                 &[],
-                &[],
-                slice::from_ref(&img_barrier),
+                buf_barriers,
+                img_barriers,
             );
         }
     }
 
-    pub fn copy_buffer(&self, src: &Buffer, dst: &Buffer, region: vk::BufferCopy) -> Result<()> {
-        let cmd = self.get_per_thread_cmd()?;
+    fn cmd_buffer_barrier(
+        &self,
+        cmd: vk::CommandBuffer,
+        buf: vk::Buffer,
+        scope: PipelineBarrierScope,
+    ) {
+        let buf_barrier = Self::get_buffer_barrier(buf, &scope);
+        self.cmd_pipeline_barrier(cmd, &scope, slice::from_ref(&buf_barrier), &[]);
+    }
+
+    fn cmd_image_barrier(
+        &self,
+        cmd: vk::CommandBuffer,
+        img: vk::Image,
+        aspect: vk::ImageAspectFlags,
+        scope: PipelineBarrierScope,
+    ) {
+        let img_barrier = Self::get_image_barrier(img, aspect, &scope);
+        self.cmd_pipeline_barrier(cmd, &scope, &[], slice::from_ref(&img_barrier));
+    }
+
+    // this records a single barrier for all resources of the batch
+    fn cmd_batch_barrier(
+        &self,
+        cmd: &SimpleCommandBuffer,
+        copies: &[BufferImageCopy],
+        acquire: bool,
+    ) {
+        let (src_ty, dst_ty) = if acquire {
+            (
+                PipelineBarrierType::AcquireSrc,
+                PipelineBarrierType::AcquireDst,
+            )
+        } else {
+            (
+                PipelineBarrierType::ReleaseSrc,
+                PipelineBarrierType::ReleaseDst,
+            )
+        };
+        let src_scope = self.get_pipeline_barrier_scope(src_ty, cmd.queue_family);
+        let dst_scope = self.get_pipeline_barrier_scope(dst_ty, cmd.queue_family);
+
+        let mut bufs: Vec<(vk::Buffer, bool)> = Vec::with_capacity(copies.len());
+        let mut imgs: Vec<(vk::Image, vk::ImageAspectFlags, bool)> =
+            Vec::with_capacity(copies.len());
+        for copy in copies {
+            let buf = copy.buffer.handle;
+            if !bufs.iter().any(|(handle, _)| *handle == buf) {
+                bufs.push((buf, copy.to_image));
+            }
 
-        let src_acquire = self.get_pipeline_barrier_scope(PipelineBarrierType::AcquireSrc);
-        let dst_acquire = self.get_pipeline_barrier_scope(PipelineBarrierType::AcquireDst);
-        let src_release = self.get_pipeline_barrier_scope(PipelineBarrierType::ReleaseSrc);
-        let dst_release = self.get_pipeline_barrier_scope(PipelineBarrierType::ReleaseDst);
+            let img = copy.image.handle;
+            let aspect = copy.region.image_subresource.aspect_mask;
+            match imgs.iter_mut().find(|(handle, _, _)| *handle == img) {
+                Some((_, aspects, _)) => *aspects |= aspect,
+                None => imgs.push((img, aspect, !copy.to_image)),
+            }
+        }
+
+        let scope = |is_src: bool| if is_src { &src_scope } else { &dst_scope };
+        let buf_barriers: Vec<vk::BufferMemoryBarrier> = bufs
+            .into_iter()
+            .map(|(buf, is_src)| Self::get_buffer_barrier(buf, scope(is_src)))
+            .collect();
+        let img_barriers: Vec<vk::ImageMemoryBarrier> = imgs
+            .into_iter()
+            .map(|(img, aspect, is_src)| Self::get_image_barrier(img, aspect, scope(is_src)))
+            .collect();
+
+        // src_scope and dst_scope have the same stage masks
+        self.cmd_pipeline_barrier(cmd.handle, &src_scope, &buf_barriers, &img_barriers);
+    }
+
+    pub fn copy_buffer(
+        &self,
+        src: &Buffer,
+        dst: &Buffer,
+        region: vk::BufferCopy,
+        sync_fd: Option<OwnedFd>,
+    ) -> Result<Option<OwnedFd>> {
+        let cmd = self.get_per_thread_cmd(false)?;
+
+        let src_acquire =
+            self.get_pipeline_barrier_scope(PipelineBarrierType::AcquireSrc, cmd.queue_family);
+        let dst_acquire =
+            self.get_pipeline_barrier_scope(PipelineBarrierType::AcquireDst, cmd.queue_family);
+        let src_release =
+            self.get_pipeline_barrier_scope(PipelineBarrierType::ReleaseSrc, cmd.queue_family);
+        let dst_release =
+            self.get_pipeline_barrier_scope(PipelineBarrierType::ReleaseDst, cmd.queue_family);
 
         self.cmd_buffer_barrier(cmd.handle, src.handle, src_acquire);
         self.cmd_buffer_barrier(cmd.handle, dst.handle, dst_acquire);
@@ -2158,7 +3151,7 @@ impl CopyQueue {
         self.cmd_buffer_barrier(cmd.handle, src.handle, src_release);
         self.cmd_buffer_barrier(cmd.handle, dst.handle, dst_release);
 
-        self.execute_per_thread_cmd(cmd)
+        self.execute_per_thread_cmd(cmd, sync_fd)
     }
 
     pub fn copy_image_to_buffer(
@@ -2166,13 +3159,19 @@ impl CopyQueue {
         img: &Image,
         buf: &Buffer,
         region: vk::BufferImageCopy,
-    ) -> Result<()> {
-        let cmd = self.get_per_thread_cmd()?;
-
-        let img_acquire = self.get_pipeline_barrier_scope(PipelineBarrierType::AcquireSrc);
-        let buf_acquire = self.get_pipeline_barrier_scope(PipelineBarrierType::AcquireDst);
-        let img_release = self.get_pipeline_barrier_scope(PipelineBarrierType::ReleaseSrc);
-        let buf_release = self.get_pipeline_barrier_scope(PipelineBarrierType::ReleaseDst);
+        sync_fd: Option<OwnedFd>,
+    ) -> Result<Option<OwnedFd>> {
+        let fallback = self.needs_fallback_queue(slice::from_ref(&region.buffer_offset))?;
+        let cmd = self.get_per_thread_cmd(fallback)?;
+
+        let img_acquire =
+            self.get_pipeline_barrier_scope(PipelineBarrierType::AcquireSrc, cmd.queue_family);
+        let buf_acquire =
+            self.get_pipeline_barrier_scope(PipelineBarrierType::AcquireDst, cmd.queue_family);
+        let img_release =
+            self.get_pipeline_barrier_scope(PipelineBarrierType::ReleaseSrc, cmd.queue_family);
+        let buf_release =
+            self.get_pipeline_barrier_scope(PipelineBarrierType::ReleaseDst, cmd.queue_family);
         let img_aspect = region.image_subresource.aspect_mask;
         let img_layout = img_acquire.dst_image_layout;
 
@@ -2193,7 +3192,7 @@ impl CopyQueue {
         self.cmd_image_barrier(cmd.handle, img.handle, img_aspect, img_release);
         self.cmd_buffer_barrier(cmd.handle, buf.handle, buf_release);
 
-        self.execute_per_thread_cmd(cmd)
+        self.execute_per_thread_cmd(cmd, sync_fd)
     }
 
     pub fn copy_buffer_to_image(
@@ -2201,13 +3200,19 @@ impl CopyQueue {
         buf: &Buffer,
         img: &Image,
         region: vk::BufferImageCopy,
-    ) -> Result<()> {
-        let cmd = self.get_per_thread_cmd()?;
-
-        let buf_acquire = self.get_pipeline_barrier_scope(PipelineBarrierType::AcquireSrc);
-        let img_acquire = self.get_pipeline_barrier_scope(PipelineBarrierType::AcquireDst);
-        let buf_release = self.get_pipeline_barrier_scope(PipelineBarrierType::ReleaseSrc);
-        let img_release = self.get_pipeline_barrier_scope(PipelineBarrierType::ReleaseDst);
+        sync_fd: Option<OwnedFd>,
+    ) -> Result<Option<OwnedFd>> {
+        let fallback = self.needs_fallback_queue(slice::from_ref(&region.buffer_offset))?;
+        let cmd = self.get_per_thread_cmd(fallback)?;
+
+        let buf_acquire =
+            self.get_pipeline_barrier_scope(PipelineBarrierType::AcquireSrc, cmd.queue_family);
+        let img_acquire =
+            self.get_pipeline_barrier_scope(PipelineBarrierType::AcquireDst, cmd.queue_family);
+        let buf_release =
+            self.get_pipeline_barrier_scope(PipelineBarrierType::ReleaseSrc, cmd.queue_family);
+        let img_release =
+            self.get_pipeline_barrier_scope(PipelineBarrierType::ReleaseDst, cmd.queue_family);
         let img_aspect = region.image_subresource.aspect_mask;
         let img_layout = img_acquire.dst_image_layout;
 
@@ -2228,6 +3233,66 @@ impl CopyQueue {
         self.cmd_buffer_barrier(cmd.handle, buf.handle, buf_release);
         self.cmd_image_barrier(cmd.handle, img.handle, img_aspect, img_release);
 
-        self.execute_per_thread_cmd(cmd)
+        self.execute_per_thread_cmd(cmd, sync_fd)
+    }
+
+    // All copies are recorded into a single command buffer with merged barriers.  A resource
+    // must not be both a src and a dst in a batch.
+    pub fn copy_buffer_image_batch(
+        &self,
+        copies: &[BufferImageCopy],
+        sync_fd: Option<OwnedFd>,
+    ) -> Result<Option<OwnedFd>> {
+        let buffer_offsets: Vec<vk::DeviceSize> = copies
+            .iter()
+            .map(|copy| copy.region.buffer_offset)
+            .collect();
+        let fallback = self.needs_fallback_queue(&buffer_offsets)?;
+        let cmd = self.get_per_thread_cmd(fallback)?;
+
+        self.cmd_batch_barrier(&cmd, copies, true);
+
+        for copy in copies {
+            let buf = copy.buffer.handle;
+            let img = copy.image.handle;
+            let region = slice::from_ref(&copy.region);
+
+            if copy.to_image {
+                let img_layout = vk::ImageLayout::TRANSFER_DST_OPTIMAL;
+
+                // SAFETY: no VUID violation
+                unsafe {
+                    self.device
+                        .handle
+                        .cmd_copy_buffer_to_image(cmd.handle, buf, img, img_layout, region);
+                }
+            } else {
+                let img_layout = vk::ImageLayout::TRANSFER_SRC_OPTIMAL;
+
+                // SAFETY: no VUID violation
+                unsafe {
+                    self.device
+                        .handle
+                        .cmd_copy_image_to_buffer(cmd.handle, img, img_layout, buf, region);
+                }
+            }
+        }
+
+        self.cmd_batch_barrier(&cmd, copies, false);
+
+        self.execute_per_thread_cmd(cmd, sync_fd)
+    }
+}
+
+impl Drop for CopyQueue {
+    fn drop(&mut self) {
+        // destroy the command buffers of all threads, not only of this thread
+        self.cmds.lock().unwrap().clear();
+
+        let _ = PER_THREAD_CMDS.try_with(|cmds| {
+            let mut cmds = cmds.borrow_mut();
+            cmds.remove(&(self.id, false));
+            cmds.remove(&(self.id, true));
+        });
     }
 }
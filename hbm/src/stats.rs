@@ -0,0 +1,413 @@
+// Copyright 2025 Google LLC
+// SPDX-License-Identifier: MIT
+
+//! Device statistics.
+//!
+//! A device collects counters and latency histograms of hot-path operations, and the live BOs per
+//! memory type, for each of its backends.  Collection uses relaxed atomics and is always enabled.
+//! With the `trace` feature, operations are also marked as atrace spans for systrace and
+//! perfetto.
+
+use super::backends::MemoryType;
+use super::types::Size;
+use std::cell::Cell;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::{Duration, Instant};
+use std::{array, fmt};
+
+/// The number of buckets of a latency histogram.
+///
+/// Bucket 0 counts latencies below 1us.  Bucket `i` counts latencies in `[2^(i-1), 2^i)` us,
+/// except that the last bucket also counts all longer latencies.
+pub const HISTOGRAM_BUCKET_COUNT: usize = 24;
+
+// the number of distinct memory types
+const MEMORY_TYPE_COUNT: usize = MemoryType::all().bits() as usize + 1;
+
+/// An instrumented operation.
+#[derive(Clone, Copy, Debug, Eq, PartialEq)]
+pub enum Operation {
+    /// A BO classification by the backend.
+    Classify,
+    /// A BO creation with a constraint or with a layout.
+    Create,
+    /// A memory allocation or import, and binding it to a BO.
+    BindMemory,
+    /// The first mapping of a BO.
+    Map,
+    /// A copy, until it is submitted or, when waiting, until it completes.
+    Copy,
+    /// A blocking wait for a copy to complete.  The time is also included in `Copy`.
+    Wait,
+}
+
+impl Operation {
+    /// All operations, in the order of their indices.
+    pub const ALL: [Operation; 6] = [
+        Operation::Classify,
+        Operation::Create,
+        Operation::BindMemory,
+        Operation::Map,
+        Operation::Copy,
+        Operation::Wait,
+    ];
+
+    /// Returns the name of the operation.
+    pub fn name(self) -> &'static str {
+        match self {
+            Operation::Classify => "classify",
+            Operation::Create => "create",
+            Operation::BindMemory => "bind_memory",
+            Operation::Map => "map",
+            Operation::Copy => "copy",
+            Operation::Wait => "wait",
+        }
+    }
+}
+
+const OPERATION_COUNT: usize = Operation::ALL.len();
+
+fn bucket_index(ns: u64) -> usize {
+    let us = ns / 1000;
+    let idx = (u64::BITS - us.leading_zeros()) as usize;
+    idx.min(HISTOGRAM_BUCKET_COUNT - 1)
+}
+
+fn duration_ns(dur: Duration) -> u64 {
+    u64::try_from(dur.as_nanos()).unwrap_or(u64::MAX)
+}
+
+#[derive(Default)]
+struct OperationCounters {
+    count: AtomicU64,
+    total_ns: AtomicU64,
+    max_ns: AtomicU64,
+    histogram: [AtomicU64; HISTOGRAM_BUCKET_COUNT],
+}
+
+impl OperationCounters {
+    fn record(&self, dur: Duration) {
+        let ns = duration_ns(dur);
+        self.count.fetch_add(1, Ordering::Relaxed);
+        self.total_ns.fetch_add(ns, Ordering::Relaxed);
+        self.max_ns.fetch_max(ns, Ordering::Relaxed);
+        self.histogram[bucket_index(ns)].fetch_add(1, Ordering::Relaxed);
+    }
+
+    fn snapshot(&self) -> OperationStats {
+        OperationStats {
+            count: self.count.load(Ordering::Relaxed),
+            total: Duration::from_nanos(self.total_ns.load(Ordering::Relaxed)),
+            max: Duration::from_nanos(self.max_ns.load(Ordering::Relaxed)),
+            histogram: array::from_fn(|idx| self.histogram[idx].load(Ordering::Relaxed)),
+        }
+    }
+}
+
+#[derive(Default)]
+struct MemoryCounters {
+    count: AtomicU64,
+    size: AtomicU64,
+}
+
+// The counters of a backend.
+#[derive(Default)]
+pub(crate) struct Counters {
+    ops: [OperationCounters; OPERATION_COUNT],
+    memory: [MemoryCounters; MEMORY_TYPE_COUNT],
+}
+
+impl Counters {
+    // Starts timing an operation.  The operation ends when the span is dropped.
+    pub fn span(&self, op: Operation) -> Span<'_> {
+        if op == Operation::Copy {
+            // discard waits outside of copies, such as those when destroying command buffers
+            PENDING_WAIT.with(|pending| pending.set(Duration::ZERO));
+        }
+
+        #[cfg(feature = "trace")]
+        trace::begin(op.name());
+
+        Span {
+            counters: self,
+            op,
+            start: Instant::now(),
+        }
+    }
+
+    // Adds a live BO of a memory type.
+    pub fn add_bo(&self, mt: MemoryType, size: Size) {
+        let memory = &self.memory[mt.bits() as usize];
+        memory.count.fetch_add(1, Ordering::Relaxed);
+        memory.size.fetch_add(size, Ordering::Relaxed);
+    }
+
+    // Removes a live BO of a memory type.
+    pub fn remove_bo(&self, mt: MemoryType, size: Size) {
+        let memory = &self.memory[mt.bits() as usize];
+        memory.count.fetch_sub(1, Ordering::Relaxed);
+        memory.size.fetch_sub(size, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self) -> BackendStats {
+        BackendStats {
+            ops: array::from_fn(|idx| self.ops[idx].snapshot()),
+            memory: array::from_fn(|idx| MemoryStats {
+                count: self.memory[idx].count.load(Ordering::Relaxed),
+                size: self.memory[idx].size.load(Ordering::Relaxed),
+            }),
+        }
+    }
+}
+
+// A timed operation.
+#[must_use]
+pub(crate) struct Span<'a> {
+    counters: &'a Counters,
+    op: Operation,
+    start: Instant,
+}
+
+impl Drop for Span<'_> {
+    fn drop(&mut self) {
+        self.counters.ops[self.op as usize].record(self.start.elapsed());
+
+        if self.op == Operation::Copy {
+            let wait = PENDING_WAIT.with(|pending| pending.replace(Duration::ZERO));
+            if !wait.is_zero() {
+                self.counters.ops[Operation::Wait as usize].record(wait);
+            }
+        }
+
+        #[cfg(feature = "trace")]
+        trace::end();
+    }
+}
+
+thread_local! {
+    // Backends do not know their devices.  They accumulate the time of blocking waits here, and
+    // the time is attributed to the backend of the enclosing copy span.
+    static PENDING_WAIT: Cell<Duration> = const { Cell::new(Duration::ZERO) };
+}
+
+// Calls a function that blocks for a copy to complete, and accounts the time as a wait.
+pub(crate) fn wait<T, F>(f: F) -> T
+where
+    F: FnOnce() -> T,
+{
+    #[cfg(feature = "trace")]
+    trace::begin(Operation::Wait.name());
+
+    let start = Instant::now();
+    let ret = f();
+    let elapsed = start.elapsed();
+    PENDING_WAIT.with(|pending| pending.set(pending.get() + elapsed));
+
+    #[cfg(feature = "trace")]
+    trace::end();
+
+    ret
+}
+
+/// The latency statistics of an operation.
+#[derive(Clone, Copy, Debug, Default, Eq, PartialEq)]
+pub struct OperationStats {
+    /// The number of times the operation was performed.
+    pub count: u64,
+    /// The total time spent in the operation.
+    pub total: Duration,
+    /// The longest time spent in a single operation.
+    pub max: Duration,
+    /// The latency histogram.  See `HISTOGRAM_BUCKET_COUNT` for the bucket bounds.
+    pub histogram: [u64; HISTOGRAM_BUCKET_COUNT],
+}
+
+impl OperationStats {
+    /// Returns the mean latency.
+    pub fn mean(&self) -> Duration {
+        if self.count == 0 {
+            return Duration::ZERO;
+        }
+
+        Duration::from_nanos(duration_ns(self.total) / self.count)
+    }
+
+    /// Returns an upper bound of the latency percentile, which is between 0 and 100.
+    ///
+    /// The bound is the upper bound of the histogram bucket that the percentile falls into, and
+    /// is capped by `max`.
+    pub fn percentile(&self, pct: u32) -> Duration {
+        let target = (self.count * pct.min(100) as u64).div_ceil(100);
+
+        let mut acc = 0;
+        for (idx, &count) in self.histogram.iter().enumerate() {
+            acc += count;
+            if acc >= target && acc > 0 {
+                let bound = Duration::from_micros(1 << idx);
+                return bound.min(self.max);
+            }
+        }
+
+        self.max
+    }
+}
+
+/// The statistics of the live BOs of a memory type.
+#[derive(Clone, Copy, Debug, Default, Eq, PartialEq)]
+pub struct MemoryStats {
+    /// The number of BOs with memories of the memory type bound.
+    pub count: u64,
+    /// The total size of the BOs.
+    pub size: Size,
+}
+
+/// The statistics of a backend of a device.
+#[derive(Clone, Debug, Default, Eq, PartialEq)]
+pub struct BackendStats {
+    ops: [OperationStats; OPERATION_COUNT],
+    memory: [MemoryStats; MEMORY_TYPE_COUNT],
+}
+
+impl BackendStats {
+    /// Returns the latency statistics of an operation.
+    pub fn operation(&self, op: Operation) -> &OperationStats {
+        &self.ops[op as usize]
+    }
+
+    /// Returns the statistics of the live BOs of a memory type.
+    ///
+    /// BOs without memories bound are not counted.  Imported BOs count their full sizes even
+    /// when the memories are shared with other BOs.
+    pub fn memory(&self, mt: MemoryType) -> &MemoryStats {
+        &self.memory[mt.bits() as usize]
+    }
+}
+
+impl fmt::Display for BackendStats {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        for op in Operation::ALL {
+            let stats = self.operation(op);
+            if stats.count == 0 {
+                continue;
+            }
+
+            writeln!(
+                f,
+                "{}: count {} mean {:?} p50 {:?} p99 {:?} max {:?}",
+                op.name(),
+                stats.count,
+                stats.mean(),
+                stats.percentile(50),
+                stats.percentile(99),
+                stats.max
+            )?;
+        }
+
+        for (bits, stats) in self.memory.iter().enumerate() {
+            if stats.count == 0 {
+                continue;
+            }
+
+            let mt = MemoryType::from_bits_truncate(bits as u32);
+            writeln!(
+                f,
+                "memory {:?}: count {} size {}",
+                mt, stats.count, stats.size
+            )?;
+        }
+
+        Ok(())
+    }
+}
+
+#[cfg(feature = "trace")]
+mod trace {
+    use std::fs::{File, OpenOptions};
+    use std::io::Write;
+    use std::process;
+    use std::sync::OnceLock;
+
+    const TRACE_MARKER_PATHS: [&str; 2] = [
+        "/sys/kernel/tracing/trace_marker",
+        "/sys/kernel/debug/tracing/trace_marker",
+    ];
+
+    fn marker() -> Option<&'static File> {
+        static MARKER: OnceLock<Option<File>> = OnceLock::new();
+
+        MARKER
+            .get_or_init(|| {
+                TRACE_MARKER_PATHS
+                    .iter()
+                    .find_map(|path| OpenOptions::new().write(true).open(path).ok())
+            })
+            .as_ref()
+    }
+
+    // each marker must be written with a single write
+    fn write(msg: String) {
+        if let Some(mut marker) = marker() {
+            let _ = marker.write_all(msg.as_bytes());
+        }
+    }
+
+    // Begins an atrace span on the current thread.
+    pub fn begin(name: &str) {
+        if marker().is_some() {
+            write(format!("B|{}|hbm:{}", process::id(), name));
+        }
+    }
+
+    // Ends the innermost atrace span on the current thread.
+    pub fn end() {
+        if marker().is_some() {
+            write(format!("E|{}", process::id()));
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_bucket_index() {
+        assert_eq!(bucket_index(0), 0);
+        assert_eq!(bucket_index(999), 0);
+        assert_eq!(bucket_index(1000), 1);
+        assert_eq!(bucket_index(1999), 1);
+        assert_eq!(bucket_index(2000), 2);
+        assert_eq!(bucket_index(u64::MAX), HISTOGRAM_BUCKET_COUNT - 1);
+    }
+
+    #[test]
+    fn test_counters() {
+        let counters = Counters::default();
+
+        drop(counters.span(Operation::Map));
+        {
+            let _span = counters.span(Operation::Copy);
+            wait(|| std::thread::sleep(Duration::from_millis(1)));
+        }
+
+        let mt = MemoryType::MAPPABLE | MemoryType::CACHED;
+        counters.add_bo(mt, 4096);
+        counters.add_bo(mt, 8192);
+        counters.remove_bo(mt, 4096);
+
+        let stats = counters.snapshot();
+        assert_eq!(stats.operation(Operation::Classify).count, 0);
+        assert_eq!(stats.operation(Operation::Map).count, 1);
+        assert_eq!(stats.operation(Operation::Copy).count, 1);
+
+        let wait = stats.operation(Operation::Wait);
+        assert_eq!(wait.count, 1);
+        assert!(wait.max >= Duration::from_millis(1));
+        assert!(stats.operation(Operation::Copy).max >= wait.max);
+        assert_eq!(wait.percentile(50), wait.max);
+
+        assert_eq!(stats.memory(mt).count, 1);
+        assert_eq!(stats.memory(mt).size, 8192);
+        assert_eq!(stats.memory(MemoryType::LOCAL).count, 0);
+    }
+}
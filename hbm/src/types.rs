@@ -8,7 +8,7 @@
 use super::formats;
 use nix::poll::PollFlags;
 use nix::sys::mman::ProtFlags;
-use std::{ffi, fmt, io, num, ptr, result};
+use std::{ffi, fmt, hash, io, num, ops, ptr, result};
 
 /// The error type for HBM operations.
 #[derive(thiserror::Error, Debug)]
@@ -157,14 +157,168 @@ where
     }
 }
 
-/// An access type for memory mapping.
-pub(crate) enum Access {
+// the number of modifiers that a ModifierSet holds inline
+pub(crate) const INLINE_MODIFIERS: usize = 32;
+
+// the inline variant is large by design
+#[allow(clippy::large_enum_variant)]
+#[derive(Clone)]
+enum ModifierStorage {
+    Inline {
+        len: usize,
+        mods: [Modifier; INLINE_MODIFIERS],
+    },
+    Heap(Vec<Modifier>),
+}
+
+// A set of modifiers.
+//
+// Classes and constraints are created, cloned, and merged on every allocation.  This keeps up to
+// INLINE_MODIFIERS modifiers inline to avoid heap allocations, and moves all modifiers to the heap
+// when there are more.  Modifiers are kept in insertion order, which is the preference order of
+// the backends.
+#[derive(Clone)]
+pub(crate) struct ModifierSet {
+    storage: ModifierStorage,
+}
+
+impl ModifierSet {
+    pub(crate) fn new() -> Self {
+        Self {
+            storage: ModifierStorage::Inline {
+                len: 0,
+                mods: [formats::MOD_INVALID; INLINE_MODIFIERS],
+            },
+        }
+    }
+
+    fn as_mut_slice(&mut self) -> &mut [Modifier] {
+        match &mut self.storage {
+            ModifierStorage::Inline { len, mods } => &mut mods[..*len],
+            ModifierStorage::Heap(mods) => mods,
+        }
+    }
+
+    pub(crate) fn insert(&mut self, modifier: Modifier) {
+        if self.contains(&modifier) {
+            return;
+        }
+
+        match &mut self.storage {
+            ModifierStorage::Inline { len, mods } if *len < INLINE_MODIFIERS => {
+                mods[*len] = modifier;
+                *len += 1;
+            }
+            ModifierStorage::Inline { len, mods } => {
+                let mut heap = Vec::with_capacity(*len * 2);
+                heap.extend_from_slice(&mods[..*len]);
+                heap.push(modifier);
+                self.storage = ModifierStorage::Heap(heap);
+            }
+            ModifierStorage::Heap(mods) => mods.push(modifier),
+        }
+    }
+
+    pub(crate) fn retain(&mut self, mut f: impl FnMut(&Modifier) -> bool) {
+        match &mut self.storage {
+            ModifierStorage::Inline { len, mods } => {
+                let mut kept = 0;
+                for idx in 0..*len {
+                    if f(&mods[idx]) {
+                        mods[kept] = mods[idx];
+                        kept += 1;
+                    }
+                }
+                *len = kept;
+            }
+            ModifierStorage::Heap(mods) => mods.retain(f),
+        }
+    }
+
+    pub(crate) fn intersect(&mut self, other: &[Modifier]) {
+        self.retain(|m| other.contains(m));
+    }
+
+    // Sorts the modifiers stably, such that modifiers with equal keys keep their order.
+    pub(crate) fn sort_by_key<K: Ord>(&mut self, f: impl FnMut(&Modifier) -> K) {
+        self.as_mut_slice().sort_by_key(f);
+    }
+}
+
+impl Default for ModifierSet {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl ops::Deref for ModifierSet {
+    type Target = [Modifier];
+
+    fn deref(&self) -> &Self::Target {
+        match &self.storage {
+            ModifierStorage::Inline { len, mods } => &mods[..*len],
+            ModifierStorage::Heap(mods) => mods,
+        }
+    }
+}
+
+impl PartialEq for ModifierSet {
+    fn eq(&self, other: &Self) -> bool {
+        **self == **other
+    }
+}
+
+impl Eq for ModifierSet {}
+
+impl hash::Hash for ModifierSet {
+    fn hash<H: hash::Hasher>(&self, state: &mut H) {
+        (**self).hash(state);
+    }
+}
+
+impl fmt::Debug for ModifierSet {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_list().entries(self.iter()).finish()
+    }
+}
+
+impl Extend<Modifier> for ModifierSet {
+    fn extend<I: IntoIterator<Item = Modifier>>(&mut self, iter: I) {
+        for modifier in iter {
+            self.insert(modifier);
+        }
+    }
+}
+
+impl FromIterator<Modifier> for ModifierSet {
+    fn from_iter<I: IntoIterator<Item = Modifier>>(iter: I) -> Self {
+        let mut set = Self::new();
+        set.extend(iter);
+        set
+    }
+}
+
+/// An access type for CPU access.
+#[derive(Clone, Copy, Debug, Eq, PartialEq)]
+pub enum Access {
+    /// The CPU reads.
     Read,
-    #[allow(dead_code)]
+    /// The CPU writes.
     Write,
+    /// The CPU reads and writes.
     ReadWrite,
 }
 
+impl Access {
+    pub(crate) fn is_read(&self) -> bool {
+        *self != Access::Write
+    }
+
+    pub(crate) fn is_write(&self) -> bool {
+        *self != Access::Read
+    }
+}
+
 impl From<Access> for ProtFlags {
     fn from(access: Access) -> Self {
         match access {
@@ -207,4 +361,29 @@ mod tests {
     fn test_modifier() {
         assert_eq!(Modifier::default(), formats::MOD_INVALID);
     }
+
+    #[test]
+    fn test_modifier_set() {
+        let mut set: ModifierSet = (0..4).map(Modifier).chain([Modifier(1)]).collect();
+        assert_eq!(&*set, &[Modifier(0), Modifier(1), Modifier(2), Modifier(3)]);
+
+        set.intersect(&[Modifier(3), Modifier(1), Modifier(5)]);
+        assert_eq!(&*set, &[Modifier(1), Modifier(3)]);
+
+        set.extend([Modifier(4), Modifier(6)]);
+        set.sort_by_key(|m| m.0 % 2);
+        assert_eq!(&*set, &[Modifier(4), Modifier(6), Modifier(1), Modifier(3)]);
+
+        let count = INLINE_MODIFIERS as u64 * 2;
+        let mut large: ModifierSet = (0..count).rev().map(Modifier).collect();
+        assert_eq!(large.len(), count as usize);
+        assert!(large.contains(&Modifier(0)));
+
+        let cloned = large.clone();
+        large.intersect(&[Modifier(count - 1), Modifier(0), Modifier(count)]);
+        assert_eq!(&*large, &[Modifier(count - 1), Modifier(0)]);
+        large.sort_by_key(|m| m.0);
+        assert_eq!(&*large, &[Modifier(0), Modifier(count - 1)]);
+        assert_eq!(cloned.len(), count as usize);
+    }
 }
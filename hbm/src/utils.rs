@@ -10,7 +10,7 @@ use nix::{fcntl, poll, sys, unistd};
 use std::ffi::CString;
 use std::os::fd::{AsFd, AsRawFd, FromRawFd, OwnedFd};
 use std::path::Path;
-use std::{num, slice};
+use std::{num, ptr, slice};
 
 pub fn makedev(major: u64, minor: u64) -> u64 {
     libc::makedev(major as _, minor as _) as u64
@@ -33,21 +33,49 @@ pub fn seek_end(fd: impl AsFd) -> Result<Size> {
     Ok(offset.try_into()?)
 }
 
-pub fn mmap(fd: impl AsFd, size: Size, access: Access) -> Result<Mapping> {
+// returns the device and inode numbers, which identify the file while it is open
+pub fn file_id(fd: impl AsFd) -> Result<(u64, u64)> {
+    let stat = sys::stat::fstat(fd.as_fd().as_raw_fd())?;
+    Ok((stat.st_dev as u64, stat.st_ino as u64))
+}
+
+pub fn page_size() -> Size {
+    // SAFETY: _SC_PAGESIZE is always valid
+    let size = unsafe { libc::sysconf(libc::_SC_PAGESIZE) };
+    size as Size
+}
+
+// the offset needs not be page-aligned
+pub fn mmap(fd: impl AsFd, offset: Size, size: Size, access: Access) -> Result<Mapping> {
     let prot = access.into();
     let flags = sys::mman::MapFlags::MAP_SHARED;
 
-    let len = num::NonZeroUsize::try_from(usize::try_from(size)?)?;
+    let page_offset = offset % page_size();
+    let map_offset = libc::off_t::try_from(offset - page_offset)?;
+    let map_len = num::NonZeroUsize::try_from(usize::try_from(page_offset + size)?)?;
     let ptr =
         // SAFETY: clients assume the responsibility
-        unsafe { sys::mman::mmap(None, len, prot, flags, fd, 0) }?;
+        unsafe { sys::mman::mmap(None, map_len, prot, flags, fd, map_offset) }?;
+
+    let page_offset = page_offset as usize;
+    let ptr = ptr::NonNull::new(ptr.as_ptr().cast::<u8>().wrapping_add(page_offset)).unwrap();
+    let len = num::NonZeroUsize::try_from(map_len.get() - page_offset)?;
 
-    Ok(Mapping { ptr, len })
+    Ok(Mapping {
+        ptr: ptr.cast(),
+        len,
+    })
 }
 
 pub fn munmap(mapping: Mapping) -> Result<()> {
+    // undo the page alignment in mmap
+    let page_offset = mapping.ptr.as_ptr() as usize % page_size() as usize;
+    let ptr = mapping.ptr.as_ptr().cast::<u8>().wrapping_sub(page_offset);
+    let ptr = ptr::NonNull::new(ptr.cast()).unwrap();
+    let len = mapping.len.get() + page_offset;
+
     // SAFETY: ptr and len are from sys::mman::mmap
-    unsafe { sys::mman::munmap(mapping.ptr, mapping.len.into()) }.map_err(Error::from)
+    unsafe { sys::mman::munmap(ptr, len) }.map_err(Error::from)
 }
 
 pub fn poll(fd: impl AsFd, access: Access) -> Result<()> {
@@ -77,8 +105,23 @@ pub fn poll(fd: impl AsFd, access: Access) -> Result<()> {
 }
 
 pub fn memfd_create(name: &str, size: Size) -> Result<OwnedFd> {
+    memfd_create_sealed(name, size, sys::memfd::MemFdCreateFlag::empty())
+}
+
+// Creates a memfd backed by 2MB hugetlb pages.  The size must be a multiple of 2MB.
+pub fn memfd_create_hugetlb(name: &str, size: Size) -> Result<OwnedFd> {
+    use sys::memfd::MemFdCreateFlag;
+    let flags = MemFdCreateFlag::MFD_HUGETLB | MemFdCreateFlag::MFD_HUGE_2MB;
+    memfd_create_sealed(name, size, flags)
+}
+
+fn memfd_create_sealed(
+    name: &str,
+    size: Size,
+    flags: sys::memfd::MemFdCreateFlag,
+) -> Result<OwnedFd> {
     use sys::memfd::MemFdCreateFlag;
-    let create_flags = MemFdCreateFlag::MFD_CLOEXEC | MemFdCreateFlag::MFD_ALLOW_SEALING;
+    let create_flags = MemFdCreateFlag::MFD_CLOEXEC | MemFdCreateFlag::MFD_ALLOW_SEALING | flags;
     let seal_flags = fcntl::SealFlag::F_SEAL_SHRINK
         | fcntl::SealFlag::F_SEAL_GROW
         | fcntl::SealFlag::F_SEAL_SEAL;
@@ -254,11 +297,16 @@ mod udmabuf {
         open(UDMABUF_PATH)
     }
 
-    pub fn udmabuf_alloc(udmabuf_fd: impl AsFd, memfd: OwnedFd, size: Size) -> Result<OwnedFd> {
+    pub fn udmabuf_alloc(
+        udmabuf_fd: impl AsFd,
+        memfd: impl AsFd,
+        offset: Size,
+        size: Size,
+    ) -> Result<OwnedFd> {
         let arg = udmabuf_create {
-            memfd: memfd.as_raw_fd() as u32,
+            memfd: memfd.as_fd().as_raw_fd() as u32,
             flags: UDMABUF_FLAGS_CLOEXEC,
-            offset: 0,
+            offset,
             size,
         };
 